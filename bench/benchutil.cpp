@@ -0,0 +1,179 @@
+#include "benchutil.h"
+#include "driver.h"
+#include "lexer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#define popen _popen
+#define pclose _pclose
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+size_t CurrentRSS() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS Counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &Counters, sizeof(Counters)))
+        return Counters.WorkingSetSize;
+    return 0;
+#else
+    // The second field of statm is the resident size in pages.
+    FILE *F = fopen("/proc/self/statm", "r");
+    if (!F)
+        return 0;
+    long Pages = 0, Resident = 0;
+    int Read = fscanf(F, "%ld %ld", &Pages, &Resident);
+    fclose(F);
+    return Read == 2 ? size_t(Resident) * size_t(sysconf(_SC_PAGESIZE)) : 0;
+#endif
+}
+
+size_t PeakRSS() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS Counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &Counters, sizeof(Counters)))
+        return Counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage Usage;
+    if (getrusage(RUSAGE_SELF, &Usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return size_t(Usage.ru_maxrss); // bytes
+#else
+    return size_t(Usage.ru_maxrss) * 1024; // KiB
+#endif
+#endif
+}
+
+double Percentile(std::vector<double> Samples, double P) {
+    if (Samples.empty())
+        return 0;
+    std::sort(Samples.begin(), Samples.end());
+    double Rank = P / 100 * (Samples.size() - 1);
+    size_t Lo = size_t(Rank);
+    size_t Hi = std::min(Lo + 1, Samples.size() - 1);
+    return Samples[Lo] + (Rank - Lo) * (Samples[Hi] - Samples[Lo]);
+}
+
+double Mean(const std::vector<double> &Samples) {
+    double Sum = 0;
+    for (double S : Samples)
+        Sum += S;
+    return Samples.empty() ? 0 : Sum / Samples.size();
+}
+
+double MannWhitneyGreater(const std::vector<double> &A, const std::vector<double> &B) {
+    size_t NA = A.size(), NB = B.size(), N = NA + NB;
+    if (!NA || !NB)
+        return 1;
+    // Rank the pooled samples, ties get the mean of their ranks.
+    std::vector<std::pair<double, bool>> Pooled; // value, from A
+    for (double X : A)
+        Pooled.push_back({X, true});
+    for (double X : B)
+        Pooled.push_back({X, false});
+    std::sort(Pooled.begin(), Pooled.end(),
+              [](const std::pair<double, bool> &L, const std::pair<double, bool> &R) { return L.first < R.first; });
+    double RankSumA = 0, TieTerm = 0;
+    for (size_t i = 0; i < N;) {
+        size_t j = i;
+        while (j < N && Pooled[j].first == Pooled[i].first)
+            ++j;
+        double Rank = (i + 1 + j) / 2.0, Ties = double(j - i);
+        for (size_t k = i; k < j; ++k)
+            if (Pooled[k].second)
+                RankSumA += Rank;
+        TieTerm += Ties * Ties * Ties - Ties;
+        i = j;
+    }
+    double U = RankSumA - NA * (NA + 1) / 2.0;
+    double MeanU = NA * NB / 2.0;
+    double VarU = NA * NB / 12.0 * ((N + 1) - TieTerm / (double(N) * (N - 1)));
+    if (VarU <= 0)
+        return U > MeanU ? 0 : 1;
+    // With a continuity correction.
+    double Z = (U - MeanU - 0.5) / std::sqrt(VarU);
+    return 0.5 * std::erfc(Z / std::sqrt(2.0));
+}
+
+double LogLogSlope(const std::vector<double> &X, const std::vector<double> &Y) {
+    double SX = 0, SY = 0, SXX = 0, SXY = 0;
+    size_t N = 0;
+    for (size_t i = 0; i < X.size() && i < Y.size(); ++i) {
+        if (X[i] <= 0 || Y[i] <= 0)
+            continue;
+        double LX = std::log(X[i]), LY = std::log(Y[i]);
+        SX += LX;
+        SY += LY;
+        SXX += LX * LX;
+        SXY += LX * LY;
+        ++N;
+    }
+    double Den = N * SXX - SX * SX;
+    return N < 2 || Den == 0 ? 0 : (N * SXY - SX * SY) / Den;
+}
+
+bool StartDriver() {
+    DriverEcho = EchoLevel::None;
+    return InitializeDriver();
+}
+
+unsigned RunSource(const std::string &Text, PhaseTimes *Total) {
+    unsigned Failed = 0;
+    SetLexerInput(Text);
+    getNextToken();
+    while (CurTok != tok_eof) {
+        HandleTopLevelItem();
+        Failed += !LastItemOk;
+        if (!Total)
+            continue;
+        const PhaseTimes &T = LastPhaseTimes;
+        Total->Parse += T.Parse;
+        Total->Codegen += T.Codegen;
+        Total->Optimize += T.Optimize;
+        Total->JITAdd += T.JITAdd;
+        Total->Lookup += T.Lookup;
+        Total->Execute += T.Execute;
+        Total->Remove += T.Remove;
+    }
+    return Failed;
+}
+
+bool ReadFile(const std::string &Path, std::string &Text) {
+    std::ifstream In(Path, std::ios::binary);
+    if (!In)
+        return false;
+    std::ostringstream SS;
+    SS << In.rdbuf();
+    Text = SS.str();
+    return true;
+}
+
+bool RunCommand(const std::string &Command, std::string &Output) {
+    FILE *P = popen(Command.c_str(), "r");
+    if (!P)
+        return false;
+    Output.clear();
+    char Buffer[4096];
+    size_t Read;
+    while ((Read = fread(Buffer, 1, sizeof(Buffer), P)) > 0)
+        Output.append(Buffer, Read);
+    return pclose(P) == 0;
+}
+
+bool ParseOption(const std::string &Arg, const std::string &Name, std::string &Value) {
+    std::string Prefix = "--" + Name + "=";
+    if (Arg.compare(0, Prefix.size(), Prefix) != 0)
+        return false;
+    Value = Arg.substr(Prefix.size());
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+#include "driver.h"
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Shared pieces of the benchmarks: a clock, memory readings, statistics, and feeding
+// source text through the REPL's driver (src/driver.h) in-process.
+
+typedef std::chrono::steady_clock::time_point TimePoint;
+
+inline TimePoint Now() {
+    return std::chrono::steady_clock::now();
+}
+
+inline double SecondsSince(TimePoint Start) {
+    return std::chrono::duration<double>(Now() - Start).count();
+}
+
+// Resident and peak resident memory of the process in bytes, 0 where unknown.
+size_t CurrentRSS();
+size_t PeakRSS();
+
+// The P-th percentile (0..100) of Samples, by linear interpolation. 0 if empty.
+double Percentile(std::vector<double> Samples, double P);
+double Mean(const std::vector<double> &Samples);
+// One-sided Mann-Whitney U test: the p-value of the hypothesis that samples of A tend
+// to be larger than samples of B (normal approximation with tie correction). Small
+// when A is reliably slower, bigger or later than B.
+double MannWhitneyGreater(const std::vector<double> &A, const std::vector<double> &B);
+// Slope of the least-squares line through (log X, log Y): the growth exponent of Y in X.
+// Points with a value <= 0 are skipped.
+double LogLogSlope(const std::vector<double> &X, const std::vector<double> &Y);
+
+// Set up the driver printing only errors, false if the JIT cannot be created.
+bool StartDriver();
+// Handle every top-level item of Text, like the REPL reading it from stdin. Adds the
+// phase times of every item to Total, if given. Returns the number of items that
+// failed, see LastItemOk.
+unsigned RunSource(const std::string &Text, PhaseTimes *Total = nullptr);
+// The contents of a file, false if it cannot be read.
+bool ReadFile(const std::string &Path, std::string &Text);
+// Run a shell command, collecting its standard output. False unless it exits with 0.
+bool RunCommand(const std::string &Command, std::string &Output);
+
+// "--name=value" options. Returns true and sets Value if Arg is one for Name.
+bool ParseOption(const std::string &Arg, const std::string &Name, std::string &Value);
+
+#endif // BENCHUTIL_H
@@ -0,0 +1,216 @@
+// Compile cost of each kind of AST construct, per node. For every construct and size
+// it generates a definition made of that construct, then times building its IR
+// (codegen without TheFPM), TheFPM, and emitting an object file with the JIT's target
+// machine, the work a lookup does. The module is discarded afterwards, so every sample
+// compiles in the same state. Prints the median over --reps samples as CSV; a cost per
+// node that grows with the size points at a construct to fix in the front end.
+//
+//   kaleido_bench_construct_costs [--sizes=8,64,512] [--reps=20] [--construct=NAME]
+
+#include "benchutil.h"
+#include "KaleidoscopeJIT.h"
+#include "codegen.h"
+#include "lexer.h"
+#include "parser.h"
+#include "visitor.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+struct CountNodes : ExprVisitor<CountNodes> {
+    unsigned N = 0;
+    void visitExpr(ExprAST *E) {
+        ++N;
+        visitChildren(E);
+    }
+};
+
+static std::string Var(const char *Prefix, unsigned I) {
+    return Prefix + std::to_string(I);
+}
+
+// Each generator returns "(params) body" for a definition with N of its construct.
+static std::string BinaryChain(unsigned N) {
+    std::string Body = "x";
+    const char *Ops[] = {" + ", " * ", " - ", " * "};
+    for (unsigned i = 0; i < N; ++i)
+        Body += Ops[i % 4] + std::string(i % 2 ? "y" : "x");
+    return "(x y) " + Body;
+}
+
+static std::string NestedIf(unsigned N) {
+    std::string Body;
+    for (unsigned i = 0; i < N; ++i)
+        Body += "if x < " + std::to_string(i) + " then " + std::to_string(i) + " else ";
+    return "(x) " + Body + "x";
+}
+
+static std::string ForNest(unsigned N) {
+    std::string Body;
+    for (unsigned i = 0; i < N; ++i)
+        Body += "for " + Var("i", i) + " = 0, " + Var("i", i) + " < 2 in ";
+    return "(x) " + Body + "x";
+}
+
+static std::string VarBindings(unsigned N) {
+    std::string Body = "var a0 = x";
+    for (unsigned i = 1; i < N; ++i)
+        Body += ", " + Var("a", i) + " = " + Var("a", i - 1) + " + x";
+    return "(x) " + Body + " in " + Var("a", N - 1);
+}
+
+// The operators are defined by Setup below.
+static std::string UserOperators(unsigned N) {
+    std::string Body = "x";
+    for (unsigned i = 0; i < N; ++i)
+        Body += i % 2 ? " | !y" : " & x";
+    return "(x y) " + Body;
+}
+
+static std::string CallArguments(unsigned N) {
+    std::string Body = "callee" + std::to_string(N) + "(x";
+    for (unsigned i = 1; i < N; ++i)
+        Body += ", x + " + std::to_string(i);
+    return "(x) " + Body + ")";
+}
+
+static std::string CalleeExtern(unsigned N) {
+    std::string Params;
+    for (unsigned i = 0; i < N; ++i)
+        Params += " " + Var("a", i);
+    return "extern callee" + std::to_string(N) + "(" + Params + ");";
+}
+
+struct Construct {
+    const char *Name;
+    std::string (*Generate)(unsigned N);
+};
+
+static const Construct Constructs[] = {
+    {"binary", BinaryChain}, {"if", NestedIf},         {"for", ForNest},
+    {"var", VarBindings},    {"userop", UserOperators}, {"call", CallArguments},
+};
+
+static const char *Setup = "def binary & 6 (L R) if L then R else 0;"
+                           "def binary | 5 (L R) if L then 1 else if R then 1 else 0;"
+                           "def unary!(v) if v then 0 else 1;";
+
+struct Sample {
+    double IR = 0, FPM = 0, Object = 0;
+};
+
+// Compile one definition into the current module, then drop the module.
+static bool CompileOnce(const std::string &Source, const std::string &Name, Sample &S, unsigned &Nodes) {
+    SetLexerInput(Source);
+    getNextToken();
+    auto FnAST = ParseDefinition();
+    if (!FnAST)
+        return false;
+    CountNodes Count;
+    Count.visit(FnAST->getBody());
+    Nodes = Count.N;
+
+    double PassesBefore = FunctionPassSeconds;
+    TimePoint Start = Now();
+    llvm::Function *F = FnAST->codegen();
+    double Codegen = SecondsSince(Start);
+    S.FPM = FunctionPassSeconds - PassesBefore;
+    S.IR = Codegen - S.FPM;
+    bool Ok = F != nullptr;
+    if (Ok) {
+        llvm::SmallVector<char, 0> Buffer;
+        llvm::raw_svector_ostream OS(Buffer);
+        llvm::legacy::PassManager PM;
+#if LLVM_VERSION_MAJOR >= 18
+        llvm::CodeGenFileType FileType = llvm::CodeGenFileType::ObjectFile;
+#else
+        llvm::CodeGenFileType FileType = llvm::CGFT_ObjectFile;
+#endif
+        Ok = !TheJIT->getTargetMachine().addPassesToEmitFile(PM, OS, nullptr, FileType);
+        Start = Now();
+        if (Ok)
+            PM.run(*TheModule);
+        S.Object = SecondsSince(Start);
+    }
+    FunctionProtos.erase(Name);
+    InitializeModule();
+    return Ok;
+}
+
+static std::vector<unsigned> ParseSizes(const std::string &List) {
+    std::vector<unsigned> Sizes;
+    for (size_t Pos = 0; Pos < List.size();) {
+        size_t Comma = List.find(',', Pos);
+        if (Comma == std::string::npos)
+            Comma = List.size();
+        long N = std::atol(List.substr(Pos, Comma - Pos).c_str());
+        if (N > 0)
+            Sizes.push_back(unsigned(N));
+        Pos = Comma + 1;
+    }
+    return Sizes;
+}
+
+int main(int argc, char **argv) {
+    std::vector<unsigned> Sizes = {8, 64, 512};
+    long Reps = 20;
+    std::string Only;
+    for (int i = 1; i < argc; ++i) {
+        std::string Value;
+        if (ParseOption(argv[i], "sizes", Value)) {
+            Sizes = ParseSizes(Value);
+        } else if (ParseOption(argv[i], "reps", Value)) {
+            Reps = std::atol(Value.c_str());
+        } else if (ParseOption(argv[i], "construct", Value)) {
+            Only = Value;
+        } else {
+            fprintf(stderr, "usage: %s [--sizes=N,N,...] [--reps=N] [--construct=NAME]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (Sizes.empty() || Reps < 1)
+        return 1;
+    if (!StartDriver())
+        return 1;
+    RunSource(Setup);
+    for (unsigned N : Sizes)
+        RunSource(CalleeExtern(N));
+
+    printf("construct,size,nodes,ir_ns_per_node,fpm_ns_per_node,object_ns_per_node,ir_us,fpm_us,object_us\n");
+    unsigned Serial = 0;
+    for (auto &C : Constructs) {
+        if (!Only.empty() && Only != C.Name)
+            continue;
+        std::vector<double> NodeCounts, Totals;
+        for (unsigned N : Sizes) {
+            std::vector<double> IR, FPM, Object;
+            unsigned Nodes = 0;
+            // A new name for every sample, so none finds anything of an earlier one.
+            for (long r = 0; r < Reps; ++r) {
+                std::string Name = "bench" + std::to_string(Serial++);
+                Sample S;
+                if (!CompileOnce("def " + Name + C.Generate(N) + ";", Name, S, Nodes)) {
+                    fprintf(stderr, "%s with %u failed to compile\n", C.Name, N);
+                    return 1;
+                }
+                IR.push_back(S.IR);
+                FPM.push_back(S.FPM);
+                Object.push_back(S.Object);
+            }
+            double MIR = Percentile(IR, 50), MFPM = Percentile(FPM, 50), MObject = Percentile(Object, 50);
+            printf("%s,%u,%u,%.1f,%.1f,%.1f,%.3f,%.3f,%.3f\n", C.Name, N, Nodes, MIR / Nodes * 1e9,
+                   MFPM / Nodes * 1e9, MObject / Nodes * 1e9, MIR * 1e6, MFPM * 1e6, MObject * 1e6);
+            fflush(stdout);
+            NodeCounts.push_back(Nodes);
+            Totals.push_back(MIR + MFPM + MObject);
+        }
+        if (Sizes.size() > 1)
+            fprintf(stderr, "%-7s compile time grows as nodes^%.2f\n", C.Name, LogLogSlope(NodeCounts, Totals));
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+// Cost per definition as a session grows: feeds N generated defs through
+// HandleDefinition() one at a time, then looks each one up, which makes the JIT emit
+// and link its module. Prints one CSV row per window of definitions and, at the end,
+// the growth exponent of every cost: ~0 when the per-definition cost stays flat, 1 when
+// it grows linearly with the session, i.e. the session as a whole is quadratic.
+// codegen_us includes parsing; lookup_new_us is object emission and linking.
+//
+//   kaleido_bench_jit_scaling [--defs=100000] [--windows=50] [--fail-above=EXPONENT]
+
+#include "benchutil.h"
+#include "driver.h"
+#include "KaleidoscopeJIT.h"
+#include "codegen.h"
+#include "lexer.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Each definition calls an earlier one, so codegen declares it from FunctionProtos and
+// the link resolves it in MainJD.
+static std::string GenerateDefinition(long I) {
+    std::string N = std::to_string(I);
+    if (I == 0)
+        return "def f0(x y) x * y + 1;";
+    return "def f" + N + "(x y) if x < " + N + " then f" + std::to_string(I / 2) +
+           "(x + 1, y) * 0.5 else y + " + N + ";";
+}
+
+static bool Lookup(const std::string &Name) {
+    auto Sym = TheJIT->lookup(Name);
+    if (!Sym) {
+        llvm::errs() << "JIT Lookup Error: " << Sym.takeError() << "\n";
+        return false;
+    }
+    return true;
+}
+
+struct Window {
+    long Defs = 0;
+    std::vector<double> Codegen, Optimize, JITAdd, LookupNew, LookupOld;
+    size_t RSS = 0;
+};
+
+int main(int argc, char **argv) {
+    long NumDefs = 100000, NumWindows = 50;
+    double FailAbove = -1;
+    for (int i = 1; i < argc; ++i) {
+        std::string Value;
+        if (ParseOption(argv[i], "defs", Value)) {
+            NumDefs = std::atol(Value.c_str());
+        } else if (ParseOption(argv[i], "windows", Value)) {
+            NumWindows = std::atol(Value.c_str());
+        } else if (ParseOption(argv[i], "fail-above", Value)) {
+            FailAbove = std::atof(Value.c_str());
+        } else {
+            fprintf(stderr, "usage: %s [--defs=N] [--windows=N] [--fail-above=EXPONENT]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (NumDefs < 1 || NumWindows < 1)
+        return 1;
+    if (!StartDriver())
+        return 1;
+
+    long WindowSize = std::max(1L, NumDefs / NumWindows);
+    std::vector<Window> Windows;
+    Window Cur;
+    printf("defs,codegen_us,optimize_us,jit_add_us,lookup_new_us,lookup_old_us,lookup_new_p99_us,rss_mb\n");
+    for (long I = 0; I < NumDefs; ++I) {
+        SetLexerInput(GenerateDefinition(I));
+        getNextToken();
+        HandleDefinition();
+        if (LastPhaseTimes.JITAdd == 0) {
+            fprintf(stderr, "definition %ld failed\n", I);
+            return 1;
+        }
+
+        // The first lookup of a new function emits and links its module; looking up
+        // the oldest one only searches the symbol tables.
+        TimePoint Start = Now();
+        if (!Lookup("f" + std::to_string(I)))
+            return 1;
+        double LookupNew = SecondsSince(Start);
+        Start = Now();
+        if (!Lookup("f0"))
+            return 1;
+        double LookupOld = SecondsSince(Start);
+
+        Cur.Codegen.push_back(LastPhaseTimes.Parse + LastPhaseTimes.Codegen);
+        Cur.Optimize.push_back(LastPhaseTimes.Optimize);
+        Cur.JITAdd.push_back(LastPhaseTimes.JITAdd);
+        Cur.LookupNew.push_back(LookupNew);
+        Cur.LookupOld.push_back(LookupOld);
+        if ((I + 1) % WindowSize != 0 && I + 1 != NumDefs)
+            continue;
+
+        Cur.Defs = I + 1;
+        Cur.RSS = CurrentRSS();
+        printf("%ld,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f\n", Cur.Defs, Mean(Cur.Codegen) * 1e6,
+               Mean(Cur.Optimize) * 1e6, Mean(Cur.JITAdd) * 1e6, Mean(Cur.LookupNew) * 1e6,
+               Mean(Cur.LookupOld) * 1e6, Percentile(Cur.LookupNew, 99) * 1e6, Cur.RSS / 1048576.0);
+        fflush(stdout);
+        Windows.push_back(std::move(Cur));
+        Cur = Window();
+    }
+
+    // Growth of the mean cost of a window with the size of the session.
+    std::vector<double> Defs, Codegen, Optimize, JITAdd, LookupNew, LookupOld;
+    for (auto &W : Windows) {
+        Defs.push_back(W.Defs);
+        Codegen.push_back(Mean(W.Codegen));
+        Optimize.push_back(Mean(W.Optimize));
+        JITAdd.push_back(Mean(W.JITAdd));
+        LookupNew.push_back(Mean(W.LookupNew));
+        LookupOld.push_back(Mean(W.LookupOld));
+    }
+    struct Curve {
+        const char *Name;
+        double Exponent;
+    } Curves[] = {
+        {"codegen", LogLogSlope(Defs, Codegen)},       {"optimize", LogLogSlope(Defs, Optimize)},
+        {"jit_add", LogLogSlope(Defs, JITAdd)},        {"lookup_new", LogLogSlope(Defs, LookupNew)},
+        {"lookup_old", LogLogSlope(Defs, LookupOld)},
+    };
+    bool Failed = false;
+    fprintf(stderr, "growth exponent of the cost per definition over %ld definitions:\n", NumDefs);
+    for (auto &C : Curves) {
+        bool Over = FailAbove >= 0 && C.Exponent > FailAbove;
+        fprintf(stderr, "  %-10s %+.3f%s\n", C.Name, C.Exponent, Over ? "  superlinear" : "");
+        Failed |= Over;
+    }
+    if (Windows.size() > 1) {
+        const Window &First = Windows.front(), &Last = Windows.back();
+        double Bytes = double(Last.RSS) - double(First.RSS);
+        fprintf(stderr, "  memory     %.0f bytes per definition\n", Bytes / double(Last.Defs - First.Defs));
+    }
+    return Failed ? 1 : 0;
+}
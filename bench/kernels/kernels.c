@@ -0,0 +1,54 @@
+/* The C reference versions of the kernels in this directory, compiled by the host
+ * compiler at -O2. Each computes the same value as its .kal twin, in the same order of
+ * floating point operations, so the results match exactly. */
+#include <stdlib.h>
+
+double c_fib(double n) {
+    return n < 2 ? n : c_fib(n - 1) + c_fib(n - 2);
+}
+
+static double mandeliter(double cr, double ci) {
+    double zr = 0, zi = 0;
+    int it = 0;
+    while (it < 255) {
+        double t = zr * zr - zi * zi + cr;
+        zi = 2 * zr * zi + ci;
+        zr = t;
+        ++it;
+        if (!(zr * zr + zi * zi < 4))
+            break;
+    }
+    return it;
+}
+
+double c_mandel(double n) {
+    double sum = 0;
+    for (double y = 0; y < n; ++y)
+        for (double x = 0; x < n; ++x)
+            sum += mandeliter(x * 3 / n - 2, y * 3 / n - 1.5);
+    return sum;
+}
+
+double c_integrate(double n) {
+    double acc = 0, h = 1 / n;
+    for (double i = 0; i < n; ++i) {
+        double x = (i + 0.5) * h;
+        acc += 4 / (1 + x * x);
+    }
+    return acc * h;
+}
+
+double c_reduce(double n) {
+    long len = (long)n;
+    double *a = calloc(len, sizeof(double));
+    double s = 0;
+    if (!a)
+        return 0;
+    for (long i = 0; i < len; ++i)
+        a[i] = i * 0.5;
+    for (int r = 0; r < 10; ++r)
+        for (long i = 0; i < len; ++i)
+            s += a[i] * a[i];
+    free(a);
+    return s;
+}
@@ -0,0 +1,106 @@
+// How far JIT-compiled Kaleidoscope is from native code: times each kernel of
+// kernels/ as compiled by the JIT and as compiled by the host C compiler at -O2
+// (kernels.c), and prints the Kaleidoscope/C ratio of their median run times as CSV.
+// Only the calls are timed; compiling the Kaleidoscope happens before, at the lookup.
+//
+//   kaleido_bench_native_ratio --kernels=DIR [--reps=5] [--kernel=NAME]
+
+#include "benchutil.h"
+#include "KaleidoscopeJIT.h"
+#include "codegen.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+extern "C" {
+double c_fib(double N);
+double c_mandel(double N);
+double c_integrate(double N);
+double c_reduce(double N);
+}
+
+typedef double (*KernelFn)(double);
+
+struct Kernel {
+    const char *Name;     // kernels/<Name>.kal defines k<Name>
+    KernelFn Native;
+    double Arg;
+};
+
+static const Kernel Kernels[] = {
+    {"fib", c_fib, 30},
+    {"mandel", c_mandel, 600},
+    {"integrate", c_integrate, 2e7},
+    {"reduce", c_reduce, 1e6},
+};
+
+static double MedianTime(KernelFn Fn, double Arg, long Reps, double &Result) {
+    std::vector<double> Times;
+    Result = Fn(Arg); // warm up caches and the arena
+    for (long i = 0; i < Reps; ++i) {
+        TimePoint Start = Now();
+        Result = Fn(Arg);
+        Times.push_back(SecondsSince(Start));
+    }
+    return Percentile(Times, 50);
+}
+
+int main(int argc, char **argv) {
+    std::string Dir, Only;
+    long Reps = 5;
+    for (int i = 1; i < argc; ++i) {
+        std::string Value;
+        if (ParseOption(argv[i], "kernels", Value)) {
+            Dir = Value;
+        } else if (ParseOption(argv[i], "reps", Value)) {
+            Reps = std::atol(Value.c_str());
+        } else if (ParseOption(argv[i], "kernel", Value)) {
+            Only = Value;
+        } else {
+            fprintf(stderr, "usage: %s --kernels=DIR [--reps=N] [--kernel=NAME]\n", argv[0]);
+            return 1;
+        }
+    }
+    std::string Prelude;
+    if (Dir.empty() || Reps < 1 || !ReadFile(Dir + "/prelude.kal", Prelude)) {
+        fprintf(stderr, "cannot read the kernels in '%s'\n", Dir.c_str());
+        return 1;
+    }
+    if (!StartDriver())
+        return 1;
+    RunSource(Prelude);
+
+    bool Ok = true;
+    printf("kernel,arg,kaleidoscope_ms,c_ms,ratio,result\n");
+    for (auto &K : Kernels) {
+        if (!Only.empty() && Only != K.Name)
+            continue;
+        std::string Source;
+        if (!ReadFile(Dir + "/" + K.Name + ".kal", Source)) {
+            fprintf(stderr, "cannot read %s.kal\n", K.Name);
+            return 1;
+        }
+        RunSource(Source);
+        auto Sym = TheJIT->lookup("k" + std::string(K.Name));
+        if (!Sym) {
+            llvm::errs() << "JIT Lookup Error: " << Sym.takeError() << "\n";
+            return 1;
+        }
+        KernelFn JITFn = Sym->getAddress().toPtr<KernelFn>();
+
+        double JITResult, NativeResult;
+        double JITTime = MedianTime(JITFn, K.Arg, Reps, JITResult);
+        double NativeTime = MedianTime(K.Native, K.Arg, Reps, NativeResult);
+        // Both evaluate the same operations in the same order.
+        bool Match = std::fabs(JITResult - NativeResult) <= 1e-9 * std::fabs(NativeResult);
+        Ok &= Match;
+        printf("%s,%g,%.3f,%.3f,%.2f,%s\n", K.Name, K.Arg, JITTime * 1e3, NativeTime * 1e3, JITTime / NativeTime,
+               Match ? "match" : "MISMATCH");
+        fflush(stdout);
+        if (!Match)
+            fprintf(stderr, "%s: Kaleidoscope %.17g, C %.17g\n", K.Name, JITResult, NativeResult);
+    }
+    return Ok ? 0 : 1;
+}
@@ -0,0 +1,185 @@
+// Performance regression gate, run by CTest (label "perf"). Runs a program --samples
+// times, each in a new process, measuring compile time (parse, codegen, optimization,
+// JIT add and the lookups that emit code), run time and peak memory. Then compares
+// every metric with the samples stored in <baselines>/<program>.json by the one-sided
+// Mann-Whitney U test. A metric regresses when it is larger with p < --alpha and its
+// median grew by more than --tolerance; both, so neither noise nor a tiny but
+// consistent change fails the gate. --update records new baselines instead.
+//
+// Exits with 0 when nothing regressed and 1 on a regression or an error. A missing
+// baseline is an error too, so a gate without baselines cannot pass unnoticed, unless
+// --allow-missing-baseline makes it exit with 77 (skipped) instead. Baselines belong to
+// the machine they were recorded on, see update_baselines.cmake.
+//
+//   kaleido_perf_gate --program=NAME --programs=DIR --baselines=DIR [--samples=15]
+//                     [--alpha=0.01] [--tolerance=0.10] [--update] [--allow-missing-baseline]
+
+#include "benchutil.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+static const char *MetricNames[] = {"compile_s", "run_s", "peak_rss_bytes"};
+static const unsigned NumMetrics = sizeof(MetricNames) / sizeof(MetricNames[0]);
+
+typedef std::vector<double> Samples[NumMetrics];
+
+// A library of Defs generated definitions, each calling an earlier one, and a call
+// through the whole chain: the cost of a session that loaded a large library.
+static std::string GenerateLibrary(unsigned Defs) {
+    std::string Text = "def lib0(x) x + 1;\n";
+    for (unsigned i = 1; i < Defs; ++i)
+        Text += "def lib" + std::to_string(i) + "(x) if x < " + std::to_string(i % 7) + " then x * 2 else lib" +
+                std::to_string(i - 1) + "(x - 1) + 1;\n";
+    return Text + "lib" + std::to_string(Defs - 1) + "(" + std::to_string(Defs) + ");\n";
+}
+
+static bool LoadProgram(const std::string &Name, const std::string &Dir, std::string &Text) {
+    if (Name == "library") {
+        Text = GenerateLibrary(2000);
+        return true;
+    }
+    return ReadFile(Dir + "/" + Name + ".kal", Text);
+}
+
+// One sample, in this (child) process: the metrics on stdout.
+static int RunChild(const std::string &Text) {
+    if (!StartDriver())
+        return 1;
+    PhaseTimes Total;
+    if (unsigned Failed = RunSource(Text, &Total)) {
+        fprintf(stderr, "%u items of the program failed\n", Failed);
+        return 1;
+    }
+    double Compile = Total.Parse + Total.Codegen + Total.Optimize + Total.JITAdd + Total.Lookup + Total.Remove;
+    printf("%.9f %.9f %.0f\n", Compile, Total.Execute, double(PeakRSS()));
+    return 0;
+}
+
+static bool ReadBaseline(const std::string &Path, Samples &S) {
+    std::string Text;
+    if (!ReadFile(Path, Text))
+        return false;
+    for (unsigned m = 0; m < NumMetrics; ++m) {
+        size_t Key = Text.find("\"" + std::string(MetricNames[m]) + "\"");
+        size_t Open = Key == std::string::npos ? Key : Text.find('[', Key);
+        if (Open == std::string::npos)
+            return false;
+        const char *P = Text.c_str() + Open + 1;
+        for (;;) {
+            while (*P == ' ' || *P == '\n' || *P == ',')
+                ++P;
+            if (*P == ']')
+                break;
+            char *End;
+            double V = std::strtod(P, &End);
+            if (End == P)
+                return false;
+            S[m].push_back(V);
+            P = End;
+        }
+    }
+    return true;
+}
+
+static bool WriteBaseline(const std::string &Path, const std::string &Program, const Samples &S) {
+    FILE *F = fopen(Path.c_str(), "w");
+    if (!F)
+        return false;
+    fprintf(F, "{\n  \"program\": \"%s\"", Program.c_str());
+    for (unsigned m = 0; m < NumMetrics; ++m) {
+        fprintf(F, ",\n  \"%s\": [", MetricNames[m]);
+        for (size_t i = 0; i < S[m].size(); ++i)
+            fprintf(F, "%s%.9g", i ? ", " : "", S[m][i]);
+        fprintf(F, "]");
+    }
+    fprintf(F, "\n}\n");
+    return fclose(F) == 0;
+}
+
+int main(int argc, char **argv) {
+    std::string Program, ProgramDir = ".", BaselineDir = ".";
+    long NumSamples = 15;
+    double Alpha = 0.01, Tolerance = 0.10;
+    bool Update = false, Child = false, AllowMissingBaseline = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string Arg = argv[i], Value;
+        if (ParseOption(Arg, "program", Value)) {
+            Program = Value;
+        } else if (ParseOption(Arg, "programs", Value)) {
+            ProgramDir = Value;
+        } else if (ParseOption(Arg, "baselines", Value)) {
+            BaselineDir = Value;
+        } else if (ParseOption(Arg, "samples", Value)) {
+            NumSamples = std::atol(Value.c_str());
+        } else if (ParseOption(Arg, "alpha", Value)) {
+            Alpha = std::atof(Value.c_str());
+        } else if (ParseOption(Arg, "tolerance", Value)) {
+            Tolerance = std::atof(Value.c_str());
+        } else if (Arg == "--update") {
+            Update = true;
+        } else if (Arg == "--allow-missing-baseline") {
+            AllowMissingBaseline = true;
+        } else if (Arg == "--child") {
+            Child = true;
+        } else {
+            fprintf(stderr, "usage: %s --program=NAME --programs=DIR --baselines=DIR [--samples=N] "
+                            "[--alpha=P] [--tolerance=FRACTION] [--update] [--allow-missing-baseline]\n", argv[0]);
+            return 1;
+        }
+    }
+    std::string Text;
+    if (Program.empty() || !LoadProgram(Program, ProgramDir, Text)) {
+        fprintf(stderr, "cannot read program '%s'\n", Program.c_str());
+        return 1;
+    }
+    if (Child)
+        return RunChild(Text);
+    if (NumSamples < 2)
+        return 1;
+
+    std::string BaselinePath = BaselineDir + "/" + Program + ".json";
+    Samples Baseline;
+    if (!Update && !ReadBaseline(BaselinePath, Baseline)) {
+        fprintf(stderr, "no baseline %s, record one with update_baselines.cmake\n", BaselinePath.c_str());
+        return AllowMissingBaseline ? 77 : 1;
+    }
+
+    Samples Current;
+    std::string Command = "\"" + std::string(argv[0]) + "\" --child --program=" + Program + " \"--programs=" +
+                          ProgramDir + "\"";
+    for (long i = 0; i < NumSamples; ++i) {
+        std::string Output;
+        double Values[NumMetrics];
+        if (!RunCommand(Command, Output) ||
+            sscanf(Output.c_str(), "%lf %lf %lf", &Values[0], &Values[1], &Values[2]) != int(NumMetrics)) {
+            fprintf(stderr, "sample %ld of %s failed\n", i, Program.c_str());
+            return 1;
+        }
+        for (unsigned m = 0; m < NumMetrics; ++m)
+            Current[m].push_back(Values[m]);
+    }
+
+    if (Update) {
+        if (!WriteBaseline(BaselinePath, Program, Current)) {
+            fprintf(stderr, "cannot write %s\n", BaselinePath.c_str());
+            return 1;
+        }
+        printf("recorded %s\n", BaselinePath.c_str());
+        return 0;
+    }
+
+    bool Regressed = false;
+    printf("%-16s %14s %14s %8s %10s\n", "metric", "baseline", "current", "change", "p");
+    for (unsigned m = 0; m < NumMetrics; ++m) {
+        double Base = Percentile(Baseline[m], 50), Cur = Percentile(Current[m], 50);
+        double Change = Base > 0 ? Cur / Base - 1 : 0;
+        double P = MannWhitneyGreater(Current[m], Baseline[m]);
+        bool Worse = P < Alpha && Change > Tolerance;
+        printf("%-16s %14.6g %14.6g %+7.1f%% %10.2g%s\n", MetricNames[m], Base, Cur, Change * 100, P,
+               Worse ? "  REGRESSED" : "");
+        Regressed |= Worse;
+    }
+    return Regressed ? 1 : 0;
+}
@@ -0,0 +1,3 @@
+# The programs of the performance gate: programs/<name>.kal, except "library", which
+# perf_gate.cpp generates.
+set(KALEIDO_PERF_PROGRAMS mandelbrot recursive loops library)
@@ -0,0 +1,161 @@
+// Time to first result of top-level expressions: from reading the expression to
+// having its value, as a REPL user sees it. Runs a mix of typical expressions through
+// HandleTopLevelExpression() and prints the p50/p99/p999 of every phase (driver.h) and
+// of the total, as CSV.
+//
+// warm: one session, the definitions are read once and the mix runs --samples times.
+// cold: every sample is a new process (this program, with --cold-child), so startup,
+//       the JIT's creation and the definitions count too, in the "startup" phase.
+//
+//   kaleido_bench_repl_latency [--mode=warm|cold] [--samples=N] [--backend=auto|jit]
+
+#include "benchutil.h"
+#include "bytecode.h"
+#include "driver.h"
+#include "lexer.h"
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+static const char *Definitions =
+    "def binary : 1 (x y) y;"
+    "extern sin(x);"
+    "def sq(x) x * x;"
+    "def fib(n) if n < 3 then 1 else fib(n - 1) + fib(n - 2);"
+    "def sumto(n) var a = 0 in (for i = 0, i < n in a = a + i) : a;";
+
+// What users type most: constants, calls of their definitions and small loops.
+static const char *Mix[] = {
+    "42;",
+    "1 + 2 * 3;",
+    "sq(12);",
+    "fib(15);",
+    "sin(0.5) + sq(2);",
+    "sumto(100);",
+    "var a = 0 in (for i = 0, i < 100 in a = a + sq(i)) : a;",
+    "(1 + 2i) * (3 - 1i);",
+};
+static const unsigned MixSize = sizeof(Mix) / sizeof(Mix[0]);
+
+static const char *PhaseNames[] = {"startup", "parse", "codegen", "optimize", "jit_add",
+                                   "lookup",  "execute", "remove", "total"};
+static const unsigned NumPhases = sizeof(PhaseNames) / sizeof(PhaseNames[0]);
+
+typedef std::vector<double> Sample; // seconds, one per phase
+
+static Sample RunExpression(const char *Expr, double Startup) {
+    SetLexerInput(Expr);
+    getNextToken();
+    TimePoint Start = Now();
+    HandleTopLevelExpression();
+    double Total = SecondsSince(Start) + Startup;
+    const PhaseTimes &T = LastPhaseTimes;
+    if (!LastEvaluationOk)
+        fprintf(stderr, "evaluation of \"%s\" failed\n", Expr);
+    return {Startup, T.Parse, T.Codegen, T.Optimize, T.JITAdd, T.Lookup, T.Execute, T.Remove, Total};
+}
+
+// One sample of a cold process: start, define, evaluate Mix[Index], print the phases.
+static int RunColdChild(unsigned Index) {
+    TimePoint Start = Now();
+    if (!StartDriver())
+        return 1;
+    RunSource(Definitions);
+    Sample S = RunExpression(Mix[Index], SecondsSince(Start));
+    for (unsigned i = 0; i < NumPhases; ++i)
+        printf("%s%.9f", i ? "," : "", S[i]);
+    printf("\n");
+    return LastEvaluationOk ? 0 : 1;
+}
+
+static bool RunColdSample(const std::string &Self, const std::string &BackendName, unsigned Index, Sample &S) {
+    std::string Command = "\"" + Self + "\" --cold-child=" + std::to_string(Index) + " --backend=" + BackendName;
+    // The process starting and exiting is part of what a cold user waits for.
+    TimePoint Start = Now();
+    std::string Output;
+    bool Ok = RunCommand(Command, Output);
+    double Total = SecondsSince(Start);
+    S.assign(NumPhases, 0);
+    const char *P = Output.c_str();
+    for (unsigned i = 0; i + 1 < NumPhases && Ok; ++i) {
+        char *End;
+        S[i] = std::strtod(P, &End);
+        Ok = End != P;
+        P = *End == ',' ? End + 1 : End;
+    }
+    S[NumPhases - 1] = Total;
+    return Ok;
+}
+
+static void PrintReport(const char *Mode, const std::vector<Sample> &Samples,
+                        const std::map<unsigned, std::vector<double>> &Totals) {
+    printf("mode,phase,p50_us,p99_us,p999_us,mean_us\n");
+    for (unsigned p = 0; p < NumPhases; ++p) {
+        std::vector<double> Phase;
+        for (auto &S : Samples)
+            Phase.push_back(S[p] * 1e6);
+        printf("%s,%s,%.3f,%.3f,%.3f,%.3f\n", Mode, PhaseNames[p], Percentile(Phase, 50), Percentile(Phase, 99),
+               Percentile(Phase, 99.9), Mean(Phase));
+    }
+    fprintf(stderr, "total per expression (p50 / p99, us):\n");
+    for (auto &T : Totals)
+        fprintf(stderr, "  %9.1f %9.1f  %s\n", Percentile(T.second, 50), Percentile(T.second, 99), Mix[T.first]);
+}
+
+int main(int argc, char **argv) {
+    std::string Mode = "warm", BackendName = "auto";
+    long Samples = 1000;
+    for (int i = 1; i < argc; ++i) {
+        std::string Value;
+        if (ParseOption(argv[i], "mode", Value) && (Value == "warm" || Value == "cold")) {
+            Mode = Value;
+        } else if (ParseOption(argv[i], "samples", Value)) {
+            Samples = std::atol(Value.c_str());
+        } else if (ParseOption(argv[i], "backend", Value) && (Value == "auto" || Value == "jit")) {
+            BackendName = Value;
+            TopLevelBackend = Value == "jit" ? Backend::JIT : Backend::Auto;
+        } else if (ParseOption(argv[i], "cold-child", Value)) {
+            Mode = "child:" + Value;
+        } else {
+            fprintf(stderr, "usage: %s [--mode=warm|cold] [--samples=N] [--backend=auto|jit]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (Mode.compare(0, 6, "child:") == 0)
+        return RunColdChild(unsigned(std::atoi(Mode.c_str() + 6)) % MixSize);
+    if (Samples < 1)
+        return 1;
+
+    // Every expression of the mix is sampled equally often, in turn.
+    std::vector<Sample> All;
+    std::map<unsigned, std::vector<double>> Totals;
+    if (Mode == "cold") {
+        for (long i = 0; i < Samples; ++i) {
+            Sample S;
+            if (!RunColdSample(argv[0], BackendName, i % MixSize, S)) {
+                fprintf(stderr, "cold sample %ld failed\n", i);
+                return 1;
+            }
+            Totals[i % MixSize].push_back(S.back() * 1e6);
+            All.push_back(S);
+        }
+    } else {
+        if (!StartDriver())
+            return 1;
+        RunSource(Definitions);
+        // One round first, so the first compile of each function is not a sample.
+        for (unsigned i = 0; i < MixSize; ++i)
+            RunExpression(Mix[i], 0);
+        for (long i = 0; i < Samples; ++i) {
+            Sample S = RunExpression(Mix[i % MixSize], 0);
+            if (!LastEvaluationOk)
+                return 1;
+            Totals[i % MixSize].push_back(S.back() * 1e6);
+            All.push_back(S);
+        }
+    }
+    PrintReport(Mode.c_str(), All, Totals);
+    return 0;
+}
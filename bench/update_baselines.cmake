@@ -0,0 +1,29 @@
+# Record new baselines for the performance gate (perf_gate.cpp) on this machine:
+#
+#   cmake --build build --target update_perf_baselines
+#
+# or directly
+#
+#   cmake -DGATE=<path to kaleido_perf_gate> -P bench/update_baselines.cmake
+#
+# Baselines are timings of one machine, so record them on the machine that runs the
+# gate, with the tree the later runs should be compared against, and commit them.
+if(NOT GATE)
+    message(FATAL_ERROR "set GATE to the kaleido_perf_gate executable")
+endif()
+get_filename_component(BENCH_DIR "${CMAKE_CURRENT_LIST_FILE}" DIRECTORY)
+if(NOT SAMPLES)
+    set(SAMPLES 15)
+endif()
+
+include("${BENCH_DIR}/perf_programs.cmake")
+file(MAKE_DIRECTORY "${BENCH_DIR}/baselines")
+foreach(PROGRAM ${KALEIDO_PERF_PROGRAMS})
+    execute_process(
+        COMMAND "${GATE}" --update --program=${PROGRAM} "--programs=${BENCH_DIR}/programs"
+                "--baselines=${BENCH_DIR}/baselines" --samples=${SAMPLES}
+        RESULT_VARIABLE RESULT)
+    if(NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "recording the baseline of ${PROGRAM} failed")
+    endif()
+endforeach()
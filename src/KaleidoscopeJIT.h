@@ -27,6 +27,7 @@
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/Target/TargetMachine.h"
 #include <memory>
 
 namespace llvm {
@@ -39,6 +40,9 @@ private:
   DataLayout DL;
   MangleAndInterner Mangle;
 
+  // Host target machine, so the optimizer gets real target cost information.
+  std::unique_ptr<TargetMachine> TM;
+
   RTDyldObjectLinkingLayer ObjectLayer;
   IRCompileLayer CompileLayer;
 
@@ -48,6 +52,7 @@ public:
   KaleidoscopeJIT(std::unique_ptr<ExecutionSession> ES,
                   JITTargetMachineBuilder JTMB, DataLayout DL)
       : ES(std::move(ES)), DL(std::move(DL)), Mangle(*this->ES, this->DL),
+        TM(cantFail(JTMB.createTargetMachine())),
         ObjectLayer(*this->ES,
                     [](const MemoryBuffer &) {
                       return std::make_unique<SectionMemoryManager>();
@@ -89,6 +94,8 @@ public:
 
   const DataLayout &getDataLayout() const { return DL; }
 
+  TargetMachine &getTargetMachine() { return *TM; }
+
   JITDylib &getMainJITDylib() { return MainJD; }
 
   Error addModule(ThreadSafeModule TSM, ResourceTrackerSP RT = nullptr) {
@@ -1,43 +1,399 @@
 #include "ast.h"
 #include "codegen.h"
 #include "parser.h"
+#include "fastmath.h"
+#include "complex.h"
+#include "records.h"
+#include "globals.h"
+#include "consteval.h"
+#include "closures.h"
+#include "generators.h"
+#include "transforms.h"
+#include "visitor.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Metadata.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Support/SaveAndRestore.h"
 #include <algorithm>
+#include <cmath>
+#include <set>
 
-// Forward declaration
+// Forward declarations
 llvm::Function *getFunction(std::string Name);
+llvm::Function *getFunction(Symbol Name);
+
+/// Remove a function whose body failed to generate; it may be cached in ModuleFunctions.
+static void EraseFunction(llvm::Function *F) {
+    ModuleFunctions.clear();
+    F->eraseFromParent();
+}
 
 ///Create an alloca instruction in the entry block of the function
-llvm::AllocaInst* CreateEntryBlockAlloca(llvm::Function *TheFunction, llvm::StringRef VarName){
+llvm::AllocaInst* CreateEntryBlockAlloca(llvm::Function *TheFunction, llvm::StringRef VarName, llvm::Type *Ty = nullptr){
     llvm::IRBuilder<> TmpB(&TheFunction->getEntryBlock(),TheFunction->getEntryBlock().begin());
 
-    return TmpB.CreateAlloca(llvm::Type::getDoubleTy(*TheContext), nullptr, VarName);
+    return TmpB.CreateAlloca(Ty ? Ty : getNumTy(), nullptr, VarName);
+}
+
+/// Convert a number to an i1 by comparing non-equal to 0.0.
+static llvm::Value *CreateCondition(llvm::Value *V, const char *Name){
+    if (!V->getType()->isFloatingPointTy())
+        return LogErrorV("condition must be a number");
+    return Builder->CreateFCmpONE(V, llvm::ConstantFP::get(V->getType(), 0.0), Name);
+}
+
+llvm::Type *TypeAST::codegen() const {
+    if (IsArray) {
+        if (llvm::Type *Ty = getArrayTy(*this))
+            return Ty;
+        LogErrorV("Unknown type name");
+        return nullptr;
+    }
+    switch (Kind) {
+    case Complex:
+        return getComplexTy();
+    case Tuple: {
+        std::vector<llvm::Type*> Types;
+        for (auto &Elem : Elems) {
+            if (Elem.isArray()) {
+                LogErrorV("tuples cannot hold arrays");
+                return nullptr;
+            }
+            Types.push_back(Elem.codegen());
+            if (!Types.back())
+                return nullptr;
+        }
+        return llvm::StructType::get(*TheContext, Types);
+    }
+    case Record:
+        if (llvm::Type *Ty = getRecordTy(RecordName))
+            return Ty;
+        LogErrorV("Unknown type name");
+        return nullptr;
+    case Function:
+        return getClosureTy(*this);
+    case Number:
+        break;
+    }
+    return getNumTy();
+}
+
+std::string TypeAST::getName() const {
+    std::string Str;
+    switch (Kind) {
+    case Number:
+        Str = "double";
+        break;
+    case Complex:
+        Str = "complex";
+        break;
+    case Record:
+        Str = RecordName;
+        break;
+    case Tuple:
+        for (auto &Elem : Elems)
+            Str += (Str.empty() ? "(" : ", ") + Elem.getName();
+        Str += ")";
+        break;
+    case Function: {
+        std::vector<TypeAST> Params = getParamTypes();
+        Str = "fn(";
+        for (size_t i = 0; i < Params.size(); ++i)
+            Str += (i ? ", " : "") + Params[i].getName();
+        Str += ") : " + getResultType().getName();
+        break;
+    }
+    }
+    if (IsArray)
+        Str += Layout == SoA ? "[] soa" : "[]";
+    return Str;
+}
+
+int RecordDeclAST::getFieldIndex(const std::string &FieldName) const {
+    auto It = std::find(FieldNames.begin(), FieldNames.end(), FieldName);
+    return It == FieldNames.end() ? -1 : It - FieldNames.begin();
+}
+
+bool RecordDeclAST::codegen() {
+    if (RecordDecls.count(Name)) {
+        LogErrorV("struct is already defined");
+        return false;
+    }
+    for (auto &FieldTy : FieldTypes) {
+        if (FieldTy.isArray() || FieldTy.containsFunction()) {
+            LogErrorV("struct fields cannot be arrays or functions");
+            return false;
+        }
+        // Also rejects records that are not declared yet, including this one.
+        if (!FieldTy.codegen())
+            return false;
+    }
+    RecordDecls[Name] = std::make_unique<RecordDeclAST>(Name, FieldNames, FieldTypes);
+    return true;
+}
+
+/// Calls the codegen() of the node's own class, which hides ExprAST::codegen(), so
+/// every call below is direct.
+class CodegenVisitor : public ExprVisitor<CodegenVisitor, llvm::Value*> {
+public:
+#define EXPR_CODEGEN(Name) \
+    llvm::Value *visit##Name(Name##ExprAST *E) { return E->codegen(); }
+    EXPR_NODES(EXPR_CODEGEN)
+#undef EXPR_CODEGEN
+};
+
+llvm::Value *ExprAST::codegen() {
+    return CodegenVisitor().visit(this);
 }
 
 llvm::Value *NumberExprAST::codegen() {
-    return llvm::ConstantFP::get(llvm::Type::getDoubleTy(*TheContext), llvm::APFloat(Val));
+    return llvm::ConstantFP::get(getNumTy(), Val);
+}
+
+llvm::Value *ImaginaryExprAST::codegen() {
+    llvm::Constant *Lanes[] = {llvm::ConstantFP::get(getNumTy(), 0.0), llvm::ConstantFP::get(getNumTy(), Val)};
+    return llvm::ConstantVector::get(Lanes);
 }
 
 llvm::Value *VariableExprAST::codegen() {
     // find the variable name in the symbol table. We assume that the variable has already been emitted somewhere and its value is available
-    llvm::AllocaInst *A = NamedValues[Name];
+    llvm::AllocaInst *A = NamedValues.lookup(Sym);
     if (!A) {
-        LogErrorV("Unknown variable name");
+        // Locals shadow globals, and globals shadow functions
+        if (GlobalVars.count(Name))
+            return EmitGlobalRef(Name);
+        if (FunctionProtos.count(Name))
+            return EmitFunctionRef(Name);
+        return LogErrorV("Unknown variable name");
     }
     // Load the value
     return Builder->CreateLoad(A->getAllocatedType(), A, Name.c_str());
 }
 
+llvm::Value *LambdaExprAST::codegen() {
+    // Capture the variables of the enclosing function the body refers to.
+    const std::vector<std::string> &Params = Proto->getArgs();
+    std::set<std::string> Refs;
+    CollectVarRefs(Body.get(), Refs);
+    std::vector<std::string> Captures;
+    std::vector<llvm::Type*> EnvTypes;
+    std::vector<llvm::AllocaInst*> CaptureAllocas;
+    for (auto &Name : Refs) {
+        llvm::AllocaInst *A = NamedValues.lookup(InternSymbol(Name));
+        if (!A)
+            continue;
+        if (std::find(Params.begin(), Params.end(), Name) != Params.end())
+            continue;
+        Captures.push_back(Name);
+        CaptureAllocas.push_back(A);
+        EnvTypes.push_back(A->getAllocatedType());
+    }
+
+    TypeAST FnTy = TypeAST::getFunction(Proto->getArgTypes(), Proto->getReturnType());
+    llvm::StructType *ClosureTy = getClosureTy(FnTy);
+    if (!ClosureTy)
+        return nullptr;
+
+    // The environment lives in the frame of the enclosing function.
+    llvm::StructType *EnvTy = llvm::StructType::get(*TheContext, EnvTypes);
+    llvm::Value *Env = llvm::ConstantPointerNull::get(llvm::PointerType::getUnqual(*TheContext));
+    if (!Captures.empty()) {
+        llvm::Function *Parent = Builder->GetInsertBlock()->getParent();
+        llvm::AllocaInst *EnvAlloca = CreateEntryBlockAlloca(Parent, "env", EnvTy);
+        for (unsigned i = 0, e = Captures.size(); i != e; ++i) {
+            llvm::Value *Val = Builder->CreateLoad(EnvTypes[i], CaptureAllocas[i], Captures[i]);
+            Builder->CreateStore(Val, Builder->CreateStructGEP(EnvTy, EnvAlloca, i));
+        }
+        Env = EnvAlloca;
+    }
+
+    llvm::Function *Code = llvm::Function::Create(getClosureCodeTy(FnTy), llvm::Function::InternalLinkage,
+                                                  "lambda", TheModule.get());
+    Code->addFnAttr(llvm::Attribute::AlwaysInline);
+
+    // Emit the body into its own function, then resume the enclosing one. A yield in
+    // the lambda would suspend the lambda, not the generator around it.
+    auto SavedIP = Builder->saveIP();
+    llvm::SaveAndRestore<GeneratorState*> SavedGenerator(CurGenerator, nullptr);
+    NamedValues.pushScope(/*IsFrame*/ true);
+    Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", Code));
+
+    // Captured variables are copied into locals of the lambda, like arguments.
+    llvm::Value *EnvArg = Code->getArg(0);
+    EnvArg->setName("env");
+    for (unsigned i = 0, e = Captures.size(); i != e; ++i) {
+        llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(Code, Captures[i], EnvTypes[i]);
+        llvm::Value *Addr = Builder->CreateStructGEP(EnvTy, EnvArg, i);
+        Builder->CreateStore(Builder->CreateLoad(EnvTypes[i], Addr, Captures[i]), Alloca);
+        NamedValues.bind(InternSymbol(Captures[i]), Alloca);
+    }
+    for (unsigned i = 0, e = Params.size(); i != e; ++i) {
+        llvm::Argument *Arg = Code->getArg(i + 1);
+        Arg->setName(Params[i]);
+        llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(Code, Params[i], Arg->getType());
+        Builder->CreateStore(Arg, Alloca);
+        NamedValues.bind(InternSymbol(Params[i]), Alloca);
+    }
+
+    llvm::Value *RetVal = Body->codegen();
+    if (RetVal)
+        RetVal = CoerceValue(RetVal, Code->getReturnType());
+    if (RetVal) {
+        Builder->CreateRet(RetVal);
+        if (llvm::verifyFunction(*Code, &llvm::errs()))
+            RetVal = nullptr;
+    }
+    NamedValues.popScope();
+    Builder->restoreIP(SavedIP);
+    if (!RetVal) {
+        Code->eraseFromParent();
+        return nullptr;
+    }
+    RunFunctionPasses(*Code);
+    return EmitClosure(Code, Env, ClosureTy);
+}
+
+llvm::Value *TupleExprAST::codegen() {
+    std::vector<llvm::Value*> Vals;
+    std::vector<llvm::Type*> Types;
+    for (auto &Elem : Elems) {
+        Vals.push_back(Elem->codegen());
+        if (!Vals.back())
+            return nullptr;
+        Types.push_back(Vals.back()->getType());
+        ArrayInfo Info;
+        if (getArrayInfo(Types.back(), Info))
+            return LogErrorV("tuples cannot hold arrays");
+    }
+    // A literal (unnamed) struct, records are the named ones.
+    llvm::Value *Tup = llvm::PoisonValue::get(llvm::StructType::get(*TheContext, Types));
+    for (unsigned i = 0, e = Vals.size(); i != e; ++i)
+        Tup = Builder->CreateInsertValue(Tup, Vals[i], i);
+    return Tup;
+}
+
+llvm::Value *TupleElementExprAST::codegen() {
+    llvm::Value *Tup = Tuple->codegen();
+    if (!Tup)
+        return nullptr;
+    if (!isTupleTy(Tup->getType()))
+        return LogErrorV("only a tuple can be destructured");
+    if (Index >= llvm::cast<llvm::StructType>(Tup->getType())->getNumElements())
+        return LogErrorV("tuple has fewer elements than names");
+    return Builder->CreateExtractValue(Tup, Index);
+}
+
+llvm::Value *IndexExprAST::codegen() {
+    llvm::Value *A = Array->codegen();
+    llvm::Value *I = Index->codegen();
+    if (!A || !I)
+        return nullptr;
+    return EmitLoadElement(A, I);
+}
+
+llvm::Value *IndexExprAST::codegenStore(llvm::Value *Val) {
+    if (auto *V = llvm::dyn_cast<VariableExprAST>(Array.get())) {
+        auto G = GlobalVars.find(V->getName());
+        if (!NamedValues.lookup(V->getSymbol()) && G != GlobalVars.end() && G->second.IsConst)
+            return LogErrorV("cannot assign to an element of a const table");
+    }
+    llvm::Value *A = Array->codegen();
+    llvm::Value *I = Index->codegen();
+    if (!A || !I)
+        return nullptr;
+    return EmitStoreElement(A, I, Val);
+}
+
+llvm::Value *IndexExprAST::codegenFieldAddress(const std::string &FieldName, llvm::Type *&FieldTy) {
+    llvm::Value *A = Array->codegen();
+    if (!A)
+        return nullptr;
+    ArrayInfo Info;
+    if (!getArrayInfo(A->getType(), Info) || !Info.Record)
+        return LogErrorV("'.' needs a record");
+    int Field = Info.Record->getFieldIndex(FieldName);
+    if (Field < 0)
+        return LogErrorV("Unknown field name");
+
+    llvm::Value *I = Index->codegen();
+    if (!I)
+        return nullptr;
+    FieldTy = llvm::cast<llvm::StructType>(Info.ElemTy)->getElementType(Field);
+    return EmitElementFieldAddress(A, I, Field);
+}
+
+/// Records in variables and arrays are accessed in place, one field at a time.
+static bool IsInMemory(ExprAST *E) {
+    if (llvm::isa<VariableExprAST, IndexExprAST>(E))
+        return true;
+    if (auto *F = llvm::dyn_cast<FieldExprAST>(E))
+        return IsInMemory(F->getBase());
+    return false;
+}
+
+llvm::Value *FieldExprAST::codegenAddress(llvm::Type *&FieldTy) {
+    if (auto *Elem = llvm::dyn_cast<IndexExprAST>(Base.get()))
+        return Elem->codegenFieldAddress(FieldName, FieldTy);
+
+    llvm::Value *BaseAddr = nullptr;
+    llvm::Type *BaseTy = nullptr;
+    if (auto *V = llvm::dyn_cast<VariableExprAST>(Base.get())) {
+        llvm::AllocaInst *A = NamedValues.lookup(V->getSymbol());
+        if (!A)
+            return LogErrorV("Unknown variable name");
+        BaseAddr = A;
+        BaseTy = A->getAllocatedType();
+    } else if (auto *F = llvm::dyn_cast<FieldExprAST>(Base.get())) {
+        BaseAddr = F->codegenAddress(BaseTy);
+        if (!BaseAddr)
+            return nullptr;
+    } else {
+        return LogErrorV("only fields of variables and array elements can be assigned");
+    }
+
+    const RecordDeclAST *R = getRecordDecl(BaseTy);
+    if (!R)
+        return LogErrorV("'.' needs a record");
+    int Field = R->getFieldIndex(FieldName);
+    if (Field < 0)
+        return LogErrorV("Unknown field name");
+    FieldTy = llvm::cast<llvm::StructType>(BaseTy)->getElementType(Field);
+    return Builder->CreateStructGEP(BaseTy, BaseAddr, Field, FieldName);
+}
+
+llvm::Value *FieldExprAST::codegen() {
+    if (IsInMemory(Base.get())) {
+        llvm::Type *FieldTy = nullptr;
+        llvm::Value *Addr = codegenAddress(FieldTy);
+        if (!Addr)
+            return nullptr;
+        return Builder->CreateLoad(FieldTy, Addr, FieldName);
+    }
+
+    // A record value, e.g. returned by a call.
+    llvm::Value *V = Base->codegen();
+    if (!V)
+        return nullptr;
+    const RecordDeclAST *R = getRecordDecl(V->getType());
+    if (!R)
+        return LogErrorV("'.' needs a record");
+    int Field = R->getFieldIndex(FieldName);
+    if (Field < 0)
+        return LogErrorV("Unknown field name");
+    return Builder->CreateExtractValue(V, Field, FieldName);
+}
+
 llvm::Value *BinaryExprAST::codegen() {
     // Special case '=' because we don't want to emit the LHS as an expression.
     if (Op == '='){
-        VariableExprAST *LHSE = static_cast<VariableExprAST*>(LHS.get());
-        if (!LHSE){
-            return LogErrorV("destination of '=' must be a variable");
+        VariableExprAST *LHSE = llvm::dyn_cast<VariableExprAST>(LHS.get());
+        IndexExprAST *LHSElem = llvm::dyn_cast<IndexExprAST>(LHS.get());
+        FieldExprAST *LHSField = llvm::dyn_cast<FieldExprAST>(LHS.get());
+        if (!LHSE && !LHSElem && !LHSField){
+            return LogErrorV("destination of '=' must be a variable, an array element or a field");
         }
         
         // Codegen the RHS
@@ -45,9 +401,41 @@ llvm::Value *BinaryExprAST::codegen() {
         if (!Val)
             return nullptr;
 
-        llvm::Value *Variable = NamedValues[LHSE->getName()];
+        if (LHSElem)
+            return LHSElem->codegenStore(Val);
+        if (LHSField) {
+            llvm::Type *FieldTy = nullptr;
+            llvm::Value *Addr = LHSField->codegenAddress(FieldTy);
+            if (!Addr)
+                return nullptr;
+            Val = CoerceValue(Val, FieldTy);
+            if (!Val)
+                return nullptr;
+            Builder->CreateStore(Val, Addr);
+            return Val;
+        }
+
+        llvm::AllocaInst *Variable = NamedValues.lookup(LHSE->getSymbol());
+        if (!Variable && GlobalVars.count(LHSE->getName())) {
+            const GlobalInfo &Info = GlobalVars[LHSE->getName()];
+            if (Info.IsConst)
+                return LogErrorV("cannot assign to a const");
+            if (Info.IsTable)
+                return LogErrorV("array variables cannot be reassigned");
+            Val = CoerceValue(Val, getNumTy());
+            if (!Val)
+                return nullptr;
+            Builder->CreateStore(Val, getGlobal(LHSE->getName()));
+            return Val;
+        }
         if (!Variable)
             return LogErrorV("Unknown variable name");
+        ArrayInfo Info;
+        if (getArrayInfo(Variable->getAllocatedType(), Info))
+            return LogErrorV("array variables cannot be reassigned");
+        Val = CoerceValue(Val, Variable->getAllocatedType());
+        if (!Val)
+            return nullptr;
         Builder->CreateStore(Val, Variable);
         return Val;
     }
@@ -59,6 +447,18 @@ llvm::Value *BinaryExprAST::codegen() {
         return nullptr;
     }
 
+    // Builtin operators on complex operands, mixed number/complex operands are promoted.
+    bool IsBuiltinOp = Op == '+' || Op == '-' || Op == '*' || Op == '/' || Op == '<';
+    if (IsBuiltinOp && (isComplexTy(L->getType()) || isComplexTy(R->getType())))
+        return EmitComplexBinOp(Op, PromoteToComplex(L), PromoteToComplex(R));
+
+    // A sequencing operator (def binary : 1 (x y) y) discards its LHS, so it accepts operands of any type.
+    if (SequenceOperators.count(Op))
+        return R;
+
+    if (IsBuiltinOp && (!L->getType()->isFloatingPointTy() || !R->getType()->isFloatingPointTy()))
+        return LogErrorV("operator needs number or complex operands");
+
     switch (Op) {
     case '+':
         return Builder->CreateFAdd(L, R, "addtmp");
@@ -70,16 +470,20 @@ llvm::Value *BinaryExprAST::codegen() {
         return Builder->CreateFDiv(L, R, "divtmp");
     case '<':
         L = Builder->CreateFCmpULT(L, R, "cmptmp");
-        // Convert bool 0/1 to double 0.0 or 1.0
-        return Builder->CreateUIToFP(L, llvm::Type::getDoubleTy(*TheContext), "booltmp");
+        // Convert bool 0/1 to 0.0 or 1.0
+        return Builder->CreateUIToFP(L, getNumTy(), "booltmp");
     default:
         break;
     }
 
     // If it wasn't a builtin binary operator, it must be a user defined one. Emit a call to it.
-    llvm::Function *F = getFunction(std::string("binary") + Op);
+    llvm::Function *F = getFunction(getBinaryOpSymbol(Op));
     assert(F && "binary operator not found!");
 
+    L = CoerceValue(L, F->getArg(0)->getType());
+    R = CoerceValue(R, F->getArg(1)->getType());
+    if (!L || !R)
+        return nullptr;
     llvm::Value *Ops[2] = { L, R };
     return Builder->CreateCall(F, Ops, "binop");
 }
@@ -90,46 +494,85 @@ llvm::Value *UnaryExprAST::codegen(){
         return nullptr;
     }
 
-    llvm::Function *F = getFunction(std::string("unary") + Opcode);
+    llvm::Function *F = getFunction(getUnaryOpSymbol(Opcode));
     if (!F){
         return LogErrorV("Unkown unary operator");
     }
+    OperandV = CoerceValue(OperandV, F->getArg(0)->getType());
+    if (!OperandV)
+        return nullptr;
     return Builder->CreateCall(F, OperandV, "unop");
 }
 
 llvm::Value *VarExprAST::codegen(){
-    std::vector<llvm::AllocaInst*> OldBindings;
+    // Every binding is dropped when this returns, also on errors.
+    SymbolScope Scope(NamedValues);
+    std::vector<llvm::Value*> OwnedArrays; // freed once the body is done
+    llvm::Value *ArenaMark = nullptr;
     llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
 
     // Register all variables and emit their initializer
     for (unsigned i=0, e = VarNames.size(); i!=e; i++){
         const std::string &VarName = VarNames[i].first;
         ExprAST *Init = VarNames[i].second.get();
+        const VarTypeAST &VarTy = VarTypes[i];
 
         llvm::Value *InitVal;
-        if (Init){
+        if (VarTy.Length){
+            // "var a : T[n]" allocates a zeroed array that lives until the end of the body
+            if (Init)
+                return LogErrorV("an array variable takes a length or an initializer, not both");
+            llvm::Value *Len = VarTy.Length->codegen();
+            if (!Len)
+                return nullptr;
+            InitVal = EmitArrayAlloc(VarTy.Ty, Len, ArenaMark);
+            if (!InitVal)
+                return nullptr;
+            OwnedArrays.push_back(InitVal);
+        } else if (Init){
             InitVal = Init->codegen();
             if (!InitVal)
                 return nullptr;
+        } else if (VarTy.Present){
+            llvm::Type *Ty = VarTy.Ty.codegen();
+            if (!Ty)
+                return nullptr;
+            if (VarTy.Ty.isArray())
+                return LogErrorV("array variables need a length or an initializer");
+            if (VarTy.Ty.containsFunction())
+                return LogErrorV("function variables need an initializer");
+            InitVal = llvm::Constant::getNullValue(Ty);
         } else {
-            InitVal = llvm::ConstantFP::get(*TheContext, llvm::APFloat(0.0));
+            InitVal = llvm::ConstantFP::get(getNumTy(), 0.0);
         }
 
-        llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, VarName);
+        // The variable takes the type of its initializer, unless annotated.
+        if (VarTy.Present && !VarTy.Length){
+            llvm::Type *Ty = VarTy.Ty.codegen();
+            if (!Ty)
+                return nullptr;
+            InitVal = CoerceValue(InitVal, Ty);
+            if (!InitVal)
+                return nullptr;
+        }
+        llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, VarName, InitVal->getType());
         Builder->CreateStore(InitVal, Alloca);
 
-        OldBindings.push_back(NamedValues[VarName]);
-        NamedValues[VarName] = Alloca;
+        NamedValues.bind(VarSyms[i], Alloca);
     }
     // Codegen the body, now that all vars are in scope.
     llvm::Value *BodyVal = Body->codegen();
     if (!BodyVal)
       return nullptr;
-    
-    // restore the previous variable bindings
-    for(unsigned i=0, e = VarNames.size(); i!=e; i++){
-        NamedValues[VarNames[i].first] = OldBindings[i];
-    }
+
+    ArrayInfo Info;
+    TypeAST FnTy;
+    if (!OwnedArrays.empty() && getArrayInfo(BodyVal->getType(), Info))
+        return LogErrorV("an array cannot be used outside the var that allocated it");
+    if (!OwnedArrays.empty() && getClosureSignature(BodyVal->getType(), FnTy))
+        return LogErrorV("a function value cannot be used outside a var that allocates an array");
+    if (ArenaMark)
+        EmitArenaRelease(ArenaMark);
 
     // Return the body computation.
     return BodyVal;
@@ -142,7 +585,10 @@ llvm::Value *IfExprAST::codegen(){
         return nullptr;
     }
     // Convert condition to a bool by comparing non-equal to 0.0.
-    CondV = Builder->CreateFCmpONE(CondV, llvm::ConstantFP::get(*TheContext, llvm::APFloat(0.0)), "ifcond");
+    CondV = CreateCondition(CondV, "ifcond");
+    if (!CondV){
+        return nullptr;
+    }
 
     llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
 
@@ -161,7 +607,6 @@ llvm::Value *IfExprAST::codegen(){
     if (!ThenV){
         return nullptr;
     }
-    Builder->CreateBr(MergeBB); //creates unconditional branch from 'then' to 'merge'
     ThenBB = Builder->GetInsertBlock(); //updated ThenBB for Phi node
 
     // add the else block to the function
@@ -172,17 +617,60 @@ llvm::Value *IfExprAST::codegen(){
     if (!ElseV){
         return nullptr;
     }
-    Builder->CreateBr(MergeBB);
     ElseBB = Builder->GetInsertBlock();
 
+    // Both arms must agree on a type (a number arm is promoted if the other is complex),
+    // so the branches to 'merge' are only emitted once the conversions are in place.
+    llvm::Type *ResultTy = UnifyTypes(ThenV->getType(), ElseV->getType());
+    if (!ResultTy){
+        return LogErrorV("'then' and 'else' have incompatible types");
+    }
+    Builder->SetInsertPoint(ThenBB);
+    ThenV = CoerceValue(ThenV, ResultTy);
+    Builder->CreateBr(MergeBB); //creates unconditional branch from 'then' to 'merge'
+    Builder->SetInsertPoint(ElseBB);
+    ElseV = CoerceValue(ElseV, ResultTy);
+    Builder->CreateBr(MergeBB);
+
     TheFunction->insert(TheFunction->end(), MergeBB);
     Builder->SetInsertPoint(MergeBB);
-    llvm::PHINode *PN = Builder->CreatePHI(llvm::Type::getDoubleTy(*TheContext), 2, "iftmp");
+    llvm::PHINode *PN = Builder->CreatePHI(ResultTy, 2, "iftmp");
     PN->addIncoming(ThenV, ThenBB);
     PN->addIncoming(ElseV, ElseBB);
     return PN;
 }
 
+/// Build the self-referential llvm.loop metadata node for the given hints.
+static llvm::MDNode *CreateLoopID(const LoopHints &Hints){
+    llvm::SmallVector<llvm::Metadata*, 4> Ops;
+    Ops.push_back(nullptr); // placeholder for the self reference
+
+    auto AddCount = [&](const char *Name, unsigned Count) {
+        llvm::Metadata *Vals[] = {
+            llvm::MDString::get(*TheContext, Name),
+            llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(llvm::Type::getInt32Ty(*TheContext), Count))
+        };
+        Ops.push_back(llvm::MDNode::get(*TheContext, Vals));
+    };
+
+    if (Hints.UnrollCount)
+        AddCount("llvm.loop.unroll.count", Hints.UnrollCount);
+    if (Hints.VectorizeWidth){
+        llvm::Metadata *Enable[] = {
+            llvm::MDString::get(*TheContext, "llvm.loop.vectorize.enable"),
+            llvm::ConstantAsMetadata::get(llvm::ConstantInt::getTrue(*TheContext))
+        };
+        Ops.push_back(llvm::MDNode::get(*TheContext, Enable));
+        AddCount("llvm.loop.vectorize.width", Hints.VectorizeWidth);
+    }
+    if (Hints.InterleaveCount)
+        AddCount("llvm.loop.interleave.count", Hints.InterleaveCount);
+
+    llvm::MDNode *LoopID = llvm::MDNode::getDistinct(*TheContext, Ops);
+    LoopID->replaceOperandWith(0, LoopID);
+    return LoopID;
+}
+
 llvm::Value *ForExprAST::codegen(){
     llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
     
@@ -197,6 +685,9 @@ llvm::Value *ForExprAST::codegen(){
     }
 
     // Store the value into the alloca, i.e, the destined register
+    StartVal = CoerceValue(StartVal, getNumTy());
+    if (!StartVal)
+        return nullptr;
     Builder->CreateStore(StartVal, Alloca);
 
     llvm::BasicBlock *LoopBB = llvm::BasicBlock::Create(*TheContext, "loop", TheFunction);
@@ -204,9 +695,9 @@ llvm::Value *ForExprAST::codegen(){
 
     Builder->SetInsertPoint(LoopBB);
     
-    // allow shadowing of the counter variable
-    llvm::AllocaInst *OldVal = NamedValues[VarName];
-    NamedValues[VarName] = Alloca;
+    // allow shadowing of the counter variable, until this returns
+    SymbolScope Scope(NamedValues);
+    NamedValues.bind(VarSym, Alloca);
 
     // emit the body value
     llvm::Value *BodyV = Body->codegen();
@@ -225,11 +716,14 @@ llvm::Value *ForExprAST::codegen(){
         }
     } else {
         // step not specified, so default is 1.0
-        StepV = llvm::ConstantFP::get(*TheContext, llvm::APFloat(1.0));
+        StepV = llvm::ConstantFP::get(getNumTy(), 1.0);
     }
 
     // value of the counter variable in next iteration
     llvm::Value *CurVal = Builder->CreateLoad(Alloca->getAllocatedType(), Alloca, VarName.c_str());
+    StepV = CoerceValue(StepV, getNumTy());
+    if (!StepV)
+        return nullptr;
     llvm::Value *NextVar = Builder->CreateFAdd(CurVal, StepV, "nextvar"); 
     // The addIncoming of the phi node is replaced by storing the inc value of counter back to its register
     Builder->CreateStore(NextVar, Alloca);
@@ -240,54 +734,320 @@ llvm::Value *ForExprAST::codegen(){
         return nullptr;
     }  
     // Convert condition to a bool by comparing non-equal to 0.0.
-    EndCond = Builder->CreateFCmpONE(EndCond, llvm::ConstantFP::get(*TheContext, llvm::APFloat(0.0)), "loopcond");    
+    EndCond = CreateCondition(EndCond, "loopcond");
+    if (!EndCond)
+        return nullptr;    
 
     // refers to where Builder currently is, which cud be some other nested block, or LoopBB itself. It points to the 'end' of the loop
     llvm::BasicBlock *LoopEndBB = Builder->GetInsertBlock(); 
     llvm::BasicBlock *AfterBB = llvm::BasicBlock::Create(*TheContext, "afterloop", TheFunction);
 
-    Builder->CreateCondBr(EndCond, LoopBB, AfterBB);    
+    llvm::BranchInst *BackEdge = Builder->CreateCondBr(EndCond, LoopBB, AfterBB);    
+    // The back-edge is the latch, which is where the loop passes look for hints.
+    if (!Hints.empty())
+        BackEdge->setMetadata(llvm::LLVMContext::MD_loop, CreateLoopID(Hints));
     // Any new code will be inserted in AfterBB.
     Builder->SetInsertPoint(AfterBB);
 
-    //Restore the unshadowed variable
-    if (OldVal){
-        NamedValues[VarName] = OldVal;
-    } else {
-        NamedValues.erase(VarName);
+    // for loop will return 0.0
+    return llvm::Constant::getNullValue(getNumTy());
+}
+
+llvm::Value *ForNestExprAST::codegen(){
+    // TransformAST() rewrites every nest into plain loops before codegen.
+    return LogErrorV("loop nest reached codegen without being lowered");
+}
+
+llvm::Value *ForInExprAST::codegen(){
+    auto *Call = llvm::dyn_cast<CallExprAST>(Source.get());
+    if (!Call)
+        return LogErrorV("for-in needs a call of a generator");
+    llvm::Value *Handle = Call->codegenGeneratorStart();
+    if (!Handle)
+        return nullptr;
+    // Builtins such as len() are calls too.
+    if (!Handle->getType()->isPointerTy())
+        return LogErrorV("for-in needs a call of a generator");
+
+    llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, VarName);
+    llvm::BasicBlock *LoopBB = llvm::BasicBlock::Create(*TheContext, "forin", TheFunction);
+    llvm::BasicBlock *BodyBB = llvm::BasicBlock::Create(*TheContext, "forin.body", TheFunction);
+    llvm::BasicBlock *AfterBB = llvm::BasicBlock::Create(*TheContext, "afterforin", TheFunction);
+    Builder->CreateBr(LoopBB);
+
+    // Resume the generator, it runs up to its next yield or to its end.
+    Builder->SetInsertPoint(LoopBB);
+    Builder->CreateCondBr(EmitGeneratorNext(Handle), AfterBB, BodyBB);
+
+    Builder->SetInsertPoint(BodyBB);
+    Builder->CreateStore(EmitGeneratorValue(Handle), Alloca);
+    SymbolScope Scope(NamedValues);
+    NamedValues.bind(VarSym, Alloca);
+    if (!Body->codegen()){
+        llvm::errs() << "DEBUG---Error generating body for for-in variable: " << VarName << "\n";
+        return nullptr;
     }
+    llvm::BranchInst *BackEdge = Builder->CreateBr(LoopBB);
+    if (!Hints.empty())
+        BackEdge->setMetadata(llvm::LLVMContext::MD_loop, CreateLoopID(Hints));
 
-    // for loop will return 0.0
-    return llvm::Constant::getNullValue(llvm::Type::getDoubleTy(*TheContext));
+    // The generator is done, free its frame.
+    Builder->SetInsertPoint(AfterBB);
+    EmitGeneratorDestroy(Handle);
+    return llvm::Constant::getNullValue(getNumTy());
+}
+
+llvm::Value *YieldExprAST::codegen(){
+    if (!CurGenerator)
+        return LogErrorV("yield outside of a generator");
+    llvm::Value *V = Val->codegen();
+    if (!V)
+        return nullptr;
+    V = CoerceValue(V, getNumTy());
+    if (!V)
+        return nullptr;
+    EmitYield(V);
+    return llvm::Constant::getNullValue(getNumTy());
 }
 
 llvm::Value *CallExprAST::codegen() {
-     // Look up the name in the global module table.
-    llvm::Function *CalleeF = getFunction(Callee);
+    return codegenCall(/*StartsGenerator*/ false);
+}
+
+llvm::Value *CallExprAST::codegenGeneratorStart() {
+    return codegenCall(/*StartsGenerator*/ true);
+}
+
+llvm::Value *CallExprAST::codegenCall(bool StartsGenerator) {
+    // A variable holding a function value, locals shadow functions.
+    if (llvm::AllocaInst *Local = NamedValues.lookup(CalleeSym)) {
+        if (StartsGenerator)
+            return LogErrorV("for-in needs a call of a generator");
+        llvm::Value *Closure = Builder->CreateLoad(Local->getAllocatedType(), Local, Callee);
+        std::vector<llvm::Value *> ArgsV;
+        for (auto &Arg : Args) {
+            ArgsV.push_back(Arg->codegen());
+            if (!ArgsV.back())
+                return nullptr;
+        }
+        return EmitClosureCall(Closure, ArgsV);
+    }
+
+     // Look up the name in the global module table. Functions taking function values
+     // are called through their inlinable clone, see closures.h.
+    llvm::Function *CalleeF = getSpecializedFunction(Callee);
+    if (!CalleeF)
+        CalleeF = getFunction(CalleeSym);
+    if (!CalleeF && IsApproxBuiltin(Callee))
+        return codegenApproxBuiltin();
+    if (!CalleeF && IsComplexBuiltin(Callee)) {
+        std::vector<llvm::Value *> ArgsV;
+        for (auto &Arg : Args) {
+            ArgsV.push_back(Arg->codegen());
+            if (!ArgsV.back())
+                return nullptr;
+        }
+        return EmitComplexBuiltin(Callee, ArgsV);
+    }
+    if (!CalleeF && RecordDecls.count(Callee))
+        return codegenRecordConstructor(*RecordDecls[Callee]);
+    if (!CalleeF && Callee == "len" && Args.size() == 1) {
+        llvm::Value *A = Args[0]->codegen();
+        if (!A)
+            return nullptr;
+        ArrayInfo Info;
+        if (!getArrayInfo(A->getType(), Info))
+            return LogErrorV("len() takes an array");
+        return EmitArrayLength(A);
+    }
+    if (!CalleeF && IsIOBuiltin(Callee))
+        return codegenIOBuiltin();
+    if (!CalleeF && Callee == "parfor") {
+        if (Args.size() != 2)
+            return LogErrorV("Incorrect # arguments passed");
+        llvm::Value *N = Args[0]->codegen();
+        if (!N)
+            return nullptr;
+        if (!N->getType()->isFloatingPointTy())
+            return LogErrorV("parfor() takes a number of iterations");
+        llvm::Value *F = Args[1]->codegen();
+        if (!F)
+            return nullptr;
+        return EmitParallelFor(N, F);
+    }
     if (!CalleeF)
         return LogErrorV("Unknown function referenced");
 
+    // The handle of a generator must be destroyed, which only the for-in loop does.
+    if (isGeneratorFunction(Callee) != StartsGenerator)
+        return LogErrorV(StartsGenerator ? "for-in needs a call of a generator"
+                                         : "generators can only be called by for-in loops");
+
     // If argument mismatch error.
     if (CalleeF->arg_size() != Args.size())
         return LogErrorV("Incorrect # arguments passed");
 
     std::vector<llvm::Value *> ArgsV;
     for (unsigned i = 0, e = Args.size(); i != e; ++i) {
-        ArgsV.push_back(Args[i]->codegen());
-        if (!ArgsV.back())
+        llvm::Value *ArgV = Args[i]->codegen();
+        if (!ArgV)
+            return nullptr;
+        // Numbers promote to complex parameters, and externs without a float
+        // variant keep their double signature in f32 mode.
+        ArgV = CoerceValue(ArgV, CalleeF->getArg(i)->getType());
+        if (!ArgV)
+            return nullptr;
+        ArgsV.push_back(ArgV);
+    }
+    llvm::Value *Result = Builder->CreateCall(CalleeF, ArgsV, "calltmp");
+    if (Result->getType()->isFloatingPointTy())
+        return Builder->CreateFPCast(Result, getNumTy());
+    return Result;
+}
+
+/// Particle(x, y, vx, vy, m) builds a record value from its fields in order, Particle() is all zeros.
+llvm::Value *CallExprAST::codegenRecordConstructor(const RecordDeclAST &R) {
+    llvm::StructType *RecTy = getRecordTy(R.getName());
+    if (Args.empty())
+        return llvm::Constant::getNullValue(RecTy);
+    if (Args.size() != RecTy->getNumElements())
+        return LogErrorV("Incorrect # fields passed to struct constructor");
+
+    llvm::Value *Rec = llvm::PoisonValue::get(RecTy);
+    for (unsigned i = 0, e = Args.size(); i != e; ++i) {
+        llvm::Value *FieldV = Args[i]->codegen();
+        if (!FieldV)
+            return nullptr;
+        FieldV = CoerceValue(FieldV, RecTy->getElementType(i));
+        if (!FieldV)
+            return nullptr;
+        Rec = Builder->CreateInsertValue(Rec, FieldV, i);
+    }
+    return Rec;
+}
+
+/// fexp(x) uses the session tier, fexp(x, bits) asks for at least 'bits' correct bits.
+llvm::Value *CallExprAST::codegenApproxBuiltin() {
+    if (Args.empty() || Args.size() > 2)
+        return LogErrorV("Incorrect # arguments passed");
+
+    ApproxTier Tier = DefaultApproxTier;
+    if (Args.size() == 2) {
+        auto *Bits = llvm::dyn_cast<NumberExprAST>(Args[1].get());
+        if (!Bits)
+            return LogErrorV("precision of an approximate builtin must be a number literal");
+        Tier = ApproxTierForBits(Bits->getVal());
+    }
+
+    llvm::Value *X = Args[0]->codegen();
+    if (!X)
+        return nullptr;
+    if (!X->getType()->isFloatingPointTy())
+        return LogErrorV("approximate math builtins take a number");
+    return EmitApproxBuiltin(Callee, X, Tier);
+}
+
+/// write(fd, a), read(fd, a), flush(fd) and writeimage(fd, a, w): bulk transfers of the
+/// elements of an array.
+llvm::Value *CallExprAST::codegenIOBuiltin() {
+    bool IsFlush = Callee == "flush", IsImage = Callee == "writeimage";
+    if (Args.size() != (IsFlush ? 1u : IsImage ? 3u : 2u))
+        return LogErrorV("Incorrect # arguments passed");
+    if (Callee == "read") {
+        auto *V = llvm::dyn_cast<VariableExprAST>(Args[1].get());
+        auto G = V ? GlobalVars.find(V->getName()) : GlobalVars.end();
+        if (V && !NamedValues.lookup(V->getSymbol()) && G != GlobalVars.end() && G->second.IsConst)
+            return LogErrorV("cannot read into a const table");
+    }
+
+    llvm::Value *Fd = Args[0]->codegen();
+    if (!Fd)
+        return nullptr;
+    if (!Fd->getType()->isFloatingPointTy())
+        return LogErrorV("file descriptor must be a number");
+    llvm::Value *A = nullptr;
+    if (!IsFlush) {
+        A = Args[1]->codegen();
+        if (!A)
             return nullptr;
+        ArrayInfo Info;
+        if (!getArrayInfo(A->getType(), Info) || Info.SoA)
+            return LogErrorV((Callee + "() takes an array that is not soa").c_str());
     }
-    return Builder->CreateCall(CalleeF, ArgsV, "calltmp");
+    if (IsImage) {
+        llvm::Value *Width = Args[2]->codegen();
+        if (!Width)
+            return nullptr;
+        if (!Width->getType()->isFloatingPointTy())
+            return LogErrorV("image width must be a number");
+        return EmitImageWrite(Fd, A, Width);
+    }
+    return EmitIOBuiltin(Callee, Fd, A);
+}
+
+/// In --precision=f32 mode, externs with a single-precision C variant (sinf, putchardf, ...)
+/// are bound to it. Other externs keep their double C signature and calls convert at the boundary.
+static bool HasSinglePrecisionVariant(const std::string &Name) {
+    static const char *const Names[] = {
+        "sin", "cos", "tan", "asin", "acos", "atan", "atan2", "sinh", "cosh", "tanh",
+        "exp", "exp2", "log", "log2", "log10", "pow", "sqrt", "cbrt", "fabs",
+        "floor", "ceil", "round", "trunc", "fmod", "fmin", "fmax", "hypot",
+        "putchard", "printd"
+    };
+    for (const char *N : Names)
+        if (Name == N)
+            return true;
+    return false;
+}
+
+bool PrototypeAST::usesDoubleABI() const {
+    return IsExtern && NumPrecision == Precision::F32 && !HasSinglePrecisionVariant(Name);
+}
+
+std::string PrototypeAST::getSymbolName() const {
+    if (IsExtern && NumPrecision == Precision::F32 && HasSinglePrecisionVariant(Name))
+        return Name + "f";
+    return Name;
 }
 
 llvm::Function *PrototypeAST::codegen() {
-    // Make the function type: double(double,double) etc.
-    std::vector<llvm::Type*> Doubles(Args.size(), llvm::Type::getDoubleTy(*TheContext)); // N LLVM Double types for N args
-    llvm::FunctionType *FT = llvm::FunctionType::get(llvm::Type::getDoubleTy(*TheContext), Doubles, false); // creates a function type with N doubles as args
+    // Make the function type: double(double,double) etc. (float in f32 mode)
+    auto ToABI = [this](llvm::Type *Ty) {
+        return usesDoubleABI() && Ty == getNumTy() ? llvm::Type::getDoubleTy(*TheContext) : Ty;
+    };
+    std::vector<llvm::Type*> Params; // one type per arg, numbers unless annotated
+    for (auto &ArgTy : ArgTypes) {
+        Params.push_back(ToABI(ArgTy.codegen()));
+        if (!Params.back())
+            return nullptr;
+    }
+    // Arrays are only borrowed by callees, their storage belongs to a var in a caller.
+    // The same goes for the environment of a function value.
+    if (RetType.isArray() || RetType.containsFunction()) {
+        LogErrorV("functions cannot return arrays or functions");
+        return nullptr;
+    }
+    llvm::Type *ResultTy = RetType.codegen();
+    if (!ResultTy)
+        return nullptr;
+    // A generator returns its coroutine handle, see generators.h.
+    if (IsGenerator)
+        ResultTy = llvm::PointerType::getUnqual(*TheContext);
+    llvm::FunctionType *FT = llvm::FunctionType::get(ToABI(ResultTy), Params, false);
+    if (isTopLevelExpr()) {
+        // void __anon_expr(number *Out), see StoreTopLevelResult()
+        FT = llvm::FunctionType::get(llvm::Type::getVoidTy(*TheContext),
+                                     {llvm::PointerType::getUnqual(*TheContext)}, false);
+    }
 
-    llvm::Function *F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, Name, TheModule.get()); // actually creates the IR Function corresponding to the Prototype
+    llvm::Function *F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, getSymbolName(), TheModule.get()); // actually creates the IR Function corresponding to the Prototype
 
     // Set names for all arguments.
+    if (isTopLevelExpr()) {
+        F->getArg(0)->setName("result");
+        return F;
+    }
     unsigned Idx = 0;
     for (auto &Arg : F->args())
         Arg.setName(Args[Idx++]);
@@ -295,14 +1055,16 @@ llvm::Function *PrototypeAST::codegen() {
     return F;
 }
 
-llvm::Function *getFunction(std::string Name){
+static llvm::Function *LookupFunction(const std::string &Name){
+    auto FI = FunctionProtos.find(Name);
+
     // First, see if the function has already been added to the current module.
-    if(auto *F = TheModule->getFunction(Name)){
+    std::string LinkName = FI != FunctionProtos.end() ? FI->second->getSymbolName() : Name;
+    if(auto *F = TheModule->getFunction(LinkName)){
         return F;
     }
 
     // If not, check whether we can codegen the declaration from some existing prototype.
-    auto FI = FunctionProtos.find(Name);
     if (FI != FunctionProtos.end()){
         return FI->second->codegen(); // this will create the function in the new modu
     }
@@ -311,11 +1073,112 @@ llvm::Function *getFunction(std::string Name){
     return nullptr;
 }
 
+llvm::Function *getFunction(std::string Name){
+    return getFunction(InternSymbol(Name));
+}
+
+llvm::Function *getFunction(Symbol Name){
+    // Declarations already looked up in this module are a vector index away.
+    if (Name < ModuleFunctions.size() && ModuleFunctions[Name])
+        return ModuleFunctions[Name];
+    if (ModuleFunctions.size() < getNumSymbols())
+        ModuleFunctions.resize(getNumSymbols());
+    return ModuleFunctions[Name] = LookupFunction(getSymbolText(Name).str());
+}
+
+llvm::Function *GlobalDeclAST::codegenInit(unsigned &Count) {
+    if (GlobalVars.count(Name) || FunctionProtos.count(Name)) {
+        LogErrorV("global name is already defined");
+        return nullptr;
+    }
+
+    double Start = 0, End = 0;
+    if (GenEnd) {
+        if (!EvaluateConstant(GenStart.get(), Start) || !EvaluateConstant(GenEnd.get(), End)) {
+            LogErrorV("generator bounds must be constant");
+            return nullptr;
+        }
+        Count = End > Start ? unsigned(std::ceil(End - Start)) : 0;
+    } else {
+        Count = Elems.size();
+    }
+    if (Count == 0) {
+        LogErrorV("a table needs at least one value");
+        return nullptr;
+    }
+
+    // Out is bound to the hidden table "out.", so the values are stored with plain
+    // element assignments:
+    //   for i = start, i < end in out.[i - start] = expr
+    //   var seq. = (out.[0] = e0) in var seq. = (out.[1] = e1) in ... 0
+    auto OutElem = [](std::unique_ptr<ExprAST> Index) {
+        return std::make_unique<IndexExprAST>(std::make_unique<VariableExprAST>("out."), std::move(Index));
+    };
+    std::unique_ptr<ExprAST> Body;
+    if (GenEnd) {
+        auto Index = std::make_unique<BinaryExprAST>('-', std::make_unique<VariableExprAST>(GenVar),
+                                                     std::make_unique<NumberExprAST>(Start));
+        auto Store = std::make_unique<BinaryExprAST>('=', OutElem(std::move(Index)), std::move(Elems[0]));
+        auto Cond = std::make_unique<BinaryExprAST>('<', std::make_unique<VariableExprAST>(GenVar),
+                                                    std::make_unique<NumberExprAST>(End));
+        Body = std::make_unique<ForExprAST>(GenVar, std::make_unique<NumberExprAST>(Start), std::move(Cond),
+                                            nullptr, std::move(Store));
+    } else {
+        Body = std::make_unique<NumberExprAST>(0);
+        for (unsigned k = Count; k-- > 0;) {
+            std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> Seq;
+            Seq.emplace_back("seq.", std::make_unique<BinaryExprAST>(
+                '=', OutElem(std::make_unique<NumberExprAST>(k)), std::move(Elems[k])));
+            Body = std::make_unique<VarExprAST>(std::move(Seq), std::move(Body));
+        }
+    }
+    Body = TransformAST(std::move(Body));
+
+    llvm::FunctionType *FT = llvm::FunctionType::get(llvm::Type::getVoidTy(*TheContext),
+                                                     {llvm::PointerType::getUnqual(*TheContext)}, false);
+    llvm::Function *TheFunction = llvm::Function::Create(FT, llvm::Function::ExternalLinkage,
+                                                         "__global_init", TheModule.get());
+    TheFunction->getArg(0)->setName("out");
+    Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", TheFunction));
+
+    SymbolScope Frame(NamedValues, /*IsFrame*/ true);
+    llvm::StructType *DescTy = getArrayTy(TypeAST(TypeAST::Number).getArrayOf(TypeAST::AoS));
+    llvm::Value *Desc = Builder->CreateInsertValue(llvm::PoisonValue::get(DescTy), TheFunction->getArg(0), 0);
+    Desc = Builder->CreateInsertValue(Desc, Builder->getInt64(Count), 1);
+    llvm::AllocaInst *Out = CreateEntryBlockAlloca(TheFunction, "out.", DescTy);
+    Builder->CreateStore(Desc, Out);
+    NamedValues.bind(InternSymbol("out."), Out);
+
+    bool Failed = !Body->codegen();
+    if (!Failed) {
+        Builder->CreateRetVoid();
+        Failed = llvm::verifyFunction(*TheFunction, &llvm::errs());
+    }
+    if (Failed) {
+        llvm::errs() << "DEBUG---Error generating initializer of global: " << Name << "\n";
+        EraseFunction(TheFunction);
+        return nullptr;
+    }
+    RunFunctionPasses(*TheFunction);
+    return TheFunction;
+}
+
+llvm::GlobalVariable *GlobalDeclAST::codegen(const std::vector<double> &Values) {
+    GlobalInfo &Info = GlobalVars[Name];
+    Info.IsConst = IsConst;
+    Info.IsTable = IsTable;
+    Info.Values = Values;
+    return EmitGlobalDefinition(Name);
+}
+
 llvm::Function *FunctionAST::codegen() {
      // Transfer ownership of the prototype to the FunctionProtos map, but keep a reference to it for use below.
     auto &P = *Proto;
     FunctionProtos[Proto->getName()] = std::move(Proto);
 
+    // Run the AST-level transformations (loop nest lowering, ...) on the body.
+    Body = TransformAST(std::move(Body));
+
     // First, check for an existing function from a previous 'extern' declaration.
     llvm::Function *TheFunction = getFunction(P.getName());
     if (!TheFunction){
@@ -324,33 +1187,80 @@ llvm::Function *FunctionAST::codegen() {
     
     if (P.isBinaryOp()){
         BinopPrecedence[P.getOperatorName()] = P.getBinaryPrecedence();
+
+        // "def binary : 1 (x y) y" only sequences its operands, which lets loop fusion look through it.
+        auto *Ret = llvm::dyn_cast<VariableExprAST>(Body.get());
+        if (Ret && Ret->getName() == P.getArgs()[1])
+            SequenceOperators.insert(P.getOperatorName());
     }
 
     if (!TheFunction->empty()) {
         return (llvm::Function*)LogErrorV("Function cannot be redefined.");
     }
 
+    return codegenBody(TheFunction, P);
+}
+
+llvm::Function *FunctionAST::codegenClone(const std::string &CloneName) {
+    auto &P = *FunctionProtos.at(Name);
+    llvm::Function *Decl = getFunction(Name);
+    if (!Decl)
+        return nullptr;
+    llvm::Function *TheFunction = llvm::Function::Create(Decl->getFunctionType(), llvm::Function::InternalLinkage,
+                                                         CloneName, TheModule.get());
+    TheFunction->addFnAttr(llvm::Attribute::AlwaysInline);
+    unsigned Idx = 0;
+    for (auto &Arg : TheFunction->args())
+        Arg.setName(P.getArgs()[Idx++]);
+    return codegenBody(TheFunction, P);
+}
+
+llvm::Function *FunctionAST::codegenBody(llvm::Function *TheFunction, const PrototypeAST &P) {
     // Create a new basic block named entry to start insertion into.
     llvm::BasicBlock *BB = llvm::BasicBlock::Create(*TheContext, "entry", TheFunction);
     Builder->SetInsertPoint(BB);
 
-    // Record the function arguments in the NamedValues map.
-    NamedValues.clear();
+    // Record the function arguments in a frame of their own: clones are emitted in the
+    // middle of their caller.
+    SymbolScope Frame(NamedValues, /*IsFrame*/ true);
     for (auto &Arg : TheFunction->args()) {
+        // The top level expression's only argument is its result buffer
+        if (P.isTopLevelExpr())
+            break;
         // Create alloca for the arguments
-        llvm::AllocaInst *ArgsAlloca = CreateEntryBlockAlloca(TheFunction, Arg.getName()); 
+        llvm::AllocaInst *ArgsAlloca = CreateEntryBlockAlloca(TheFunction, Arg.getName(), Arg.getType()); 
 
         // Store their initial value into the register
         Builder->CreateStore(&Arg, ArgsAlloca);
 
         // Add to symbol table
-        NamedValues[std::string(Arg.getName())] = ArgsAlloca;
+        NamedValues.bind(InternSymbol(Arg.getName()), ArgsAlloca);
+    }
+
+    // Yields in the body belong to this function, even when it is a clone emitted in the
+    // middle of a generator.
+    GeneratorState G;
+    llvm::SaveAndRestore<GeneratorState*> SavedGenerator(CurGenerator, P.isGenerator() ? &G : nullptr);
+    if (P.isGenerator()) {
+        TheFunction->setPresplitCoroutine();
+        EmitGeneratorBegin(TheFunction, G);
     }
 
     llvm::Value *RetVal = Body->codegen();
+    if (RetVal && P.isGenerator()) {
+        // The value of the body is dropped, generators only yield.
+        EmitGeneratorEnd(G);
+    } else if (RetVal && P.isTopLevelExpr()) {
+        if (!StoreTopLevelResult(RetVal, TheFunction->getArg(0)))
+            RetVal = nullptr;
+        else
+            Builder->CreateRetVoid();
+    } else if (RetVal) {
+        RetVal = CoerceValue(RetVal, TheFunction->getReturnType());
+        if (RetVal)
+            Builder->CreateRet(RetVal);
+    }
     if (RetVal) {
-        // Finish off the function.
-        Builder->CreateRet(RetVal);
 
         // Validate the generated code, checking for consistency.
         std::string Str;
@@ -361,15 +1271,15 @@ llvm::Function *FunctionAST::codegen() {
             llvm::errs() << "-----------------------------\n";
 
             // Setup a safe exit
-            TheFunction->eraseFromParent();
+            EraseFunction(TheFunction);
             return nullptr;
         }
         // Run the optimizer on the function
-        TheFPM->run(*TheFunction, *TheFAM);
+        RunFunctionPasses(*TheFunction);
         return TheFunction;
     } 
     llvm::errs() << "DEBUG---Error generating function body, removing function: " << P.getName() << "\n";
     // Error reading body, remove function.
-    TheFunction->eraseFromParent();
+    EraseFunction(TheFunction);
     return nullptr;
 }
\ No newline at end of file
@@ -3,31 +3,196 @@
 
 #include "llvm/IR/Value.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/Support/Casting.h"
+#include "symbols.h"
+#include <functional>
 #include <memory>
 #include <vector>
 #include <string>
 
+class ExprAST;
+class RecordDeclAST;
+using ExprChildFn = std::function<void(std::unique_ptr<ExprAST> &)>;
+
+// Every expression node kind, X(Name) for class NameExprAST. See ExprVisitor in visitor.h.
+#define EXPR_NODES(X) \
+    X(Number) X(Imaginary) X(Variable) X(Tuple) X(TupleElement) X(Index) X(Field) \
+    X(Binary) X(Unary) X(Var) X(Call) X(Lambda) X(Yield) X(If) X(For) X(ForNest) X(ForIn)
+
 // Base class for all expression nodes
 class ExprAST {
 public:
+    // LLVM-style RTTI: every subclass has classof(), so llvm::isa<> and llvm::dyn_cast<>
+    // compare the kind instead of walking type_info like dynamic_cast.
+    enum ExprKind {
+#define EXPR_KIND(Name) EK_##Name,
+        EXPR_NODES(EXPR_KIND)
+#undef EXPR_KIND
+    };
+private:
+    const ExprKind Kind;
+public:
+    ExprAST(ExprKind K) : Kind(K) {}
     virtual ~ExprAST() = default;
-    virtual llvm::Value *codegen() = 0;
+    ExprKind getKind() const { return Kind; }
+    // Dispatches on the kind to the codegen() of the subclass, without a virtual call.
+    llvm::Value *codegen();
+    // Visit the owning pointer of every direct child, so AST passes can rewrite them in place.
+    virtual void forEachChild(const ExprChildFn &Fn) {}
+};
+
+/// TypeAST - a type annotation such as "z:complex". Anything unannotated is a number.
+/// Records name a "struct" declaration, and any of them can be the element type of an
+/// array ("ps : Particle[] soa"), stored either as one array of records (AoS) or as one
+/// array per field (SoA). Tuples "(double, complex)" group values for multiple returns.
+/// Function types "fn(double, double) : double" are the types of function values.
+class TypeAST {
+public:
+    enum KindTy { Number, Complex, Record, Tuple, Function };
+    enum LayoutTy { AoS, SoA };
+private:
+    KindTy Kind;
+    std::string RecordName;
+    bool IsArray = false;
+    LayoutTy Layout = AoS;
+    std::vector<TypeAST> Elems; // tuple elements, or the parameters then the result of a function
+public:
+    TypeAST(KindTy kind = Number, const std::string &recordname = "") : Kind(kind), RecordName(recordname) {}
+    static TypeAST getTuple(std::vector<TypeAST> Elems) {
+        TypeAST Ty(Tuple);
+        Ty.Elems = std::move(Elems);
+        return Ty;
+    }
+    static TypeAST getFunction(std::vector<TypeAST> Params, const TypeAST &Result) {
+        TypeAST Ty(Function);
+        Ty.Elems = std::move(Params);
+        Ty.Elems.push_back(Result);
+        return Ty;
+    }
+    llvm::Type *codegen() const;
+    // The type as written in source, e.g. "fn(double, Particle[] soa) : complex".
+    std::string getName() const;
+
+    KindTy getKind() const { return Kind; }
+    bool isNumber() const { return Kind == Number && !IsArray; }
+    const std::string &getRecordName() const { return RecordName; }
+
+    std::vector<TypeAST> getParamTypes() const { return {Elems.begin(), Elems.end() - 1}; }
+    const TypeAST &getResultType() const { return Elems.back(); }
+    // Function values are only passed downwards, see closures.h.
+    bool containsFunction() const {
+        if (Kind == Function)
+            return true;
+        for (auto &Elem : Elems)
+            if (Elem.containsFunction())
+                return true;
+        return false;
+    }
+
+    bool isArray() const { return IsArray; }
+    LayoutTy getLayout() const { return Layout; }
+    TypeAST getArrayOf(LayoutTy layout) const {
+        TypeAST Ty = *this;
+        Ty.IsArray = true;
+        Ty.Layout = layout;
+        return Ty;
+    }
+    TypeAST getElementType() const {
+        TypeAST Ty = *this;
+        Ty.IsArray = false;
+        return Ty;
+    }
 };
 
 class NumberExprAST : public ExprAST {
     double Val;
 public:
-    NumberExprAST(double V) : Val(V) {}
-    llvm::Value *codegen() override;
+    NumberExprAST(double V) : ExprAST(EK_Number), Val(V) {}
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Number; }
+    double getVal() const { return Val; }
+};
+
+/// ImaginaryExprAST - an imaginary literal such as "2.5i".
+class ImaginaryExprAST : public ExprAST {
+    double Val;
+public:
+    ImaginaryExprAST(double V) : ExprAST(EK_Imaginary), Val(V) {}
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Imaginary; }
+    double getVal() const { return Val; }
 };
 
 /// VariableExprAST - Expression class for referencing a variable, like "a".
 class VariableExprAST : public ExprAST {
     std::string Name;
+    Symbol Sym;
 public:
-    VariableExprAST(const std::string &N) : Name(N) {}
-    llvm::Value *codegen() override;
+    VariableExprAST(const std::string &N) : ExprAST(EK_Variable), Name(N), Sym(InternSymbol(N)) {}
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Variable; }
     const std::string &getName() const { return Name; }
+    Symbol getSymbol() const { return Sym; }
+};
+
+/// TupleExprAST - "(a, b, ...)", a tuple value held in registers.
+class TupleExprAST : public ExprAST {
+    std::vector<std::unique_ptr<ExprAST>> Elems;
+public:
+    TupleExprAST(std::vector<std::unique_ptr<ExprAST>> elems) : ExprAST(EK_Tuple), Elems(std::move(elems)) {}
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Tuple; }
+    void forEachChild(const ExprChildFn &Fn) override {
+        for (auto &Elem : Elems) Fn(Elem);
+    }
+};
+
+/// TupleElementExprAST - element Index of a tuple. There is no source syntax for it,
+/// "var (a, b) = t in .." is parsed into element accesses.
+class TupleElementExprAST : public ExprAST {
+    std::unique_ptr<ExprAST> Tuple;
+    unsigned Index;
+public:
+    TupleElementExprAST(std::unique_ptr<ExprAST> tuple, unsigned index) : ExprAST(EK_TupleElement), Tuple(std::move(tuple)), Index(index) {}
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_TupleElement; }
+    void forEachChild(const ExprChildFn &Fn) override { Fn(Tuple); }
+};
+
+/// IndexExprAST - element access "a[i]", i is truncated to an integer.
+class IndexExprAST : public ExprAST {
+    std::unique_ptr<ExprAST> Array, Index;
+public:
+    IndexExprAST(std::unique_ptr<ExprAST> array, std::unique_ptr<ExprAST> index)
+    : ExprAST(EK_Index), Array(std::move(array)), Index(std::move(index)) {}
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Index; }
+    void forEachChild(const ExprChildFn &Fn) override { Fn(Array); Fn(Index); }
+
+    // "a[i] = v", and the address of field FieldName of a[i] for "a[i].x".
+    llvm::Value *codegenStore(llvm::Value *Val);
+    llvm::Value *codegenFieldAddress(const std::string &FieldName, llvm::Type *&FieldTy);
+
+    ExprAST *getArray() const { return Array.get(); }
+};
+
+/// FieldExprAST - record field access "p.x".
+class FieldExprAST : public ExprAST {
+    std::unique_ptr<ExprAST> Base;
+    std::string FieldName;
+public:
+    FieldExprAST(std::unique_ptr<ExprAST> base, const std::string &fieldname)
+    : ExprAST(EK_Field), Base(std::move(base)), FieldName(fieldname) {}
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Field; }
+    void forEachChild(const ExprChildFn &Fn) override { Fn(Base); }
+
+    // Address of the field when the record lives in memory (a variable or array
+    // element), or nullptr after logging an error.
+    llvm::Value *codegenAddress(llvm::Type *&FieldTy);
+
+    ExprAST *getBase() const { return Base.get(); }
 };
 
 /// Expression class for binary operators
@@ -39,8 +204,16 @@ public:
         char op,
         std::unique_ptr<ExprAST> lhs,
         std::unique_ptr<ExprAST> rhs
-    ) : Op(op), LHS(std::move(lhs)), RHS(std::move(rhs)) {}
-    llvm::Value *codegen() override;
+    ) : ExprAST(EK_Binary), Op(op), LHS(std::move(lhs)), RHS(std::move(rhs)) {}
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Binary; }
+    void forEachChild(const ExprChildFn &Fn) override { Fn(LHS); Fn(RHS); }
+
+    char getOp() const { return Op; }
+    ExprAST *getLHS() const { return LHS.get(); }
+    ExprAST *getRHS() const { return RHS.get(); }
+    std::unique_ptr<ExprAST> &getLHSPtr() { return LHS; }
+    std::unique_ptr<ExprAST> &getRHSPtr() { return RHS; }
 };
 
 /// Expression class for unary operators
@@ -50,33 +223,85 @@ class UnaryExprAST : public ExprAST {
 
 public:
     UnaryExprAST(char opcode, std::unique_ptr<ExprAST>operand) : 
-    Opcode(opcode), Operand(std::move(operand)) {}
+    ExprAST(EK_Unary), Opcode(opcode), Operand(std::move(operand)) {}
+
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Unary; }
+    void forEachChild(const ExprChildFn &Fn) override { Fn(Operand); }
+
+    char getOpcode() const { return Opcode; }
+};
 
-    llvm::Value *codegen() override;
+/// VarTypeAST - the optional ": type" of a var binding. Array bindings carry their
+/// length, "var ps : Particle[n] soa in ...", and own their storage until 'in' ends.
+struct VarTypeAST {
+    bool Present = false;
+    TypeAST Ty;
+    std::unique_ptr<ExprAST> Length; // arrays only
 };
 
 /// VarExprAST - Expression class for var/in
 class VarExprAST : public ExprAST {
     // allow a list of names to be defined all at once
     std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames;
+    std::vector<VarTypeAST> VarTypes; // one per name
+    std::vector<Symbol> VarSyms; // one per name
     std::unique_ptr<ExprAST> Body;
 
 public:
     VarExprAST(std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> varnames,
-    std::unique_ptr<ExprAST> body) :
-    VarNames(std::move(varnames)), Body(std::move(body)) {}
-    llvm::Value *codegen() override;
+    std::unique_ptr<ExprAST> body, std::vector<VarTypeAST> vartypes = {}) :
+    ExprAST(EK_Var), VarNames(std::move(varnames)), VarTypes(std::move(vartypes)), Body(std::move(body)) {
+        VarTypes.resize(VarNames.size());
+        for (auto &Var : VarNames)
+            VarSyms.push_back(InternSymbol(Var.first));
+    }
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Var; }
+    void forEachChild(const ExprChildFn &Fn) override {
+        for (size_t i = 0; i < VarNames.size(); ++i) {
+            if (VarTypes[i].Length) Fn(VarTypes[i].Length);
+            if (VarNames[i].second) Fn(VarNames[i].second);
+        }
+        Fn(Body);
+    }
+
+    // True if any binding has a ": type" annotation.
+    bool hasTypes() const {
+        for (auto &VarTy : VarTypes)
+            if (VarTy.Present) return true;
+        return false;
+    }
+    void forEachBinding(const std::function<void(const std::string &, ExprAST *)> &Fn) const {
+        for (auto &Var : VarNames) Fn(Var.first, Var.second.get());
+    }
+    ExprAST *getBody() const { return Body.get(); }
 };
 
 /// CallExprAST - Expression class for function calls.
 class CallExprAST : public ExprAST {
     std::string Callee; // name of the function
+    Symbol CalleeSym;
     std::vector<std::unique_ptr<ExprAST>> Args;
+
+    llvm::Value *codegenCall(bool StartsGenerator);
 public:
     CallExprAST(const std::string &Callee,
                             std::vector<std::unique_ptr<ExprAST>> Args)
-            : Callee(Callee), Args(std::move(Args)) {}
-    llvm::Value *codegen() override;
+            : ExprAST(EK_Call), Callee(Callee), CalleeSym(InternSymbol(Callee)), Args(std::move(Args)) {}
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Call; }
+    llvm::Value *codegenApproxBuiltin();
+    llvm::Value *codegenIOBuiltin();
+    llvm::Value *codegenRecordConstructor(const RecordDeclAST &R);
+    // Start the generator this calls, for a for-in loop: returns the coroutine handle.
+    llvm::Value *codegenGeneratorStart();
+    void forEachChild(const ExprChildFn &Fn) override {
+        for (auto &Arg : Args) Fn(Arg);
+    }
+
+    // A function, or a variable holding a function value.
+    const std::string &getCallee() const { return Callee; }
 };
 
 /// PrototypeAST - This class represents the "prototype" for a function,
@@ -86,19 +311,45 @@ class PrototypeAST {
     std::vector<std::string> Args;
     bool IsOperator;
     unsigned Precedence;
+    bool IsExtern = false;
+    bool IsGenerator = false;
+    std::vector<TypeAST> ArgTypes; // one per argument
+    TypeAST RetType;
 public:
     PrototypeAST(
         const std::string &Name, 
         std::vector<std::string> Args, 
         bool isoperator = false, 
-        unsigned precedence = 0
+        unsigned precedence = 0,
+        std::vector<TypeAST> argtypes = {},
+        TypeAST rettype = TypeAST()
     )
     : Name(Name), 
     Args(std::move(Args)),
     IsOperator(isoperator),
-    Precedence(precedence) {}
+    Precedence(precedence),
+    ArgTypes(std::move(argtypes)),
+    RetType(rettype) {
+        ArgTypes.resize(this->Args.size());
+    }
     llvm::Function *codegen();
     const std::string &getName() const { return Name; }
+    const std::vector<std::string> &getArgs() const { return Args; }
+    const std::vector<TypeAST> &getArgTypes() const { return ArgTypes; }
+    const TypeAST &getReturnType() const { return RetType; }
+
+    // The top-level expression is compiled as void __anon_expr(ptr), see StoreTopLevelResult().
+    bool isTopLevelExpr() const { return Name == "__anon_expr"; }
+
+    // Externs are bound to host symbols, which may differ from Name in f32 mode.
+    void setExtern() { IsExtern = true; }
+    bool isExtern() const { return IsExtern; }
+    std::string getSymbolName() const;
+    bool usesDoubleABI() const;
+
+    // "gen" functions return the handle of a coroutine yielding numbers, see generators.h.
+    void setGenerator() { IsGenerator = true; }
+    bool isGenerator() const { return IsGenerator; }
 
     bool isUnaryOp() const { return IsOperator && Args.size() ==1; }
     bool isBinaryOp() const { return IsOperator && Args.size() ==2; }
@@ -111,15 +362,102 @@ public:
     unsigned getBinaryPrecedence() const { return Precedence; }
 };
 
+/// LambdaExprAST - a function value "fn(x y) x * y + k". The variables of the enclosing
+/// function the body uses (k) are captured by value when the expression is evaluated.
+class LambdaExprAST : public ExprAST {
+    std::unique_ptr<PrototypeAST> Proto;
+    std::unique_ptr<ExprAST> Body;
+public:
+    LambdaExprAST(std::unique_ptr<PrototypeAST> proto, std::unique_ptr<ExprAST> body)
+    : ExprAST(EK_Lambda), Proto(std::move(proto)), Body(std::move(body)) {}
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Lambda; }
+    void forEachChild(const ExprChildFn &Fn) override { Fn(Body); }
+};
+
+/// YieldExprAST - "yield expr" in the body of a generator. Hands the value to the loop
+/// consuming the generator and suspends until the loop asks for the next one; 0.0.
+class YieldExprAST : public ExprAST {
+    std::unique_ptr<ExprAST> Val;
+public:
+    YieldExprAST(std::unique_ptr<ExprAST> val) : ExprAST(EK_Yield), Val(std::move(val)) {}
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Yield; }
+    void forEachChild(const ExprChildFn &Fn) override { Fn(Val); }
+};
+
+/// RecordDeclAST - "struct Particle { x, y, vx, vy, m : double }". Fields are numbers
+/// unless annotated; records are values, copied on assignment like numbers.
+class RecordDeclAST {
+    std::string Name;
+    std::vector<std::string> FieldNames;
+    std::vector<TypeAST> FieldTypes;
+public:
+    RecordDeclAST(const std::string &Name, std::vector<std::string> fieldnames,
+                  std::vector<TypeAST> fieldtypes)
+    : Name(Name), FieldNames(std::move(fieldnames)), FieldTypes(std::move(fieldtypes)) {}
+    // Register the declaration, see RecordDecls.
+    bool codegen();
+    const std::string &getName() const { return Name; }
+    const std::vector<std::string> &getFieldNames() const { return FieldNames; }
+    const std::vector<TypeAST> &getFieldTypes() const { return FieldTypes; }
+    // Index of the field called FieldName, or -1.
+    int getFieldIndex(const std::string &FieldName) const;
+};
+
+/// GlobalDeclAST - "global x = expr;", "const T = [e0, e1, ..];" or the generator
+/// "const T = [expr for i = start, end];". The values are computed once, when the
+/// declaration is read, by JIT-compiling and running an initializer function.
+class GlobalDeclAST {
+    std::string Name;
+    bool IsConst;
+    bool IsTable;
+    std::vector<std::unique_ptr<ExprAST>> Elems; // the scalar, the listed values, or the generator body
+    std::string GenVar; // generator only
+    std::unique_ptr<ExprAST> GenStart, GenEnd;
+public:
+    GlobalDeclAST(const std::string &Name, bool isconst, bool istable,
+                  std::vector<std::unique_ptr<ExprAST>> elems,
+                  const std::string &genvar = "",
+                  std::unique_ptr<ExprAST> genstart = nullptr,
+                  std::unique_ptr<ExprAST> genend = nullptr)
+    : Name(Name), IsConst(isconst), IsTable(istable), Elems(std::move(elems)), GenVar(genvar),
+    GenStart(std::move(genstart)), GenEnd(std::move(genend)) {}
+
+    // Emit "void __global_init(number *Out)" writing the Count initial values to Out.
+    llvm::Function *codegenInit(unsigned &Count);
+    // Register the computed values and emit the definition into the current module.
+    llvm::GlobalVariable *codegen(const std::vector<double> &Values);
+    const std::string &getName() const { return Name; }
+};
+
 /// FunctionAST - This class represents a function definition itself.
 class FunctionAST {
     std::unique_ptr<PrototypeAST> Proto;
     std::unique_ptr<ExprAST> Body;
+    std::string Name; // Proto moves to FunctionProtos in codegen()
+    bool IsHigherOrder = false;
+    bool IsGenerator;
+
+    llvm::Function *codegenBody(llvm::Function *TheFunction, const PrototypeAST &P);
 public:
     FunctionAST(std::unique_ptr<PrototypeAST> Proto,
               std::unique_ptr<ExprAST> Body)
-    : Proto(std::move(Proto)), Body(std::move(Body)) {}
+    : Proto(std::move(Proto)), Body(std::move(Body)), Name(this->Proto->getName()),
+    IsGenerator(this->Proto->isGenerator()) {
+        for (auto &ArgTy : this->Proto->getArgTypes())
+            IsHigherOrder |= ArgTy.containsFunction();
+    }
     llvm::Function *codegen();
+    ExprAST *getBody() const { return Body.get(); }
+    // Emit the body again, as an internal alwaysinline function CloneName of the
+    // current module. Only valid after codegen().
+    llvm::Function *codegenClone(const std::string &CloneName);
+
+    const std::string &getName() const { return Name; }
+    // Takes a function value, see HigherOrderFunctions.
+    bool isHigherOrder() const { return IsHigherOrder; }
+    bool isGenerator() const { return IsGenerator; }
 };
 
 // IfElse block AST, it just stores pointers to cond, else, then blocks
@@ -130,24 +468,115 @@ public:
         std::unique_ptr<ExprAST> cond,
         std::unique_ptr<ExprAST> then,
         std::unique_ptr<ExprAST> else_st
-    ) : Cond(std::move(cond)), Then(std::move(then)), Else(std::move(else_st)) {}
-    llvm::Value *codegen() override;
+    ) : ExprAST(EK_If), Cond(std::move(cond)), Then(std::move(then)), Else(std::move(else_st)) {}
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_If; }
+    void forEachChild(const ExprChildFn &Fn) override { Fn(Cond); Fn(Then); Fn(Else); }
+
+    ExprAST *getCond() const { return Cond.get(); }
+    ExprAST *getThen() const { return Then.get(); }
+    ExprAST *getElse() const { return Else.get(); }
 }; 
 
+/// LoopHints - optional "for [unroll 4, vectorize 8, interleave 2]" hints.
+/// A count of 0 means "not specified", so the loop passes decide on their own.
+struct LoopHints {
+    unsigned UnrollCount = 0;
+    unsigned VectorizeWidth = 0;
+    unsigned InterleaveCount = 0;
+
+    bool empty() const { return !UnrollCount && !VectorizeWidth && !InterleaveCount; }
+};
+
 // expression class for for/in
 // Start: expr for initialization of cntr, End: ending condition expression, Step: cntr incrementing expression,  
 class ForExprAST : public ExprAST {
     std::string VarName;
+    Symbol VarSym;
     std::unique_ptr<ExprAST> Start, End, Step, Body;
+    LoopHints Hints;
 public:
     ForExprAST(
         std::string &varname,
         std::unique_ptr<ExprAST> start,
         std::unique_ptr<ExprAST> end, 
         std::unique_ptr<ExprAST> step,
-        std::unique_ptr<ExprAST> body
-    ) : VarName(varname), Start(std::move(start)), End(std::move(end)), 
-    Step(std::move(step)), Body(std::move(body)) {}
-    llvm::Value *codegen() override;
+        std::unique_ptr<ExprAST> body,
+        LoopHints hints = LoopHints()
+    ) : ExprAST(EK_For), VarName(varname), VarSym(InternSymbol(varname)), Start(std::move(start)), End(std::move(end)), 
+    Step(std::move(step)), Body(std::move(body)), Hints(hints) {}
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_For; }
+    void forEachChild(const ExprChildFn &Fn) override {
+        Fn(Start); Fn(End);
+        if (Step) Fn(Step);
+        Fn(Body);
+    }
+
+    const std::string &getVarName() const { return VarName; }
+    ExprAST *getStart() const { return Start.get(); }
+    ExprAST *getEnd() const { return End.get(); }
+    ExprAST *getStep() const { return Step.get(); }
+    ExprAST *getBody() const { return Body.get(); }
+    const LoopHints &getHints() const { return Hints; }
+    std::unique_ptr<ExprAST> takeStart() { return std::move(Start); }
+    std::unique_ptr<ExprAST> takeEnd() { return std::move(End); }
+    std::unique_ptr<ExprAST> takeStep() { return std::move(Step); }
+    std::unique_ptr<ExprAST> takeBody() { return std::move(Body); }
+};
+
+/// LoopDim - one dimension of a loop nest: Var runs from Start up to (excluding) End by Step.
+struct LoopDim {
+    std::string VarName;
+    std::unique_ptr<ExprAST> Start, End, Step; // Step may be null, meaning 1.0
+};
+
+/// ForNestExprAST - "for y = 0, h; x = 0, w tile(32, 32) interchange in body".
+/// Unlike a plain for, the bounds are evaluated once and an empty range runs zero times.
+/// It never reaches codegen directly: LowerLoopNest() in transforms.cpp rewrites it
+/// into plain (possibly tiled and interchanged) ForExprAST nests.
+class ForNestExprAST : public ExprAST {
+    std::vector<LoopDim> Dims; // outermost first
+    std::vector<unsigned> TileSizes; // empty, or one size per dimension
+    bool Interchange;
+    std::unique_ptr<ExprAST> Body;
+    LoopHints Hints;
+public:
+    ForNestExprAST(std::vector<LoopDim> dims, std::vector<unsigned> tilesizes,
+                   bool interchange, std::unique_ptr<ExprAST> body, LoopHints hints)
+    : ExprAST(EK_ForNest), Dims(std::move(dims)), TileSizes(std::move(tilesizes)), Interchange(interchange),
+    Body(std::move(body)), Hints(hints) {}
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_ForNest; }
+    void forEachChild(const ExprChildFn &Fn) override {
+        for (auto &D : Dims) {
+            Fn(D.Start); Fn(D.End);
+            if (D.Step) Fn(D.Step);
+        }
+        Fn(Body);
+    }
+
+    std::vector<LoopDim> &getDims() { return Dims; }
+    const std::vector<unsigned> &getTileSizes() const { return TileSizes; }
+    bool shouldInterchange() const { return Interchange; }
+    std::unique_ptr<ExprAST> &getBody() { return Body; }
+    const LoopHints &getHints() const { return Hints; }
+};
+
+/// ForInExprAST - "for x in g(a, b) in body" runs body once for every value the
+/// generator g yields, then destroys the generator. Evaluates to 0.0 like a for.
+class ForInExprAST : public ExprAST {
+    std::string VarName;
+    Symbol VarSym;
+    std::unique_ptr<ExprAST> Source, Body; // Source is the call of the generator
+    LoopHints Hints;
+public:
+    ForInExprAST(const std::string &varname, std::unique_ptr<ExprAST> source,
+                 std::unique_ptr<ExprAST> body, LoopHints hints = LoopHints())
+    : ExprAST(EK_ForIn), VarName(varname), VarSym(InternSymbol(varname)), Source(std::move(source)),
+    Body(std::move(body)), Hints(hints) {}
+    llvm::Value *codegen();
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_ForIn; }
+    void forEachChild(const ExprChildFn &Fn) override { Fn(Source); Fn(Body); }
 };
 #endif // AST_H
\ No newline at end of file
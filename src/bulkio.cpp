@@ -0,0 +1,386 @@
+#include "runtime.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+#ifdef KALEIDO_HAVE_IO_URING
+#include <liburing.h>
+#include <sys/uio.h>
+#endif
+
+// Blocking reads and writes, the fallback and the way up to the first buffer of a read.
+// Both return the bytes transferred, -1 on error, and only stop early at end of file.
+static int64_t BlockingRead(int Fd, char *P, size_t Bytes) {
+    size_t Done = 0;
+    while (Done < Bytes) {
+#ifdef _WIN32
+        int R = _read(Fd, P + Done, unsigned(std::min<size_t>(Bytes - Done, 1u << 30)));
+#else
+        ssize_t R = ::read(Fd, P + Done, Bytes - Done);
+        if (R < 0 && errno == EINTR)
+            continue;
+#endif
+        if (R < 0)
+            return -1;
+        if (R == 0)
+            break;
+        Done += R;
+    }
+    return Done;
+}
+
+static int64_t BlockingWrite(int Fd, const char *P, size_t Bytes) {
+    size_t Done = 0;
+    while (Done < Bytes) {
+#ifdef _WIN32
+        int R = _write(Fd, P + Done, unsigned(std::min<size_t>(Bytes - Done, 1u << 30)));
+#else
+        ssize_t R = ::write(Fd, P + Done, Bytes - Done);
+        if (R < 0 && errno == EINTR)
+            continue;
+#endif
+        if (R <= 0)
+            return -1;
+        Done += R;
+    }
+    return Done;
+}
+
+#ifdef KALEIDO_HAVE_IO_URING
+
+// Transfers go through a few buffers registered with the ring, so the kernel does not
+// map the pages of every request. A write waits for a free one when all are in flight.
+static const unsigned NumBuffers = 16;
+static const size_t BufferSize = 256 << 10;
+static const unsigned QueueDepth = 2 * NumBuffers;
+static const uintptr_t StopTag = ~uintptr_t(0);
+
+// A buffer, and the transfer using it. At most one transfer per descriptor is in the
+// kernel at a time, so requests on one descriptor complete in order, pipes included.
+struct IOBuffer {
+    char *Data = nullptr;
+    int Fd = -1;
+    bool IsRead = false;
+    bool InFlight = false;
+    size_t Pos = 0, Len = 0; // the bytes [Pos, Len) are still to be transferred
+    int64_t Result = 0;      // reads: the bytes read, or -errno
+};
+
+struct IODescriptor {
+    std::deque<unsigned> Writes; // buffers waiting for the one in flight
+    bool Busy = false;           // a transfer of this descriptor is in the kernel
+    bool Failed = false;         // a write failed since the last flush
+    int ReadBuf = -1;            // the buffer holding (or reading) the next input
+};
+
+class IOEngine {
+    io_uring Ring;
+    bool Fixed = false; // the buffers are registered
+    std::vector<IOBuffer> Buffers;
+    std::vector<unsigned> FreeBuffers;
+    std::map<int, IODescriptor> Descriptors;
+    std::mutex Mutex;
+    std::condition_variable Changed;
+    std::thread Reaper;
+
+    unsigned acquireBuffer(std::unique_lock<std::mutex> &Lock) {
+        Changed.wait(Lock, [this] { return !FreeBuffers.empty(); });
+        unsigned B = FreeBuffers.back();
+        FreeBuffers.pop_back();
+        return B;
+    }
+
+    void releaseBuffer(unsigned B) {
+        FreeBuffers.push_back(B);
+    }
+
+    // A write to Fd (any descriptor for -1) is queued or in the kernel.
+    bool writing(int Fd) const {
+        for (auto &Buf : Buffers)
+            if (Buf.InFlight && !Buf.IsRead && (Fd < 0 || Buf.Fd == Fd))
+                return true;
+        for (auto &D : Descriptors)
+            if (!D.second.Writes.empty() && (Fd < 0 || D.first == Fd))
+                return true;
+        return false;
+    }
+
+    // Hand the rest of buffer B to the kernel. Offset -1 reads and writes at the file
+    // position, which works on files and pipes alike.
+    void submit(unsigned B) {
+        IOBuffer &Buf = Buffers[B];
+        io_uring_sqe *SQE = io_uring_get_sqe(&Ring);
+        char *P = Buf.Data + Buf.Pos;
+        unsigned N = unsigned(Buf.Len - Buf.Pos);
+        if (Buf.IsRead && Fixed)
+            io_uring_prep_read_fixed(SQE, Buf.Fd, P, N, -1, B);
+        else if (Buf.IsRead)
+            io_uring_prep_read(SQE, Buf.Fd, P, N, -1);
+        else if (Fixed)
+            io_uring_prep_write_fixed(SQE, Buf.Fd, P, N, -1, B);
+        else
+            io_uring_prep_write(SQE, Buf.Fd, P, N, -1);
+        io_uring_sqe_set_data(SQE, reinterpret_cast<void *>(uintptr_t(B)));
+        Buf.InFlight = true;
+        Descriptors[Buf.Fd].Busy = true;
+        io_uring_submit(&Ring);
+    }
+
+    // Start the next queued write of Fd, if its descriptor is idle.
+    void startNext(IODescriptor &D) {
+        if (D.Busy || D.Writes.empty())
+            return;
+        unsigned B = D.Writes.front();
+        D.Writes.pop_front();
+        submit(B);
+    }
+
+    void complete(unsigned B, int Res) {
+        IOBuffer &Buf = Buffers[B];
+        IODescriptor &D = Descriptors[Buf.Fd];
+        Buf.InFlight = false;
+        D.Busy = false;
+        if (Buf.IsRead) {
+            Buf.Result = Res;
+        } else if (Res > 0 && Buf.Pos + Res < Buf.Len) {
+            // A short write, send the rest before anything else.
+            Buf.Pos += Res;
+            submit(B);
+            return;
+        } else {
+            D.Failed |= Res <= 0;
+            releaseBuffer(B);
+        }
+        startNext(D);
+    }
+
+    // Runs on its own thread, the only one looking at the completion queue.
+    void reap() {
+        while (true) {
+            io_uring_cqe *CQE;
+            int R = io_uring_wait_cqe(&Ring, &CQE);
+            if (R == -EINTR)
+                continue;
+            if (R < 0)
+                return;
+            uintptr_t Tag = reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(CQE));
+            int Res = CQE->res;
+            io_uring_cqe_seen(&Ring, CQE);
+            if (Tag == StopTag)
+                return;
+            std::lock_guard<std::mutex> Lock(Mutex);
+            complete(unsigned(Tag), Res);
+            Changed.notify_all();
+        }
+    }
+
+    // Read the next buffer's worth of Fd into a buffer of its own. The waits unlock the
+    // mutex, so other readers of Fd (parfor) may run in between: the buffer is marked in
+    // flight before it is published, and they wait for its result like for any read.
+    void readAhead(std::unique_lock<std::mutex> &Lock, int Fd) {
+        unsigned B = acquireBuffer(Lock);
+        if (Descriptors[Fd].ReadBuf >= 0) {
+            // Another reader started one while this one waited for a buffer.
+            releaseBuffer(B);
+            Changed.notify_all();
+            return;
+        }
+        IOBuffer &Buf = Buffers[B];
+        Buf.Fd = Fd;
+        Buf.IsRead = true;
+        Buf.InFlight = true;
+        Buf.Pos = 0;
+        Buf.Len = BufferSize;
+        Buf.Result = 0;
+        Descriptors[Fd].ReadBuf = B;
+        Changed.wait(Lock, [&] { return !Descriptors[Fd].Busy; });
+        submit(B);
+    }
+
+public:
+    bool Usable = false;
+
+    IOEngine() {
+        if (io_uring_queue_init(QueueDepth, &Ring, 0) < 0)
+            return;
+        Buffers.resize(NumBuffers);
+        std::vector<iovec> IOVecs(NumBuffers);
+        for (unsigned i = 0; i < NumBuffers; ++i) {
+            Buffers[i].Data = static_cast<char *>(std::malloc(BufferSize));
+            IOVecs[i] = {Buffers[i].Data, BufferSize};
+            FreeBuffers.push_back(i);
+        }
+        // Older kernels count registered buffers against RLIMIT_MEMLOCK, plain
+        // reads and writes of the same buffers work everywhere.
+        Fixed = io_uring_register_buffers(&Ring, IOVecs.data(), NumBuffers) == 0;
+        Reaper = std::thread([this] { reap(); });
+        Usable = true;
+    }
+
+    ~IOEngine() {
+        if (!Usable)
+            return;
+        {
+            // Pending writes still reach their files. A read ahead may wait on a pipe
+            // forever; the kernel cancels it when the ring goes away.
+            std::unique_lock<std::mutex> Lock(Mutex);
+            Changed.wait(Lock, [this] { return !writing(-1); });
+            io_uring_sqe *SQE = io_uring_get_sqe(&Ring);
+            io_uring_prep_nop(SQE);
+            io_uring_sqe_set_data(SQE, reinterpret_cast<void *>(StopTag));
+            io_uring_submit(&Ring);
+        }
+        Reaper.join();
+        io_uring_queue_exit(&Ring);
+        // The buffers are left to the process exit, the kernel may still hold them.
+    }
+
+    int64_t write(int Fd, const char *P, size_t Bytes) {
+        std::unique_lock<std::mutex> Lock(Mutex);
+        for (size_t Done = 0; Done < Bytes;) {
+            unsigned B = acquireBuffer(Lock);
+            IOBuffer &Buf = Buffers[B];
+            Buf.Fd = Fd;
+            Buf.IsRead = false;
+            Buf.Pos = 0;
+            Buf.Len = std::min(BufferSize, Bytes - Done);
+            std::memcpy(Buf.Data, P + Done, Buf.Len);
+            Done += Buf.Len;
+            IODescriptor &D = Descriptors[Fd];
+            D.Writes.push_back(B);
+            startNext(D);
+        }
+        return Bytes;
+    }
+
+    int64_t read(int Fd, char *P, size_t Bytes) {
+        std::unique_lock<std::mutex> Lock(Mutex);
+        size_t Done = 0;
+        while (Done < Bytes) {
+            if (Descriptors[Fd].ReadBuf < 0)
+                readAhead(Lock, Fd);
+            unsigned B = Descriptors[Fd].ReadBuf;
+            IOBuffer &Buf = Buffers[B];
+            Changed.wait(Lock, [&] { return !Buf.InFlight; });
+            if (Buf.Result <= 0) {
+                // End of file or an error, the next read tries again.
+                Descriptors[Fd].ReadBuf = -1;
+                releaseBuffer(B);
+                Changed.notify_all();
+                if (Buf.Result < 0)
+                    return -1;
+                break;
+            }
+            size_t N = std::min<size_t>(Buf.Result - Buf.Pos, Bytes - Done);
+            std::memcpy(P + Done, Buf.Data + Buf.Pos, N);
+            Buf.Pos += N;
+            Done += N;
+            if (Buf.Pos == size_t(Buf.Result)) {
+                // Used up: read on while the caller works on what it got.
+                Descriptors[Fd].ReadBuf = -1;
+                releaseBuffer(B);
+                readAhead(Lock, Fd);
+            }
+        }
+        return Done;
+    }
+
+    int64_t flush(int Fd) {
+        std::unique_lock<std::mutex> Lock(Mutex);
+        Changed.wait(Lock, [&] { return !writing(Fd); });
+        IODescriptor &D = Descriptors[Fd];
+        bool Failed = D.Failed;
+        D.Failed = false;
+        return Failed ? -1 : 0;
+    }
+};
+
+static IOEngine &getIOEngine() {
+    static IOEngine Engine;
+    return Engine;
+}
+
+#endif // KALEIDO_HAVE_IO_URING
+
+extern "C" DLLEXPORT int64_t kaleido_io_write(int64_t Fd, const void *Data, int64_t N, int64_t Size) {
+    if (Fd < 0 || N < 0 || Size <= 0 || N > INT64_MAX / Size)
+        return -1;
+    const char *P = static_cast<const char *>(Data);
+#ifdef KALEIDO_HAVE_IO_URING
+    if (getIOEngine().Usable)
+        return getIOEngine().write(int(Fd), P, N * Size) < 0 ? -1 : N;
+#endif
+    return BlockingWrite(int(Fd), P, N * Size) < 0 ? -1 : N;
+}
+
+extern "C" DLLEXPORT int64_t kaleido_io_read(int64_t Fd, void *Data, int64_t N, int64_t Size) {
+    if (Fd < 0 || N < 0 || Size <= 0 || N > INT64_MAX / Size)
+        return -1;
+    char *P = static_cast<char *>(Data);
+    int64_t Bytes;
+#ifdef KALEIDO_HAVE_IO_URING
+    if (getIOEngine().Usable)
+        Bytes = getIOEngine().read(int(Fd), P, N * Size);
+    else
+#endif
+    Bytes = BlockingRead(int(Fd), P, N * Size);
+    return Bytes < 0 ? -1 : Bytes / Size;
+}
+
+extern "C" DLLEXPORT int64_t kaleido_io_flush(int64_t Fd) {
+    if (Fd < 0)
+        return -1;
+#ifdef KALEIDO_HAVE_IO_URING
+    if (getIOEngine().Usable)
+        return getIOEngine().flush(int(Fd));
+#endif
+    return 0;
+}
+
+// [0, 1] to a byte; NaN is black.
+static unsigned char ToPixelByte(double V) {
+    if (!(V > 0.0))
+        return 0;
+    return V >= 1.0 ? 255 : static_cast<unsigned char>(V * 255.0 + 0.5);
+}
+
+extern "C" DLLEXPORT int64_t kaleido_image_write(int64_t Fd, const void *Data, int64_t N, int64_t Width,
+                                                 int64_t Channels, int64_t Size) {
+    if (N < 0 || Width <= 0 || N % Width != 0 || (Channels != 1 && Channels != 3) || (Size != 4 && Size != 8) ||
+        N > INT64_MAX / Channels)
+        return -1;
+    char Header[64];
+    int HeaderLen = std::snprintf(Header, sizeof(Header), "P%d\n%lld %lld\n255\n", Channels == 1 ? 5 : 6,
+                                  static_cast<long long>(Width), static_cast<long long>(N / Width));
+
+    // Converted in one pass, then written with a single write of the whole image.
+    int64_t Samples = N * Channels;
+    std::vector<unsigned char> Out(HeaderLen + Samples);
+    std::memcpy(Out.data(), Header, HeaderLen);
+    unsigned char *P = Out.data() + HeaderLen;
+    if (Size == 8) {
+        const double *In = static_cast<const double *>(Data);
+        for (int64_t i = 0; i < Samples; ++i)
+            P[i] = ToPixelByte(In[i]);
+    } else {
+        const float *In = static_cast<const float *>(Data);
+        for (int64_t i = 0; i < Samples; ++i)
+            P[i] = ToPixelByte(In[i]);
+    }
+    return kaleido_io_write(Fd, Out.data(), Out.size(), 1) < 0 ? -1 : N;
+}
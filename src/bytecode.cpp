@@ -0,0 +1,393 @@
+#include "bytecode.h"
+#include "codegen.h"
+#include "closures.h"
+#include "globals.h"
+#include "transforms.h"
+#include "KaleidoscopeJIT.h"
+#include <algorithm>
+#include <map>
+#include <string>
+
+Backend TopLevelBackend = Backend::Auto;
+
+// Direct threading needs the "labels as values" extension of GCC and Clang, other
+// compilers dispatch through a switch.
+#if defined(__GNUC__) || defined(__clang__)
+#define BC_COMPUTED_GOTO 1
+#endif
+
+// Calls pass the arguments as separate doubles, up to this many.
+static const unsigned MaxCallArgs = 6;
+
+//===----------------------------------------------------------------------===//
+// AST -> bytecode
+//===----------------------------------------------------------------------===//
+
+/// Registers are allocated like a stack: every expression gets a destination register
+/// from its parent and releases the temporaries it used once it is done.
+class BytecodeCompiler {
+    BytecodeProgram &P;
+    std::map<std::string, unsigned> Locals; // var and for variables, by name
+    unsigned NextReg = 0;
+
+    unsigned newReg() {
+        unsigned R = NextReg++;
+        P.NumRegs = std::max(P.NumRegs, NextReg);
+        return R;
+    }
+    size_t emit(BCInstr I) {
+        P.Code.push_back(I);
+        return P.Code.size() - 1;
+    }
+    void patchTarget(size_t Jump) { P.Code[Jump].Target = P.Code.size(); }
+
+    void *lookupSymbol(const std::string &Name);
+    bool emitCall(const std::string &Callee, const std::vector<ExprAST*> &Args, unsigned Dst);
+    bool emitVariable(const std::string &Name, unsigned Dst);
+    bool emitAssign(const std::string &Name, ExprAST *RHS, unsigned Dst);
+    bool emitBinary(BinaryExprAST *B, unsigned Dst);
+    bool emitIf(IfExprAST *E, unsigned Dst);
+    bool emitFor(ForExprAST *E, unsigned Dst);
+    bool emitVar(VarExprAST *E, unsigned Dst);
+public:
+    BytecodeCompiler(BytecodeProgram &P) : P(P) {}
+    bool compile(ExprAST *E);
+    bool emitExpr(ExprAST *E, unsigned Dst);
+};
+
+void *BytecodeCompiler::lookupSymbol(const std::string &Name) {
+    auto Sym = TheJIT->lookup(Name);
+    if (!Sym) {
+        llvm::consumeError(Sym.takeError());
+        return nullptr;
+    }
+    return Sym->getAddress().toPtr<void *>();
+}
+
+bool BytecodeCompiler::compile(ExprAST *E) {
+    unsigned Result = newReg();
+    if (!emitExpr(E, Result))
+        return false;
+    emit(BCInstr(BC_Ret, Result));
+    return true;
+}
+
+bool BytecodeCompiler::emitExpr(ExprAST *E, unsigned Dst) {
+    unsigned Saved = NextReg;
+    bool Ok = false;
+    switch (E->getKind()) {
+    case ExprAST::EK_Number: {
+        BCInstr I(BC_LoadK, Dst);
+        I.K = llvm::cast<NumberExprAST>(E)->getVal();
+        emit(I);
+        Ok = true;
+        break;
+    }
+    case ExprAST::EK_Variable:
+        Ok = emitVariable(llvm::cast<VariableExprAST>(E)->getName(), Dst);
+        break;
+    case ExprAST::EK_Binary:
+        Ok = emitBinary(llvm::cast<BinaryExprAST>(E), Dst);
+        break;
+    case ExprAST::EK_Unary: {
+        std::vector<ExprAST*> Operand;
+        E->forEachChild([&](std::unique_ptr<ExprAST> &Child) { Operand.push_back(Child.get()); });
+        Ok = emitCall(std::string("unary") + llvm::cast<UnaryExprAST>(E)->getOpcode(), Operand, Dst);
+        break;
+    }
+    case ExprAST::EK_Call: {
+        std::vector<ExprAST*> Args;
+        E->forEachChild([&](std::unique_ptr<ExprAST> &Child) { Args.push_back(Child.get()); });
+        Ok = emitCall(llvm::cast<CallExprAST>(E)->getCallee(), Args, Dst);
+        break;
+    }
+    case ExprAST::EK_If:
+        Ok = emitIf(llvm::cast<IfExprAST>(E), Dst);
+        break;
+    case ExprAST::EK_For:
+        Ok = emitFor(llvm::cast<ForExprAST>(E), Dst);
+        break;
+    case ExprAST::EK_Var:
+        Ok = emitVar(llvm::cast<VarExprAST>(E), Dst);
+        break;
+    default: // complex numbers, records, tuples and function values need the JIT
+        break;
+    }
+    NextReg = Saved;
+    return Ok;
+}
+
+bool BytecodeCompiler::emitVariable(const std::string &Name, unsigned Dst) {
+    auto Local = Locals.find(Name);
+    if (Local != Locals.end()) {
+        emit(BCInstr(BC_Mov, Dst, Local->second));
+        return true;
+    }
+    auto G = GlobalVars.find(Name);
+    if (G == GlobalVars.end() || G->second.IsTable)
+        return false;
+    if (G->second.IsConst) {
+        BCInstr I(BC_LoadK, Dst);
+        I.K = G->second.Values[0];
+        emit(I);
+        return true;
+    }
+    BCInstr I(BC_LoadGlobal, Dst);
+    I.Global = static_cast<double *>(lookupSymbol(Name));
+    if (!I.Global)
+        return false;
+    emit(I);
+    return true;
+}
+
+bool BytecodeCompiler::emitAssign(const std::string &Name, ExprAST *RHS, unsigned Dst) {
+    if (!emitExpr(RHS, Dst))
+        return false;
+    auto Local = Locals.find(Name);
+    if (Local != Locals.end()) {
+        emit(BCInstr(BC_Mov, Local->second, Dst));
+        return true;
+    }
+    auto G = GlobalVars.find(Name);
+    if (G == GlobalVars.end() || G->second.IsConst || G->second.IsTable)
+        return false;
+    BCInstr I(BC_StoreGlobal, Dst);
+    I.Global = static_cast<double *>(lookupSymbol(Name));
+    if (!I.Global)
+        return false;
+    emit(I);
+    return true;
+}
+
+bool BytecodeCompiler::emitBinary(BinaryExprAST *B, unsigned Dst) {
+    char Op = B->getOp();
+    if (Op == '=') {
+        auto *LHS = llvm::dyn_cast<VariableExprAST>(B->getLHS());
+        return LHS && emitAssign(LHS->getName(), B->getRHS(), Dst);
+    }
+
+    BCOpcode Opc;
+    switch (Op) {
+    case '+': Opc = BC_Add; break;
+    case '-': Opc = BC_Sub; break;
+    case '*': Opc = BC_Mul; break;
+    case '/': Opc = BC_Div; break;
+    case '<': Opc = BC_Lt; break;
+    default: {
+        // Same as codegen: a sequencing operator evaluates both sides and is the RHS,
+        // any other one is a call to "binary<op>".
+        if (SequenceOperators.count(Op)) {
+            unsigned Tmp = newReg();
+            return emitExpr(B->getLHS(), Tmp) && emitExpr(B->getRHS(), Dst);
+        }
+        return emitCall(std::string("binary") + Op, {B->getLHS(), B->getRHS()}, Dst);
+    }
+    }
+    unsigned R = newReg();
+    if (!emitExpr(B->getLHS(), Dst) || !emitExpr(B->getRHS(), R))
+        return false;
+    emit(BCInstr(Opc, Dst, Dst, R));
+    return true;
+}
+
+bool BytecodeCompiler::emitCall(const std::string &Callee, const std::vector<ExprAST*> &Args, unsigned Dst) {
+    // Function values, specialized higher-order functions and builtins need codegen.
+    if (Locals.count(Callee) || HigherOrderFunctions.count(Callee))
+        return false;
+    auto FI = FunctionProtos.find(Callee);
+    if (FI == FunctionProtos.end() || Args.size() > MaxCallArgs)
+        return false;
+    const PrototypeAST &Proto = *FI->second;
+    if (Proto.getArgs().size() != Args.size() || !Proto.getReturnType().isNumber())
+        return false;
+    for (auto &ArgTy : Proto.getArgTypes())
+        if (!ArgTy.isNumber())
+            return false;
+
+    // Arguments go into consecutive registers.
+    unsigned Base = NextReg;
+    for (size_t i = 0; i < Args.size(); ++i)
+        newReg();
+    for (size_t i = 0; i < Args.size(); ++i)
+        if (!emitExpr(Args[i], Base + i))
+            return false;
+
+    BCInstr I(BC_Call, Dst, Base, Args.size());
+    I.Fn = lookupSymbol(Proto.getSymbolName());
+    if (!I.Fn)
+        return false;
+    emit(I);
+    return true;
+}
+
+bool BytecodeCompiler::emitIf(IfExprAST *E, unsigned Dst) {
+    if (!emitExpr(E->getCond(), Dst))
+        return false;
+    size_t ToElse = emit(BCInstr(BC_JmpIfFalse, Dst));
+    if (!emitExpr(E->getThen(), Dst))
+        return false;
+    size_t ToEnd = emit(BCInstr(BC_Jmp));
+    patchTarget(ToElse);
+    if (!emitExpr(E->getElse(), Dst))
+        return false;
+    patchTarget(ToEnd);
+    return true;
+}
+
+/// Same order as ForExprAST::codegen(): body, step, increment, then the end condition
+/// decides whether to run the body again.
+bool BytecodeCompiler::emitFor(ForExprAST *E, unsigned Dst) {
+    unsigned Counter = newReg();
+    if (!emitExpr(E->getStart(), Counter))
+        return false;
+
+    auto Old = Locals.find(E->getVarName());
+    bool HadOld = Old != Locals.end();
+    unsigned OldReg = HadOld ? Old->second : 0;
+    Locals[E->getVarName()] = Counter;
+
+    unsigned Tmp = newReg();
+    size_t Loop = P.Code.size();
+    bool Ok = emitExpr(E->getBody(), Tmp);
+    if (Ok && E->getStep()) {
+        Ok = emitExpr(E->getStep(), Tmp);
+    } else if (Ok) {
+        BCInstr One(BC_LoadK, Tmp);
+        One.K = 1.0;
+        emit(One);
+    }
+    if (Ok) {
+        emit(BCInstr(BC_Add, Counter, Counter, Tmp));
+        Ok = emitExpr(E->getEnd(), Tmp);
+    }
+    if (Ok) {
+        BCInstr Back(BC_JmpIfTrue, Tmp);
+        Back.Target = Loop;
+        emit(Back);
+        BCInstr Zero(BC_LoadK, Dst);
+        emit(Zero);
+    }
+
+    if (HadOld)
+        Locals[E->getVarName()] = OldReg;
+    else
+        Locals.erase(E->getVarName());
+    return Ok;
+}
+
+bool BytecodeCompiler::emitVar(VarExprAST *E, unsigned Dst) {
+    if (E->hasTypes())
+        return false;
+    std::vector<std::pair<std::string, ExprAST*>> Bindings;
+    E->forEachBinding([&](const std::string &Name, ExprAST *Init) { Bindings.emplace_back(Name, Init); });
+
+    std::map<std::string, unsigned> OldLocals = Locals;
+    bool Ok = true;
+    for (auto &B : Bindings) {
+        // The initializer is evaluated before the name is in scope.
+        unsigned Reg = newReg();
+        if (B.second) {
+            Ok = emitExpr(B.second, Reg);
+        } else {
+            emit(BCInstr(BC_LoadK, Reg));
+        }
+        if (!Ok)
+            break;
+        Locals[B.first] = Reg;
+    }
+    if (Ok)
+        Ok = emitExpr(E->getBody(), Dst);
+    Locals = std::move(OldLocals);
+    return Ok;
+}
+
+bool CompileBytecode(ExprAST *E, BytecodeProgram &P) {
+    // Every value is a double here, f32 mode needs the JIT.
+    if (NumPrecision != Precision::F64)
+        return false;
+    BytecodeCompiler Compiler(P);
+    return Compiler.compile(E);
+}
+
+//===----------------------------------------------------------------------===//
+// Interpreter
+//===----------------------------------------------------------------------===//
+
+typedef double (*Fn0)();
+typedef double (*Fn1)(double);
+typedef double (*Fn2)(double, double);
+typedef double (*Fn3)(double, double, double);
+typedef double (*Fn4)(double, double, double, double);
+typedef double (*Fn5)(double, double, double, double, double);
+typedef double (*Fn6)(double, double, double, double, double, double);
+
+static double CallNative(void *Fn, const double *A, unsigned NumArgs) {
+    switch (NumArgs) {
+    case 0: return reinterpret_cast<Fn0>(Fn)();
+    case 1: return reinterpret_cast<Fn1>(Fn)(A[0]);
+    case 2: return reinterpret_cast<Fn2>(Fn)(A[0], A[1]);
+    case 3: return reinterpret_cast<Fn3>(Fn)(A[0], A[1], A[2]);
+    case 4: return reinterpret_cast<Fn4>(Fn)(A[0], A[1], A[2], A[3]);
+    case 5: return reinterpret_cast<Fn5>(Fn)(A[0], A[1], A[2], A[3], A[4]);
+    default: return reinterpret_cast<Fn6>(Fn)(A[0], A[1], A[2], A[3], A[4], A[5]);
+    }
+}
+
+double RunBytecode(BytecodeProgram &P) {
+    std::vector<double> Regs(P.NumRegs);
+    double *R = Regs.data();
+    const BCInstr *Code = P.Code.data();
+    const BCInstr *IP = Code;
+
+#ifdef BC_COMPUTED_GOTO
+    // Direct threading: each instruction jumps straight to the handler of the next.
+    static const void *const Labels[] = {
+#define BC_LABEL(Name) &&Op_##Name,
+        BC_OPCODES(BC_LABEL)
+#undef BC_LABEL
+    };
+    if (!P.Threaded) {
+        for (auto &I : P.Code)
+            I.Handler = Labels[I.Op];
+        P.Threaded = true;
+    }
+#define DISPATCH() goto *IP->Handler
+#define OP(Name) Op_##Name:
+    DISPATCH();
+#else
+#define DISPATCH() goto Dispatch
+#define OP(Name) case BC_##Name:
+Dispatch:
+    switch (IP->Op) {
+#endif
+
+    OP(LoadK) R[IP->A] = IP->K; ++IP; DISPATCH();
+    OP(Mov) R[IP->A] = R[IP->B]; ++IP; DISPATCH();
+    OP(Add) R[IP->A] = R[IP->B] + R[IP->C]; ++IP; DISPATCH();
+    OP(Sub) R[IP->A] = R[IP->B] - R[IP->C]; ++IP; DISPATCH();
+    OP(Mul) R[IP->A] = R[IP->B] * R[IP->C]; ++IP; DISPATCH();
+    OP(Div) R[IP->A] = R[IP->B] / R[IP->C]; ++IP; DISPATCH();
+    OP(Lt) R[IP->A] = !(R[IP->B] >= R[IP->C]) ? 1.0 : 0.0; ++IP; DISPATCH();
+    OP(Jmp) IP = Code + IP->Target; DISPATCH();
+    OP(JmpIfFalse) IP = (R[IP->A] < 0.0 || R[IP->A] > 0.0) ? IP + 1 : Code + IP->Target; DISPATCH();
+    OP(JmpIfTrue) IP = (R[IP->A] < 0.0 || R[IP->A] > 0.0) ? Code + IP->Target : IP + 1; DISPATCH();
+    OP(LoadGlobal) R[IP->A] = *IP->Global; ++IP; DISPATCH();
+    OP(StoreGlobal) *IP->Global = R[IP->A]; ++IP; DISPATCH();
+    OP(Call) R[IP->A] = CallNative(IP->Fn, R + IP->B, IP->C); ++IP; DISPATCH();
+    OP(Ret) return R[IP->A];
+
+#ifndef BC_COMPUTED_GOTO
+    }
+    return 0.0;
+#endif
+#undef DISPATCH
+#undef OP
+}
+
+bool EvaluateWithBytecode(ExprAST *E, double &Result) {
+    BytecodeProgram P;
+    if (!CompileBytecode(E, P))
+        return false;
+    Result = RunBytecode(P);
+    return true;
+}
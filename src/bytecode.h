@@ -0,0 +1,70 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "ast.h"
+#include <cstdint>
+#include <vector>
+
+// A register-based bytecode for top-level expressions, which usually run only once.
+// Compiling them through LLVM (codegen, optimization, object emission, linking) costs
+// milliseconds, while interpreting them takes microseconds. The interpreter calls into
+// the JIT'd code of defined functions and into host externs.
+//
+// Only numbers are supported: literals, variables, scalar globals, the builtin and
+// user-defined operators, if, for, var and calls of functions on numbers. For anything
+// else the compiler bails out and the expression takes the JIT path, which also
+// reports any errors.
+
+// How top-level expressions run (--backend=auto|jit): auto tries the bytecode first.
+enum class Backend { Auto, JIT };
+extern Backend TopLevelBackend;
+
+#define BC_OPCODES(X) \
+    X(LoadK)      /* A = K */                              \
+    X(Mov)        /* A = B */                              \
+    X(Add)        /* A = B + C */                          \
+    X(Sub)        /* A = B - C */                          \
+    X(Mul)        /* A = B * C */                          \
+    X(Div)        /* A = B / C */                          \
+    X(Lt)         /* A = B < C, unordered compares true */ \
+    X(Jmp)        /* goto Target */                        \
+    X(JmpIfFalse) /* if A is 0 or NaN goto Target */       \
+    X(JmpIfTrue)  /* if A is neither goto Target */        \
+    X(LoadGlobal) /* A = *Global */                        \
+    X(StoreGlobal)/* *Global = A */                        \
+    X(Call)       /* A = Fn(B, B+1, .., B+C-1) */          \
+    X(Ret)        /* return A */
+
+enum BCOpcode : uint8_t {
+#define BC_ENUM(Name) BC_##Name,
+    BC_OPCODES(BC_ENUM)
+#undef BC_ENUM
+};
+
+struct BCInstr {
+    BCOpcode Op;
+    uint32_t A = 0, B = 0, C = 0;
+    union {
+        double K;
+        double *Global;
+        void *Fn;
+        uint32_t Target;
+    };
+    const void *Handler = nullptr; // label of Op, filled in by the interpreter
+    BCInstr(BCOpcode op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0) : Op(op), A(a), B(b), C(c), K(0) {}
+};
+
+struct BytecodeProgram {
+    std::vector<BCInstr> Code;
+    unsigned NumRegs = 0;
+    bool Threaded = false; // Handler is set on every instruction
+};
+
+// Compile E into P, false if E needs the JIT.
+bool CompileBytecode(ExprAST *E, BytecodeProgram &P);
+double RunBytecode(BytecodeProgram &P);
+
+// Compile and run E, false (without side effects) if E needs the JIT.
+bool EvaluateWithBytecode(ExprAST *E, double &Result);
+
+#endif // BYTECODE_H
@@ -0,0 +1,166 @@
+#include "closures.h"
+#include "codegen.h"
+#include "llvm/IR/Constants.h"
+
+// Forward declarations, see ast.cpp
+llvm::Function *getFunction(std::string Name);
+llvm::AllocaInst *CreateEntryBlockAlloca(llvm::Function *TheFunction, llvm::StringRef VarName, llvm::Type *Ty);
+
+std::map<std::string, std::unique_ptr<FunctionAST>> HigherOrderFunctions;
+
+// Every function type seen so far, by closure type name, so calls can decode it.
+static std::map<std::string, TypeAST> ClosureSignatures;
+
+llvm::FunctionType *getClosureCodeTy(const TypeAST &FnTy) {
+    std::vector<llvm::Type*> Params = {llvm::PointerType::getUnqual(*TheContext)};
+    for (auto &ParamTy : FnTy.getParamTypes()) {
+        Params.push_back(ParamTy.codegen());
+        if (!Params.back())
+            return nullptr;
+    }
+    const TypeAST &ResultTy = FnTy.getResultType();
+    if (ResultTy.isArray() || ResultTy.containsFunction()) {
+        LogErrorV("function values cannot return arrays or functions");
+        return nullptr;
+    }
+    llvm::Type *Result = ResultTy.codegen();
+    if (!Result)
+        return nullptr;
+    return llvm::FunctionType::get(Result, Params, false);
+}
+
+llvm::StructType *getClosureTy(const TypeAST &FnTy) {
+    std::string Name = FnTy.getName();
+    // Named types live in the context, so each is created once per context.
+    if (auto *ST = llvm::StructType::getTypeByName(*TheContext, Name))
+        return ST;
+    if (!getClosureCodeTy(FnTy))
+        return nullptr;
+    ClosureSignatures.emplace(Name, FnTy);
+    llvm::Type *PtrTy = llvm::PointerType::getUnqual(*TheContext);
+    return llvm::StructType::create(*TheContext, {PtrTy, PtrTy}, Name);
+}
+
+bool getClosureSignature(llvm::Type *Ty, TypeAST &FnTy) {
+    auto *ST = llvm::dyn_cast<llvm::StructType>(Ty);
+    if (!ST || !ST->hasName())
+        return false;
+    auto It = ClosureSignatures.find(ST->getName().str());
+    if (It == ClosureSignatures.end())
+        return false;
+    FnTy = It->second;
+    return true;
+}
+
+llvm::Value *EmitClosure(llvm::Function *Code, llvm::Value *Env, llvm::StructType *ClosureTy) {
+    llvm::Value *Closure = llvm::PoisonValue::get(ClosureTy);
+    Closure = Builder->CreateInsertValue(Closure, Code, 0);
+    return Builder->CreateInsertValue(Closure, Env, 1, "closure");
+}
+
+llvm::Value *EmitClosureCall(llvm::Value *Closure, std::vector<llvm::Value*> Args) {
+    TypeAST FnTy;
+    if (!getClosureSignature(Closure->getType(), FnTy))
+        return LogErrorV("only functions can be called");
+    llvm::FunctionType *FT = getClosureCodeTy(FnTy);
+    if (!FT)
+        return nullptr;
+    if (Args.size() + 1 != FT->getNumParams())
+        return LogErrorV("Incorrect # arguments passed");
+
+    std::vector<llvm::Value*> ArgsV = {Builder->CreateExtractValue(Closure, 1, "env")};
+    for (unsigned i = 0, e = Args.size(); i != e; ++i) {
+        ArgsV.push_back(CoerceValue(Args[i], FT->getParamType(i + 1)));
+        if (!ArgsV.back())
+            return nullptr;
+    }
+    llvm::Value *Code = Builder->CreateExtractValue(Closure, 0, "code");
+    return Builder->CreateCall(FT, Code, ArgsV, "calltmp");
+}
+
+llvm::Value *EmitFunctionRef(const std::string &Name) {
+    auto FI = FunctionProtos.find(Name);
+    if (FI == FunctionProtos.end())
+        return LogErrorV("Unknown function referenced");
+    const PrototypeAST &P = *FI->second;
+    if (P.isGenerator())
+        return LogErrorV("generators cannot be used as function values");
+    TypeAST FnTy = TypeAST::getFunction(P.getArgTypes(), P.getReturnType());
+    llvm::StructType *ClosureTy = getClosureTy(FnTy);
+    if (!ClosureTy)
+        return nullptr;
+    llvm::Value *NoEnv = llvm::ConstantPointerNull::get(llvm::PointerType::getUnqual(*TheContext));
+
+    // The trampoline drops the environment and converts to and from the callee's ABI
+    // (externs keep their double signature in f32 mode).
+    std::string TrampolineName = Name + ".fn";
+    if (llvm::Function *Trampoline = TheModule->getFunction(TrampolineName))
+        return EmitClosure(Trampoline, NoEnv, ClosureTy);
+    llvm::Function *Callee = getFunction(Name);
+    if (!Callee)
+        return LogErrorV("Unknown function referenced");
+    llvm::Function *Trampoline = llvm::Function::Create(getClosureCodeTy(FnTy), llvm::Function::InternalLinkage,
+                                                        TrampolineName, TheModule.get());
+    Trampoline->addFnAttr(llvm::Attribute::AlwaysInline);
+
+    auto SavedIP = Builder->saveIP();
+    Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", Trampoline));
+    std::vector<llvm::Value*> ArgsV;
+    for (unsigned i = 0, e = Callee->arg_size(); i != e; ++i)
+        ArgsV.push_back(Builder->CreateFPCast(Trampoline->getArg(i + 1), Callee->getArg(i)->getType()));
+    llvm::Value *Result = Builder->CreateCall(Callee, ArgsV, "calltmp");
+    Builder->CreateRet(Builder->CreateFPCast(Result, Trampoline->getReturnType()));
+    Builder->restoreIP(SavedIP);
+    return EmitClosure(Trampoline, NoEnv, ClosureTy);
+}
+
+llvm::Value *EmitParallelFor(llvm::Value *N, llvm::Value *Closure) {
+    TypeAST FnTy;
+    if (!getClosureSignature(Closure->getType(), FnTy) || FnTy.getParamTypes().size() != 1)
+        return LogErrorV("parfor() takes a function of one number");
+    llvm::Type *PtrTy = llvm::PointerType::getUnqual(*TheContext);
+    llvm::Type *I64Ty = Builder->getInt64Ty();
+
+    // The closure stays in the caller's frame, which outlives the call.
+    llvm::Function *Parent = Builder->GetInsertBlock()->getParent();
+    llvm::AllocaInst *Ctx = CreateEntryBlockAlloca(Parent, "parfor.closure", Closure->getType());
+    Builder->CreateStore(Closure, Ctx);
+
+    llvm::FunctionType *BodyTy = llvm::FunctionType::get(Builder->getVoidTy(), {PtrTy, I64Ty}, false);
+    llvm::Function *Body = llvm::Function::Create(BodyTy, llvm::Function::InternalLinkage, "parfor.body",
+                                                  TheModule.get());
+    auto SavedIP = Builder->saveIP();
+    Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", Body));
+    llvm::Value *C = Builder->CreateLoad(Closure->getType(), Body->getArg(0), "closure");
+    llvm::Value *I = Builder->CreateSIToFP(Body->getArg(1), getNumTy(), "i");
+    llvm::Value *Call = EmitClosureCall(C, {I});
+    if (Call)
+        Builder->CreateRetVoid();
+    Builder->restoreIP(SavedIP);
+    if (!Call) {
+        Body->eraseFromParent();
+        return nullptr;
+    }
+    RunFunctionPasses(*Body);
+
+    llvm::FunctionCallee ParallelFor = TheModule->getOrInsertFunction(
+        "kaleido_parallel_for", Builder->getVoidTy(), I64Ty, PtrTy, PtrTy);
+    Builder->CreateCall(ParallelFor, {Builder->CreateFPToSI(N, I64Ty, "n"), Body, Ctx});
+    return llvm::ConstantFP::get(getNumTy(), 0.0);
+}
+
+llvm::Function *getSpecializedFunction(const std::string &Name) {
+    auto It = HigherOrderFunctions.find(Name);
+    if (It == HigherOrderFunctions.end())
+        return nullptr;
+    std::string CloneName = Name + ".inl";
+    if (llvm::Function *F = TheModule->getFunction(CloneName))
+        return F;
+
+    // The clone is emitted in the middle of the caller, so set the caller's insertion
+    // point aside. Its locals are hidden by the frame of the clone's body.
+    auto SavedIP = Builder->saveIP();
+    llvm::Function *F = It->second->codegenClone(CloneName);
+    Builder->restoreIP(SavedIP);
+    return F;
+}
@@ -0,0 +1,53 @@
+#ifndef CLOSURES_H
+#define CLOSURES_H
+
+#include "ast.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Value.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Function values: lambdas "fn(x) x * k" and named functions used as values.
+//
+// A function value is a closure, a code pointer and an environment in a named struct
+//   %"fn(double) : double" = type { ptr code, ptr env }
+// named after the signature, so the type of a value says how to call it. The code takes
+// the environment as a hidden first argument. A lambda copies the variables it captures
+// into an environment in the frame of the function that evaluates it, so function values
+// only travel downwards: they can be passed to calls, but not returned or stored in
+// records, arrays or globals.
+//
+// Calls through a function value are indirect. To get rid of them, functions taking a
+// function value are kept as ASTs and re-emitted as an alwaysinline clone into every
+// module that calls them. Once FinalizeModule() inlined the clone, the closure argument
+// is a constant, the indirect call folds into a direct one and the lambda is inlined too.
+
+// The closure type of a function type, or nullptr if a parameter or result type is unknown.
+llvm::StructType *getClosureTy(const TypeAST &FnTy);
+// The function type behind a closure type, false if Ty is not a closure.
+bool getClosureSignature(llvm::Type *Ty, TypeAST &FnTy);
+// The type of the code of a closure: result(ptr env, params...).
+llvm::FunctionType *getClosureCodeTy(const TypeAST &FnTy);
+
+// Pair Code with its environment (null when nothing is captured).
+llvm::Value *EmitClosure(llvm::Function *Code, llvm::Value *Env, llvm::StructType *ClosureTy);
+// Call a closure, the arguments are coerced to its parameter types.
+llvm::Value *EmitClosureCall(llvm::Value *Closure, std::vector<llvm::Value*> Args);
+// The function Name as a value, through an inlinable trampoline "Name.fn".
+llvm::Value *EmitFunctionRef(const std::string &Name);
+// parfor(n, f): f(i) for every i in [0, N) on the runtime's threads (runtime.h). The
+// runtime calls a "parfor.body" function with a pointer to the closure and i, which
+// calls the closure; the captured variables are copies, so only stores through arrays
+// are seen by the caller. Returns 0.
+llvm::Value *EmitParallelFor(llvm::Value *N, llvm::Value *Closure);
+
+// The definitions of functions with a parameter of function type, and of generators
+// (see generators.h), by name. Like FunctionProtos, this outlives modules.
+extern std::map<std::string, std::unique_ptr<FunctionAST>> HigherOrderFunctions;
+// The alwaysinline clone "Name.inl" in the current module, or nullptr.
+llvm::Function *getSpecializedFunction(const std::string &Name);
+
+#endif // CLOSURES_H
@@ -1,5 +1,6 @@
 #include "codegen.h"
 #include "ast.h"
+#include "complex.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
@@ -8,22 +9,42 @@
 #include "llvm/Passes/StandardInstrumentations.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
+#include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Transforms/Coroutines/CoroCleanup.h"
+#include "llvm/Transforms/Coroutines/CoroEarly.h"
+#include "llvm/Transforms/Coroutines/CoroElide.h"
+#include "llvm/Transforms/Coroutines/CoroSplit.h"
+#include "llvm/Transforms/IPO/AlwaysInliner.h"
+#include "llvm/Transforms/IPO/GlobalDCE.h"
 #include "llvm/Transforms/InstCombine/InstCombine.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Scalar/IndVarSimplify.h"
+#include "llvm/Transforms/Scalar/LoopPassManager.h"
+#include "llvm/Transforms/Scalar/LoopUnrollPass.h"
 #include "llvm/Transforms/Scalar/Reassociate.h"
+#include "llvm/Transforms/Scalar/SROA.h"
 #include "llvm/Transforms/Scalar/SimplifyCFG.h"
 #include "llvm/Transforms/Utils/Mem2Reg.h"
+#include "llvm/Transforms/Vectorize/LoopVectorize.h"
 #include "KaleidoscopeJIT.h"
+#include <chrono>
 #include <cstdio>
+#include <optional>
 
 
+// The context every module is built in, see InitializeModule(). Defined first, so
+// it is destroyed last, after the builder and the open module that use it.
+static llvm::orc::ThreadSafeContext TheTSC;
+static std::optional<llvm::orc::ThreadSafeContext::Lock> ContextLock;
+
 // Codegen globals
-std::unique_ptr<llvm::LLVMContext> TheContext;
+llvm::LLVMContext *TheContext;
 std::unique_ptr<llvm::IRBuilder<>> Builder;
 std::unique_ptr<llvm::Module> TheModule;
-std::map<std::string, llvm::AllocaInst *> NamedValues;
+SymbolTable NamedValues;
 std::map<std::string, std::unique_ptr<PrototypeAST>> FunctionProtos;
+std::vector<llvm::Function *> ModuleFunctions;
 std::unique_ptr<llvm::orc::KaleidoscopeJIT> TheJIT;
 std::unique_ptr<llvm::FunctionPassManager> TheFPM;
 std::unique_ptr<llvm::LoopAnalysisManager> TheLAM;
@@ -33,16 +54,204 @@ std::unique_ptr<llvm::ModuleAnalysisManager> TheMAM;
 std::unique_ptr<llvm::PassInstrumentationCallbacks> ThePIC;
 std::unique_ptr<llvm::StandardInstrumentations> TheSI;
 
+Precision NumPrecision = Precision::F64;
+ContextMode TheContextMode = ContextMode::Shared;
+
+llvm::Type *getNumTy() {
+    if (NumPrecision == Precision::F32)
+        return llvm::Type::getFloatTy(*TheContext);
+    return llvm::Type::getDoubleTy(*TheContext);
+}
+
+bool isTupleTy(llvm::Type *Ty) {
+    auto *ST = llvm::dyn_cast<llvm::StructType>(Ty);
+    return ST && ST->isLiteral();
+}
+
+llvm::Value *CoerceValue(llvm::Value *V, llvm::Type *Ty) {
+    llvm::Type *From = V->getType();
+    if (From == Ty)
+        return V;
+    if (isTupleTy(From) && isTupleTy(Ty)) {
+        unsigned N = Ty->getStructNumElements();
+        if (From->getStructNumElements() != N)
+            return LogErrorV("tuple sizes do not match");
+        llvm::Value *Tup = llvm::PoisonValue::get(Ty);
+        for (unsigned i = 0; i != N; ++i) {
+            llvm::Value *Elem = CoerceValue(Builder->CreateExtractValue(V, i), Ty->getStructElementType(i));
+            if (!Elem)
+                return nullptr;
+            Tup = Builder->CreateInsertValue(Tup, Elem, i);
+        }
+        return Tup;
+    }
+    if (From->isFloatingPointTy() && Ty->isFloatingPointTy())
+        return Builder->CreateFPCast(V, Ty);
+    if (isComplexTy(Ty) && (From->isFloatingPointTy() || isComplexTy(From)))
+        return Builder->CreateFPCast(PromoteToComplex(V), Ty);
+    if (isComplexTy(From) && Ty->isFloatingPointTy())
+        return LogErrorV("a complex value cannot be used as a number, use re(), im() or abs2()");
+    return LogErrorV("type mismatch");
+}
+
+llvm::Type *UnifyTypes(llvm::Type *A, llvm::Type *B) {
+    if (A == B)
+        return A;
+    if (isTupleTy(A) && isTupleTy(B)) {
+        if (A->getStructNumElements() != B->getStructNumElements())
+            return nullptr;
+        std::vector<llvm::Type*> Elems;
+        for (unsigned i = 0, e = A->getStructNumElements(); i != e; ++i) {
+            Elems.push_back(UnifyTypes(A->getStructElementType(i), B->getStructElementType(i)));
+            if (!Elems.back())
+                return nullptr;
+        }
+        return llvm::StructType::get(*TheContext, Elems);
+    }
+    bool NumericA = A->isFloatingPointTy() || isComplexTy(A);
+    bool NumericB = B->isFloatingPointTy() || isComplexTy(B);
+    if (!NumericA || !NumericB)
+        return nullptr;
+    return isComplexTy(A) || isComplexTy(B) ? getComplexTy() : getNumTy();
+}
+
+TopLevelResult LastTopLevelResult;
+
+/// Store a number or complex value at lane Lane of Out and advance Lane past it.
+static bool StoreLanes(llvm::Value *V, llvm::Value *Out, unsigned &Lane, ResultKind &Kind) {
+    if (V->getType()->isFloatingPointTy()) {
+        Builder->CreateStore(Builder->CreateFPCast(V, getNumTy()), Builder->CreateConstGEP1_32(getNumTy(), Out, Lane++));
+        Kind = ResultKind::Number;
+        return true;
+    }
+    if (isComplexTy(V->getType())) {
+        for (unsigned i = 0; i < 2; ++i) {
+            llvm::Value *Elem = Builder->CreateExtractElement(V, uint64_t(i));
+            Builder->CreateStore(Elem, Builder->CreateConstGEP1_32(getNumTy(), Out, Lane++));
+        }
+        Kind = ResultKind::Complex;
+        return true;
+    }
+    return false;
+}
+
+bool StoreTopLevelResult(llvm::Value *V, llvm::Value *Out) {
+    TopLevelResult Result;
+    unsigned Lane = 0;
+    if (isTupleTy(V->getType())) {
+        Result.Kind = ResultKind::Tuple;
+        for (unsigned i = 0, e = V->getType()->getStructNumElements(); i != e; ++i) {
+            ResultKind ElemKind;
+            if (!StoreLanes(Builder->CreateExtractValue(V, i), Out, Lane, ElemKind)) {
+                LogErrorV("top-level expression has a type that cannot be printed");
+                return false;
+            }
+            Result.Elements.push_back(ElemKind);
+        }
+    } else if (!StoreLanes(V, Out, Lane, Result.Kind)) {
+        LogErrorV("top-level expression has a type that cannot be printed");
+        return false;
+    }
+    Result.Lanes = Lane;
+    LastTopLevelResult = Result;
+    return true;
+}
+
 llvm::Value *LogErrorV(const char *Str) {
     fprintf(stderr, "LogError: %s\n", Str);
     return nullptr;
 }
 
+/// The per-function optimization pipeline, run on every function once it is generated.
+static void AddFunctionPasses(llvm::FunctionPassManager &FPM) {
+    FPM.addPass(llvm::PromotePass());          // mem2reg pass
+    FPM.addPass(llvm::SROAPass(llvm::SROAOptions::ModifyCFG)); // splits record variables into registers
+    FPM.addPass(llvm::InstCombinePass());     // peephole optimization
+    FPM.addPass(llvm::ReassociatePass());
+    FPM.addPass(llvm::GVNPass());
+    FPM.addPass(llvm::SimplifyCFGPass());
+
+    // loop passes, these honor the llvm.loop hints emitted for 'for [...]'.
+    // indvars turns the double counter into an integer one so trip counts are computable.
+    FPM.addPass(llvm::createFunctionToLoopPassAdaptor(llvm::IndVarSimplifyPass()));
+    FPM.addPass(llvm::LoopVectorizePass());
+    FPM.addPass(llvm::LoopUnrollPass());
+    FPM.addPass(llvm::InstCombinePass());
+    FPM.addPass(llvm::SimplifyCFGPass());
+}
+
+double FunctionPassSeconds = 0;
+
+void RunFunctionPasses(llvm::Function &F) {
+    auto Start = std::chrono::steady_clock::now();
+    TheFPM->run(F, *TheFAM);
+    FunctionPassSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+}
+
+void FinalizeModule() {
+    ModuleFunctions.clear();
+    bool HasInlinable = false, HasCoroutines = false;
+    for (auto &F : *TheModule) {
+        HasInlinable |= !F.isDeclaration() && F.hasFnAttribute(llvm::Attribute::AlwaysInline);
+        // Generators, and the llvm.coro.* intrinsics of the loops consuming them.
+        HasCoroutines |= F.isPresplitCoroutine() || F.getName().starts_with("llvm.coro.");
+    }
+    if (!HasInlinable && !HasCoroutines)
+        return;
+
+    // Split the generators into their ramp, resume and destroy functions first, so
+    // the ramps can be inlined into the loops consuming them (see generators.h).
+    llvm::ModulePassManager MPM;
+    if (HasCoroutines) {
+        MPM.addPass(llvm::CoroEarlyPass());
+        MPM.addPass(llvm::createModuleToPostOrderCGSCCPassAdaptor(llvm::CoroSplitPass()));
+    }
+    // Two rounds: inlining a clone makes its closure argument a constant, the function
+    // passes fold the indirect call through it into a direct call, and the second
+    // round inlines that one as well. Likewise CoroElide turns the resumes of an
+    // inlined generator into direct calls of its resume function.
+    for (int Round = 0; Round < 2; ++Round) {
+        MPM.addPass(llvm::AlwaysInlinerPass());
+        llvm::FunctionPassManager FPM;
+        if (HasCoroutines)
+            FPM.addPass(llvm::CoroElidePass());
+        AddFunctionPasses(FPM);
+        MPM.addPass(llvm::createModuleToFunctionPassAdaptor(std::move(FPM)));
+    }
+    // Lower what is left of the coroutine intrinsics.
+    if (HasCoroutines)
+        MPM.addPass(llvm::CoroCleanupPass());
+    // Drop the clones, lambdas and trampolines that were inlined everywhere.
+    MPM.addPass(llvm::GlobalDCEPass());
+    MPM.run(*TheModule, *TheMAM);
+}
+
 void InitializeModule() {
-    // Open a new context and module.
-    TheContext = std::make_unique<llvm::LLVMContext>();
+    ContextLock.reset();
+    bool NewContext = !TheContext || TheContextMode == ContextMode::Fresh;
+    if (NewContext) {
+        TheTSC = llvm::orc::ThreadSafeContext(std::make_unique<llvm::LLVMContext>());
+        TheContext = TheTSC.getContext();
+    }
+    // The JIT compiles on the thread that looks a symbol up, which already holds this
+    // (recursive) lock, so lookups while a module is being built do not deadlock.
+    ContextLock.emplace(TheTSC.getLock());
+
+    // Open a new module.
     TheModule = std::make_unique<llvm::Module>("my cool jit", *TheContext);
     TheModule->setDataLayout(TheJIT->getDataLayout());
+    ModuleFunctions.clear();
+
+    if (!NewContext) {
+        // The builder, the instrumentation and the pass pipeline belong to the context.
+        // Only the cached analyses refer to IR of the previous module.
+        Builder->ClearInsertionPoint();
+        TheLAM->clear();
+        TheFAM->clear();
+        TheCGAM->clear();
+        TheMAM->clear();
+        return;
+    }
 
     // Create a new builder for the module.
     Builder = std::make_unique<llvm::IRBuilder<>>(*TheContext);
@@ -59,18 +268,21 @@ void InitializeModule() {
     TheSI->registerCallbacks(*ThePIC, TheMAM.get());
 
     // add the transformative passes
-    TheFPM->addPass(llvm::PromotePass());          // mem2reg pass
-    TheFPM->addPass(llvm::InstCombinePass());     // peephole optimization
-    TheFPM->addPass(llvm::ReassociatePass());
-    TheFPM->addPass(llvm::GVNPass());
-    TheFPM->addPass(llvm::SimplifyCFGPass());
+    AddFunctionPasses(*TheFPM);
 
     // Register analysis passes used in these transform passes.
-    llvm::PassBuilder PB;
+    // The target machine gives the vectorizer and unroller real cost information.
+    llvm::PassBuilder PB(&TheJIT->getTargetMachine());
     PB.registerModuleAnalyses(*TheMAM);
     PB.registerFunctionAnalyses(*TheFAM);
     PB.registerLoopAnalyses(*TheLAM);
     PB.registerCGSCCAnalyses(*TheCGAM);
     PB.crossRegisterProxies(*TheLAM, *TheFAM, *TheCGAM, *TheMAM);
 
-}
\ No newline at end of file
+}
+
+llvm::orc::ThreadSafeModule TakeModule() {
+    llvm::orc::ThreadSafeModule TSM(std::move(TheModule), TheTSC);
+    ContextLock.reset();
+    return TSM;
+}
@@ -1,6 +1,7 @@
 #ifndef CODEGEN_H
 #define CODEGEN_H
 
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Module.h"
@@ -17,7 +18,9 @@
 #include <memory>
 #include <map>
 #include <string>
+#include <vector>
 #include "ast.h"
+#include "symbols.h"
 
 // Forward declaration for KaleidoscopeJIT
 namespace llvm {
@@ -27,11 +30,16 @@ class KaleidoscopeJIT;
 }
 
 // Codegen globals
-extern std::unique_ptr<llvm::LLVMContext> TheContext;
+extern llvm::LLVMContext *TheContext; // owned by the context of the current module, see ContextMode
 extern std::unique_ptr<llvm::IRBuilder<>> Builder;
 extern std::unique_ptr<llvm::Module> TheModule;
-extern std::map<std::string, llvm::AllocaInst *> NamedValues;
+// Local variables of the function being generated, see SymbolTable.
+extern SymbolTable NamedValues;
 extern std::map<std::string, std::unique_ptr<PrototypeAST>> FunctionProtos;
+// Function declarations of the current module by symbol, filled in by getFunction().
+// Emptied whenever functions may disappear from the module: a new module, the
+// module passes of FinalizeModule() and the removal of a failed definition.
+extern std::vector<llvm::Function *> ModuleFunctions;
 extern std::unique_ptr<llvm::orc::KaleidoscopeJIT> TheJIT;
 extern std::unique_ptr<llvm::FunctionPassManager> TheFPM;
 extern std::unique_ptr<llvm::LoopAnalysisManager> TheLAM;
@@ -41,10 +49,56 @@ extern std::unique_ptr<llvm::ModuleAnalysisManager> TheMAM;
 extern std::unique_ptr<llvm::PassInstrumentationCallbacks> ThePIC;
 extern std::unique_ptr<llvm::StandardInstrumentations> TheSI;
 
+// Run TheFPM on F, the per-function optimizations. The time spent is added up in
+// FunctionPassSeconds, which the driver reports apart from IR building (driver.h).
+void RunFunctionPasses(llvm::Function &F);
+extern double FunctionPassSeconds;
+
+// Floating point type every Kaleidoscope number is compiled to (--precision=f64|f32).
+enum class Precision { F64, F32 };
+extern Precision NumPrecision;
+llvm::Type *getNumTy();
+
+// Tuples are literal (unnamed) LLVM structs; records are the named ones.
+bool isTupleTy(llvm::Type *Ty);
+
+// Convert V to Ty: floating point numbers are extended/truncated, numbers promote
+// to complex and tuples convert element-wise. Logs an error and returns nullptr for
+// anything else.
+llvm::Value *CoerceValue(llvm::Value *V, llvm::Type *Ty);
+// The type two values (e.g. the arms of an if) coerce to, or nullptr.
+llvm::Type *UnifyTypes(llvm::Type *A, llvm::Type *B);
+
+// The top-level expression is compiled as "void __anon_expr(number *Out)" and writes
+// its result lanes (1 for a number, 2 for complex, the lanes of every element for a
+// tuple) to Out. This records the shape of the last one, so the driver knows how to
+// read and print it.
+enum class ResultKind { Number, Complex, Tuple };
+struct TopLevelResult {
+    ResultKind Kind = ResultKind::Number;
+    unsigned Lanes = 1;
+    std::vector<ResultKind> Elements; // tuples only
+};
+extern TopLevelResult LastTopLevelResult;
+bool StoreTopLevelResult(llvm::Value *V, llvm::Value *Out);
+
 // Error logging for codegen
 llvm::Value *LogErrorV(const char *Str);
 
-// Module initialization
+// Contexts of the modules (--context=shared|fresh). Shared compiles every module in one
+// long-lived ThreadSafeContext, so its uniqued types and constants, the builder and the
+// pass pipeline are set up once. Fresh gives every module a new context, which is
+// freed together with the module's code.
+enum class ContextMode { Shared, Fresh };
+extern ContextMode TheContextMode;
+
+// Module initialization. Codegen holds the context's lock from here until the module
+// is handed to the JIT by TakeModule().
 void InitializeModule();
+llvm::orc::ThreadSafeModule TakeModule();
+// Run the module-level passes before the module goes to the JIT: splitting of the
+// generators (see generators.h), inlining of the alwaysinline functions behind
+// function values and generators (see closures.h), then cleanup.
+void FinalizeModule();
 
 #endif // CODEGEN_H
\ No newline at end of file
@@ -0,0 +1,91 @@
+#include "complex.h"
+#include "codegen.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+
+llvm::Type *getComplexTy() {
+    return llvm::FixedVectorType::get(getNumTy(), 2);
+}
+
+bool isComplexTy(llvm::Type *Ty) {
+    auto *VT = llvm::dyn_cast<llvm::FixedVectorType>(Ty);
+    return VT && VT->getNumElements() == 2 && VT->getElementType()->isFloatingPointTy();
+}
+
+llvm::Value *PromoteToComplex(llvm::Value *V) {
+    if (isComplexTy(V->getType()))
+        return V;
+    V = Builder->CreateFPCast(V, getNumTy());
+    return Builder->CreateInsertElement(llvm::Constant::getNullValue(getComplexTy()), V, uint64_t(0), "cplx");
+}
+
+static llvm::Value *Lanes(double Re, double Im) {
+    llvm::Constant *Elts[] = {llvm::ConstantFP::get(getNumTy(), Re), llvm::ConstantFP::get(getNumTy(), Im)};
+    return llvm::ConstantVector::get(Elts);
+}
+
+static llvm::Value *Conj(llvm::Value *Z) {
+    return Builder->CreateFMul(Z, Lanes(1.0, -1.0), "conj");
+}
+
+static llvm::Value *Abs2(llvm::Value *Z) {
+    llvm::Value *Sq = Builder->CreateFMul(Z, Z);
+    return Builder->CreateFAdd(Builder->CreateExtractElement(Sq, uint64_t(0)),
+                               Builder->CreateExtractElement(Sq, uint64_t(1)), "abs2");
+}
+
+/// (a+bi)(c+di) = (ac - bd) + (bc + ad)i
+///   = <a,b>*<c,c> + <b,a>*<d,d>*<-1,1>
+static llvm::Value *Mul(llvm::Value *L, llvm::Value *R) {
+    llvm::Value *RRe = Builder->CreateShuffleVector(R, R, llvm::ArrayRef<int>{0, 0});
+    llvm::Value *RIm = Builder->CreateShuffleVector(R, R, llvm::ArrayRef<int>{1, 1});
+    llvm::Value *LSwap = Builder->CreateShuffleVector(L, L, llvm::ArrayRef<int>{1, 0});
+    llvm::Value *Cross = Builder->CreateFMul(Builder->CreateFMul(LSwap, RIm), Lanes(-1.0, 1.0));
+    return Builder->CreateFAdd(Builder->CreateFMul(L, RRe), Cross, "cmul");
+}
+
+llvm::Value *EmitComplexBinOp(char Op, llvm::Value *L, llvm::Value *R) {
+    switch (Op) {
+    case '+':
+        return Builder->CreateFAdd(L, R, "cadd");
+    case '-':
+        return Builder->CreateFSub(L, R, "csub");
+    case '*':
+        return Mul(L, R);
+    case '/': {
+        // L/R = L*conj(R) / |R|^2
+        llvm::Value *Den = Builder->CreateVectorSplat(2, Abs2(R));
+        return Builder->CreateFDiv(Mul(L, Conj(R)), Den, "cdiv");
+    }
+    default:
+        return LogErrorV("operator is not defined for complex values");
+    }
+}
+
+bool IsComplexBuiltin(const std::string &Name) {
+    return Name == "complex" || Name == "re" || Name == "im" || Name == "abs2" || Name == "conj";
+}
+
+llvm::Value *EmitComplexBuiltin(const std::string &Name, const std::vector<llvm::Value*> &Args) {
+    if (Name == "complex") {
+        if (Args.size() != 2)
+            return LogErrorV("complex(re, im) takes two numbers");
+        if (isComplexTy(Args[0]->getType()) || isComplexTy(Args[1]->getType()))
+            return LogErrorV("complex(re, im) takes two numbers");
+        llvm::Value *Z = PromoteToComplex(Args[0]);
+        return Builder->CreateInsertElement(Z, Builder->CreateFPCast(Args[1], getNumTy()), uint64_t(1), "complex");
+    }
+
+    if (Args.size() != 1)
+        return LogErrorV("Incorrect # arguments passed");
+    llvm::Value *Z = PromoteToComplex(Args[0]);
+    if (Name == "re")
+        return Builder->CreateExtractElement(Z, uint64_t(0), "re");
+    if (Name == "im")
+        return Builder->CreateExtractElement(Z, uint64_t(1), "im");
+    if (Name == "abs2")
+        return Abs2(Z);
+    if (Name == "conj")
+        return Conj(Z);
+    return nullptr;
+}
@@ -0,0 +1,25 @@
+#ifndef COMPLEX_H
+#define COMPLEX_H
+
+#include "llvm/IR/Type.h"
+#include "llvm/IR/Value.h"
+#include <string>
+#include <vector>
+
+// Complex numbers are SSA values of type <2 x number> (real, imaginary), so they
+// live in registers and vectorize like any other value.
+
+llvm::Type *getComplexTy();
+bool isComplexTy(llvm::Type *Ty);
+
+// x -> x + 0i
+llvm::Value *PromoteToComplex(llvm::Value *V);
+
+// + - * / on two complex values (numbers are promoted by the caller).
+llvm::Value *EmitComplexBinOp(char Op, llvm::Value *L, llvm::Value *R);
+
+// complex(re, im), re(z), im(z), abs2(z), conj(z)
+bool IsComplexBuiltin(const std::string &Name);
+llvm::Value *EmitComplexBuiltin(const std::string &Name, const std::vector<llvm::Value*> &Args);
+
+#endif // COMPLEX_H
@@ -0,0 +1,106 @@
+#include "consteval.h"
+#include "codegen.h"
+#include "globals.h"
+#include "transforms.h"
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+typedef double (*UnaryMathFn)(double);
+typedef double (*BinaryMathFn)(double, double);
+
+// C math functions without side effects. An extern of one of these names is bound to
+// the same host function by the JIT, so calling it here gives the same result.
+static const std::map<std::string, UnaryMathFn> UnaryMath = {
+    {"sin", [](double X) { return std::sin(X); }},     {"cos", [](double X) { return std::cos(X); }},
+    {"tan", [](double X) { return std::tan(X); }},     {"asin", [](double X) { return std::asin(X); }},
+    {"acos", [](double X) { return std::acos(X); }},   {"atan", [](double X) { return std::atan(X); }},
+    {"sinh", [](double X) { return std::sinh(X); }},   {"cosh", [](double X) { return std::cosh(X); }},
+    {"tanh", [](double X) { return std::tanh(X); }},   {"exp", [](double X) { return std::exp(X); }},
+    {"log", [](double X) { return std::log(X); }},     {"log10", [](double X) { return std::log10(X); }},
+    {"log2", [](double X) { return std::log2(X); }},   {"sqrt", [](double X) { return std::sqrt(X); }},
+    {"cbrt", [](double X) { return std::cbrt(X); }},   {"fabs", [](double X) { return std::fabs(X); }},
+    {"floor", [](double X) { return std::floor(X); }}, {"ceil", [](double X) { return std::ceil(X); }},
+    {"round", [](double X) { return std::round(X); }}, {"trunc", [](double X) { return std::trunc(X); }},
+};
+static const std::map<std::string, BinaryMathFn> BinaryMath = {
+    {"pow", [](double X, double Y) { return std::pow(X, Y); }},
+    {"atan2", [](double X, double Y) { return std::atan2(X, Y); }},
+    {"fmod", [](double X, double Y) { return std::fmod(X, Y); }},
+    {"hypot", [](double X, double Y) { return std::hypot(X, Y); }},
+    {"fmin", [](double X, double Y) { return std::fmin(X, Y); }},
+    {"fmax", [](double X, double Y) { return std::fmax(X, Y); }},
+};
+
+static bool EvaluateCall(CallExprAST *C, double &Val) {
+    // Only names declared with 'extern'; a 'def' of the same name is user code.
+    auto FI = FunctionProtos.find(C->getCallee());
+    if (FI == FunctionProtos.end() || !FI->second->isExtern())
+        return false;
+
+    std::vector<double> Args;
+    bool Ok = true;
+    C->forEachChild([&](std::unique_ptr<ExprAST> &Arg) {
+        Args.push_back(0);
+        Ok = Ok && EvaluateConstant(Arg.get(), Args.back());
+    });
+    if (!Ok || Args.size() != FI->second->getArgs().size())
+        return false;
+
+    auto U = UnaryMath.find(C->getCallee());
+    if (U != UnaryMath.end() && Args.size() == 1) {
+        Val = U->second(Args[0]);
+        return true;
+    }
+    auto B = BinaryMath.find(C->getCallee());
+    if (B != BinaryMath.end() && Args.size() == 2) {
+        Val = B->second(Args[0], Args[1]);
+        return true;
+    }
+    return false;
+}
+
+bool EvaluateConstant(ExprAST *E, double &Val) {
+    if (auto *N = llvm::dyn_cast<NumberExprAST>(E)) {
+        Val = N->getVal();
+        return true;
+    }
+    if (auto *V = llvm::dyn_cast<VariableExprAST>(E)) {
+        auto It = GlobalVars.find(V->getName());
+        if (It == GlobalVars.end() || !It->second.IsConst || It->second.IsTable)
+            return false;
+        Val = It->second.Values[0];
+        return true;
+    }
+    if (auto *C = llvm::dyn_cast<CallExprAST>(E))
+        return EvaluateCall(C, Val);
+    if (auto *If = llvm::dyn_cast<IfExprAST>(E)) {
+        // Both arms are pure, evaluating both keeps "compiles" and "folds" the same.
+        double Cond, Then, Else;
+        if (!EvaluateConstant(If->getCond(), Cond) || !EvaluateConstant(If->getThen(), Then) ||
+            !EvaluateConstant(If->getElse(), Else))
+            return false;
+        // A condition is true when it is ordered and not equal to 0.0, as in codegen.
+        Val = (Cond < 0.0 || Cond > 0.0) ? Then : Else;
+        return true;
+    }
+
+    auto *B = llvm::dyn_cast<BinaryExprAST>(E);
+    double L, R;
+    if (!B || B->getOp() == '=' || !EvaluateConstant(B->getLHS(), L) || !EvaluateConstant(B->getRHS(), R))
+        return false;
+    switch (B->getOp()) {
+    case '+': Val = L + R; return true;
+    case '-': Val = L - R; return true;
+    case '*': Val = L * R; return true;
+    case '/': Val = L / R; return true;
+    // codegen compares unordered, so NaN operands give 1.0
+    case '<': Val = !(L >= R) ? 1.0 : 0.0; return true;
+    default:
+        if (!SequenceOperators.count(B->getOp()))
+            return false;
+        Val = R;
+        return true;
+    }
+}
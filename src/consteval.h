@@ -0,0 +1,15 @@
+#ifndef CONSTEVAL_H
+#define CONSTEVAL_H
+
+#include "ast.h"
+
+// Evaluate E at compile time, without generating any code: number literals, const
+// scalars, the builtin operators, sequencing operators, if, and calls of pure C math
+// externs (sin, sqrt, pow, ...). The results are the ones the JIT'd code computes in
+// f64 mode. False if E needs codegen.
+//
+// Used for the bounds of table generators, and to answer top-level expressions such as
+// "sqrt(2) * 3" without a module or a JIT link.
+bool EvaluateConstant(ExprAST *E, double &Val);
+
+#endif // CONSTEVAL_H
@@ -0,0 +1,400 @@
+#include "driver.h"
+#include "lexer.h"
+#include "parser.h"
+#include "codegen.h"
+#include "closures.h"
+#include "bytecode.h"
+#include "consteval.h"
+#include "runtime.h"
+#include "llvm/IR/Module.h"
+#include "KaleidoscopeJIT.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+EchoLevel DriverEcho = EchoLevel::IR;
+PhaseTimes LastPhaseTimes;
+bool LastEvaluationOk = false;
+double LastEvaluatedValue = 0;
+bool LastItemOk = false;
+
+typedef std::chrono::steady_clock::time_point TimePoint;
+
+static TimePoint Now() {
+    return std::chrono::steady_clock::now();
+}
+
+static double SecondsSince(TimePoint Start) {
+    return std::chrono::duration<double>(Now() - Start).count();
+}
+
+/// Time codegen, splitting the function passes it runs off into Optimize.
+template <typename CodegenFn>
+static auto TimeCodegen(CodegenFn Codegen) -> decltype(Codegen()) {
+    double PassesBefore = FunctionPassSeconds;
+    TimePoint Start = Now();
+    auto Result = Codegen();
+    double Passes = FunctionPassSeconds - PassesBefore;
+    LastPhaseTimes.Codegen = SecondsSince(Start) - Passes;
+    LastPhaseTimes.Optimize = Passes;
+    return Result;
+}
+
+static void TimeFinalizeModule() {
+    TimePoint Start = Now();
+    FinalizeModule();
+    LastPhaseTimes.Optimize += SecondsSince(Start);
+}
+
+static void PrintModule() {
+    if (DriverEcho == EchoLevel::IR)
+        TheModule->print(llvm::errs(), nullptr);
+}
+
+//===----------------------------------------------------------------------===//
+// Top-Level parsing
+//===----------------------------------------------------------------------===//
+
+void HandleDefinition() {
+    LastPhaseTimes = PhaseTimes();
+    LastItemOk = false;
+    TimePoint Start = Now();
+    auto FnAST = ParseDefinition();
+    LastPhaseTimes.Parse = SecondsSince(Start);
+    if (FnAST) {
+        if (TimeCodegen([&] { return FnAST->codegen(); })) {
+            if (DriverEcho == EchoLevel::IR) {
+                fprintf(stderr, "Read function definition:");
+                fprintf(stderr, "\n");
+            }
+            TimeFinalizeModule();
+
+            // Print the full module IR after the definition
+            PrintModule();
+
+            // Try to add module, capture error and print it (don't ExitOnErr)
+            Start = Now();
+            auto TSM = TakeModule();
+            if (auto Err = TheJIT->addModule(std::move(TSM))) {
+                llvm::errs() << "Error adding module to JIT: " << Err;
+                return;
+            }
+            if (DriverEcho == EchoLevel::IR)
+                llvm::errs() << "Module added to JIT.\n";
+
+            // Keep the AST, callers get their own inlinable copy, see closures.h
+            if (FnAST->isHigherOrder() || FnAST->isGenerator())
+                HigherOrderFunctions[FnAST->getName()] = std::move(FnAST);
+
+            InitializeModule();
+            LastPhaseTimes.JITAdd = SecondsSince(Start);
+            LastItemOk = true;
+        }else{
+            llvm::errs() << "DEBUG---Codegen of function definition failed --- CurTok: " << CurTok << "\n";
+        }
+    } else {
+        // Skip token for error recovery.
+        llvm::errs() << "DEBUG---Parsing function definition failed --- CurTok: " << CurTok << "\n";
+        getNextToken();
+    }
+}
+
+void HandleExtern() {
+    LastPhaseTimes = PhaseTimes();
+    LastItemOk = false;
+    if (auto ProtoAST = ParseExtern()) {
+        if (ProtoAST->codegen()) {
+            if (DriverEcho == EchoLevel::IR) {
+                fprintf(stderr, "Read extern: ");
+                fprintf(stderr, "\n");
+            }
+            // Print the full module IR after the definition
+            PrintModule();
+
+            // Register the function prototype
+            FunctionProtos[ProtoAST->getName()] = std::move(ProtoAST);
+            LastItemOk = true;
+        }
+    } else {
+        // Skip token for error recovery.
+        getNextToken();
+    }
+}
+
+void HandleStruct() {
+    LastPhaseTimes = PhaseTimes();
+    LastItemOk = false;
+    if (auto RecordAST = ParseStructDecl()) {
+        LastItemOk = RecordAST->codegen();
+        if (LastItemOk && DriverEcho == EchoLevel::IR)
+            fprintf(stderr, "Read struct %s\n", RecordAST->getName().c_str());
+    } else {
+        // Skip token for error recovery.
+        getNextToken();
+    }
+}
+
+/// Compute the initial values of a global: run its initializer in a temporary module,
+/// then define the global in a module of its own that stays in the JIT.
+void HandleGlobal() {
+    LastPhaseTimes = PhaseTimes();
+    LastItemOk = false;
+    auto GlobalAST = ParseGlobalDecl();
+    if (!GlobalAST) {
+        // Skip token for error recovery.
+        getNextToken();
+        return;
+    }
+    unsigned Count = 0;
+    if (!GlobalAST->codegenInit(Count)) {
+        llvm::errs() << "DEBUG---Codegen of global initializer failed --- \n";
+        return;
+    }
+    FinalizeModule();
+
+    auto RT = TheJIT->getMainJITDylib().createResourceTracker();
+    auto TSM = TakeModule();
+    if (auto Err = TheJIT->addModule(std::move(TSM), RT)) {
+        llvm::errs() << "Error adding module to JIT: " << Err;
+        return;
+    }
+    InitializeModule();
+
+    auto InitSymbol = TheJIT->lookup("__global_init");
+    if (!InitSymbol) {
+        llvm::errs() << "JIT Lookup Error: " << InitSymbol.takeError() << "\n";
+        return;
+    }
+    void (*FP)(void *) = InitSymbol->getAddress().toPtr<void (*)(void *)>();
+    std::vector<double> Values(Count);
+    if (NumPrecision == Precision::F32) {
+        std::vector<float> Lanes(Count);
+        FP(Lanes.data());
+        std::copy(Lanes.begin(), Lanes.end(), Values.begin());
+    } else {
+        FP(Values.data());
+    }
+    ResetRuntimeArena();
+    if (auto Err = RT->remove())
+        llvm::errs() << "Error removing module: " << Err << "\n";
+
+    GlobalAST->codegen(Values);
+    if (DriverEcho == EchoLevel::IR)
+        fprintf(stderr, "Read global %s (%u values)\n", GlobalAST->getName().c_str(), Count);
+    PrintModule();
+    auto GlobalTSM = TakeModule();
+    if (auto Err = TheJIT->addModule(std::move(GlobalTSM))) {
+        llvm::errs() << "Error adding module to JIT: " << Err;
+        return;
+    }
+    InitializeModule();
+    LastItemOk = true;
+}
+
+static void PrintValue(ResultKind Kind, const double *Lanes) {
+    if (Kind == ResultKind::Complex)
+        fprintf(stderr, "%f%+fi", Lanes[0], Lanes[1]);
+    else
+        fprintf(stderr, "%f", Lanes[0]);
+}
+
+/// Print the lanes written by the last top-level expression, see StoreTopLevelResult().
+static void PrintTopLevelResult(const std::vector<double> &Lanes) {
+    LastEvaluationOk = true;
+    LastItemOk = true;
+    LastEvaluatedValue = Lanes[0];
+    if (DriverEcho == EchoLevel::None)
+        return;
+    fprintf(stderr, "Evaluated to ");
+    if (LastTopLevelResult.Kind != ResultKind::Tuple) {
+        PrintValue(LastTopLevelResult.Kind, Lanes.data());
+        fprintf(stderr, "\n");
+        return;
+    }
+    unsigned Lane = 0;
+    fprintf(stderr, "(");
+    for (size_t i = 0; i < LastTopLevelResult.Elements.size(); ++i) {
+        ResultKind Kind = LastTopLevelResult.Elements[i];
+        if (i)
+            fprintf(stderr, ", ");
+        PrintValue(Kind, Lanes.data() + Lane);
+        Lane += Kind == ResultKind::Complex ? 2 : 1;
+    }
+    fprintf(stderr, ")\n");
+}
+
+/// The fast paths for top-level expressions: constant folding, then the bytecode
+/// interpreter. False if the expression has to be JIT-compiled.
+static bool EvaluateWithoutJIT(ExprAST *E, double &Value) {
+    if (TopLevelBackend != Backend::Auto || NumPrecision != Precision::F64)
+        return false;
+    return EvaluateConstant(E, Value) || EvaluateWithBytecode(E, Value);
+}
+
+void HandleTopLevelExpression() {
+    LastPhaseTimes = PhaseTimes();
+    LastItemOk = false;
+    LastEvaluationOk = false;
+    // Evaluate a top-level expression into an anonymous function.
+    TimePoint Start = Now();
+    auto FnAST = ParseTopLevelExpr();
+    LastPhaseTimes.Parse = SecondsSince(Start);
+    if (FnAST) {
+        // Fold or interpret it when possible, skipping LLVM altogether.
+        double Value;
+        Start = Now();
+        if (EvaluateWithoutJIT(FnAST->getBody(), Value)) {
+            LastTopLevelResult = TopLevelResult();
+            ResetRuntimeArena();
+            LastPhaseTimes.Execute = SecondsSince(Start);
+            PrintTopLevelResult({Value});
+            return;
+        }
+
+        auto *FnIR = TimeCodegen([&] { return FnAST->codegen(); });
+        if (FnIR) {
+            if (DriverEcho == EchoLevel::IR) {
+                fprintf(stderr, "Read top-level expression:");
+                fprintf(stderr, "\n");
+            }
+            TimeFinalizeModule();
+            PrintModule();
+
+            Start = Now();
+            auto RT = TheJIT->getMainJITDylib().createResourceTracker();
+            auto TSM = TakeModule();
+
+            // Try to add module, capture error and print it (don't ExitOnErr)
+            if (auto Err = TheJIT->addModule(std::move(TSM), RT)) {
+                llvm::errs() << "Error adding module to JIT: " << Err;
+                return;
+            }
+            if (DriverEcho == EchoLevel::IR)
+                llvm::errs() << "Module added to JIT.\n";
+
+            InitializeModule();
+            LastPhaseTimes.JITAdd = SecondsSince(Start);
+
+            Start = Now();
+            auto ExprSymbolExpected = TheJIT->lookup("__anon_expr");
+            if (!ExprSymbolExpected) {
+                llvm::errs() << "JIT Lookup Error: " << ExprSymbolExpected.takeError() << "\n";
+                return; // Return to MainLoop
+            }
+            LastPhaseTimes.Lookup = SecondsSince(Start);
+
+            // Get the symbol's address and cast it to the right type (takes a pointer to the result lanes, see
+            // StoreTopLevelResult()) so we can call it as a native function.
+            auto ExprSymbol = std::move(*ExprSymbolExpected);
+            void (*FP)(void *) = ExprSymbol.getAddress().toPtr<void (*)(void *)>();
+            std::vector<double> Result(LastTopLevelResult.Lanes);
+            Start = Now();
+            if (NumPrecision == Precision::F32) {
+                std::vector<float> Lanes(Result.size());
+                FP(Lanes.data());
+                std::copy(Lanes.begin(), Lanes.end(), Result.begin());
+            } else {
+                FP(Result.data());
+            }
+            ResetRuntimeArena();
+            LastPhaseTimes.Execute = SecondsSince(Start);
+            PrintTopLevelResult(Result);
+
+            // Delete the anonymous expression module from the JIT.
+            Start = Now();
+            if (auto Err = RT->remove()) {
+                llvm::errs() << "Error removing module: " << Err << "\n";
+                // We can continue even if removal fails
+            }
+            LastPhaseTimes.Remove = SecondsSince(Start);
+        } else {
+            llvm::errs() << "DEBUG---Codegen of top-level expression failed --- \n";
+        }
+    } else {
+        llvm::errs() << "DEBUG---Parsing top-level expression failed --- CurTok: " << CurTok << "\n";
+        // Skip token for error recovery.
+        getNextToken();
+    }
+}
+
+/// top ::= definition | external | structdecl | globaldecl | expression | ';'
+void HandleTopLevelItem() {
+    switch (CurTok) {
+        case ';': // ignore top-level semicolons.
+            LastItemOk = true;
+            getNextToken();
+            break;
+        case tok_def:
+        case tok_gen:
+            HandleDefinition();
+            break;
+        case tok_extern:
+            HandleExtern();
+            break;
+        case tok_struct:
+            HandleStruct();
+            break;
+        case tok_global:
+        case tok_const:
+            HandleGlobal();
+            break;
+        default:
+            HandleTopLevelExpression();
+            break;
+    }
+}
+
+/// putchard - putchar that takes a double and returns 0.
+extern "C" DLLEXPORT double putchard(double X) {
+  fputc((char)X, stderr);
+  return 0;
+}
+
+/// printd - printf that takes a double prints it as "%f\n", returning 0.
+extern "C" DLLEXPORT double printd(double X) {
+  fprintf(stderr, "%f\n", X);
+  return 0;
+}
+
+/// Single-precision variants, bound to 'extern putchard'/'extern printd' in f32 mode.
+extern "C" DLLEXPORT float putchardf(float X) {
+  fputc((char)X, stderr);
+  return 0;
+}
+
+extern "C" DLLEXPORT float printdf(float X) {
+  fprintf(stderr, "%f\n", X);
+  return 0;
+}
+
+bool InitializeDriver() {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    // 1 is lowest precedence.
+    BinopPrecedence['='] = 2;
+    BinopPrecedence['<'] = 10;
+    BinopPrecedence['+'] = 20;
+    BinopPrecedence['-'] = 20;
+    BinopPrecedence['*'] = 40; // highest.
+    BinopPrecedence['/'] = 40;
+
+    auto JITOrErr = llvm::orc::KaleidoscopeJIT::Create();
+    if (!JITOrErr) {
+        llvm::errs() << "Failed to create JIT: ";
+        llvm::errs() << JITOrErr.takeError();
+        llvm::errs() << "\n";
+        return false;
+    }
+
+    // On success, move the created JIT out:
+    TheJIT = std::move(*JITOrErr);
+
+    // Make the module, which holds all the code.
+    InitializeModule();
+    return true;
+}
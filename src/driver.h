@@ -0,0 +1,41 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+// The handling of top-level items shared by the REPL (main.cpp) and the benchmarks
+// (bench/): each handler starts at CurTok, parses one item, compiles it and adds it to
+// the JIT, and for an expression runs it and prints the result.
+
+// What the handlers print besides errors (--echo=ir|results|none).
+enum class EchoLevel { IR, Results, None };
+extern EchoLevel DriverEcho;
+
+// Wall time of the phases of the last item handled, in seconds; 0 for the phases it
+// did not go through. Codegen excludes TheFPM, which is part of Optimize together with
+// FinalizeModule(). JITAdd includes opening the next module. The JIT compiles lazily,
+// so the machine code of a module is emitted and linked by the first lookup that needs
+// it. An expression folded or interpreted without the JIT only has Parse and Execute.
+struct PhaseTimes {
+    double Parse = 0, Codegen = 0, Optimize = 0, JITAdd = 0, Lookup = 0, Execute = 0, Remove = 0;
+};
+extern PhaseTimes LastPhaseTimes;
+
+// The result of the last top-level expression, as printed, and whether it succeeded.
+extern bool LastEvaluationOk;
+extern double LastEvaluatedValue; // first lane
+// Whether the last item handled was parsed, compiled and, for an expression, evaluated
+// without an error.
+extern bool LastItemOk;
+
+// Set up the native target, the operator precedences, the JIT and the first module.
+// False if the JIT cannot be created.
+bool InitializeDriver();
+
+void HandleDefinition();
+void HandleExtern();
+void HandleStruct();
+void HandleGlobal();
+void HandleTopLevelExpression();
+// One item of any kind, or a ';'. CurTok must not be tok_eof.
+void HandleTopLevelItem();
+
+#endif // DRIVER_H
@@ -0,0 +1,223 @@
+#include "fastmath.h"
+#include "codegen.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Type.h"
+#include <vector>
+
+ApproxTier DefaultApproxTier = ApproxTier::Fast;
+
+bool IsApproxBuiltin(const std::string &Name) {
+    return Name == "fexp" || Name == "flog" || Name == "fsin" || Name == "fcos" || Name == "rsqrt";
+}
+
+bool ParseApproxTier(const std::string &Name, ApproxTier &Tier) {
+    if (Name == "precise")
+        Tier = ApproxTier::Precise;
+    else if (Name == "fast")
+        Tier = ApproxTier::Fast;
+    else if (Name == "coarse")
+        Tier = ApproxTier::Coarse;
+    else
+        return false;
+    return true;
+}
+
+ApproxTier ApproxTierForBits(double Bits) {
+    if (Bits > 24)
+        return ApproxTier::Precise;
+    if (Bits > 12)
+        return ApproxTier::Fast;
+    return ApproxTier::Coarse;
+}
+
+//===----------------------------------------------------------------------===//
+// IR helpers
+//===----------------------------------------------------------------------===//
+
+// Bit layout of the IEEE type being approximated (float or double).
+struct FPLayout {
+    unsigned Width;
+    unsigned MantissaBits;
+    int Bias;
+};
+
+static FPLayout LayoutOf(llvm::Type *Ty) {
+    if (Ty->isFloatTy())
+        return {32, 23, 127};
+    return {64, 52, 1023};
+}
+
+static llvm::Value *FP(llvm::Type *Ty, double V) {
+    return llvm::ConstantFP::get(Ty, V);
+}
+
+static llvm::Value *FMulAdd(llvm::Value *A, llvm::Value *B, llvm::Value *C) {
+    return Builder->CreateIntrinsic(llvm::Intrinsic::fmuladd, {A->getType()}, {A, B, C});
+}
+
+/// Horner evaluation of Coeffs[0] + X*Coeffs[1] + X^2*Coeffs[2] + ...
+static llvm::Value *Poly(llvm::Value *X, const std::vector<double> &Coeffs) {
+    llvm::Type *Ty = X->getType();
+    llvm::Value *Acc = FP(Ty, Coeffs.back());
+    for (size_t i = Coeffs.size() - 1; i-- > 0;)
+        Acc = FMulAdd(Acc, X, FP(Ty, Coeffs[i]));
+    return Acc;
+}
+
+/// Round to the nearest integer (as FP) without SSE4.1 or a libcall: adding and
+/// subtracting 1.5 * 2^mantissa pushes the fraction bits out of the mantissa.
+static llvm::Value *RoundNearest(llvm::Value *X) {
+    llvm::Type *Ty = X->getType();
+    llvm::Value *Shifter = FP(Ty, 1.5 * double(1ULL << LayoutOf(Ty).MantissaBits));
+    return Builder->CreateFSub(Builder->CreateFAdd(X, Shifter), Shifter, "round");
+}
+
+static llvm::Value *Clamp(llvm::Value *X, double Lo, double Hi) {
+    llvm::Type *Ty = X->getType();
+    X = Builder->CreateSelect(Builder->CreateFCmpOLT(X, FP(Ty, Lo)), FP(Ty, Lo), X);
+    return Builder->CreateSelect(Builder->CreateFCmpOGT(X, FP(Ty, Hi)), FP(Ty, Hi), X, "clamped");
+}
+
+//===----------------------------------------------------------------------===//
+// Approximations
+//===----------------------------------------------------------------------===//
+
+/// exp(x) = 2^k * exp(r), k = round(x / ln2), r = x - k*ln2 in [-ln2/2, ln2/2].
+/// exp(r) is a Taylor polynomial; 2^k is built directly in the exponent bits.
+static llvm::Value *EmitExp(llvm::Value *X, ApproxTier Tier) {
+    llvm::Type *Ty = X->getType();
+    FPLayout L = LayoutOf(Ty);
+    llvm::Type *IntTy = Builder->getIntNTy(L.Width);
+
+    // Keep 2^k a normal number.
+    X = Ty->isFloatTy() ? Clamp(X, -87.0, 88.0) : Clamp(X, -708.0, 709.0);
+
+    llvm::Value *K = RoundNearest(Builder->CreateFMul(X, FP(Ty, 1.4426950408889634)));
+    // Cody-Waite: ln2 split in a high part with trailing zero bits and a low correction.
+    llvm::Value *R = FMulAdd(K, FP(Ty, -0.693145751953125), X);
+    R = FMulAdd(K, FP(Ty, -1.4286068203094172321e-6), R);
+
+    std::vector<double> Coeffs = {1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24};
+    if (Tier == ApproxTier::Fast) {
+        Coeffs.push_back(1.0 / 120);
+        Coeffs.push_back(1.0 / 720);
+        Coeffs.push_back(1.0 / 5040);
+    }
+    llvm::Value *P = Poly(R, Coeffs);
+
+    llvm::Value *KI = Builder->CreateFPToSI(K, IntTy);
+    llvm::Value *ExpBits = Builder->CreateShl(Builder->CreateAdd(KI, llvm::ConstantInt::get(IntTy, L.Bias)),
+                                              L.MantissaBits);
+    llvm::Value *Scale = Builder->CreateBitCast(ExpBits, Ty);
+    return Builder->CreateFMul(P, Scale, "fexp");
+}
+
+/// log(x) = e*ln2 + log(m), x = m * 2^e with m in [sqrt(1/2), sqrt(2)).
+/// log(m) = 2*atanh(s), s = (m-1)/(m+1), as an odd series in s. Domain: x > 0.
+static llvm::Value *EmitLog(llvm::Value *X, ApproxTier Tier) {
+    llvm::Type *Ty = X->getType();
+    FPLayout L = LayoutOf(Ty);
+    llvm::Type *IntTy = Builder->getIntNTy(L.Width);
+
+    llvm::Value *Bits = Builder->CreateBitCast(X, IntTy);
+    llvm::Value *E = Builder->CreateSub(Builder->CreateAShr(Bits, L.MantissaBits),
+                                        llvm::ConstantInt::get(IntTy, L.Bias));
+    uint64_t MantMask = (1ULL << L.MantissaBits) - 1;
+    llvm::Value *MBits = Builder->CreateOr(Builder->CreateAnd(Bits, llvm::ConstantInt::get(IntTy, MantMask)),
+                                           llvm::ConstantInt::get(IntTy, uint64_t(L.Bias) << L.MantissaBits));
+    llvm::Value *M = Builder->CreateBitCast(MBits, Ty); // [1, 2)
+
+    llvm::Value *Big = Builder->CreateFCmpOGT(M, FP(Ty, 1.4142135623730951));
+    M = Builder->CreateSelect(Big, Builder->CreateFMul(M, FP(Ty, 0.5)), M);
+    llvm::Value *EF = Builder->CreateSIToFP(E, Ty);
+    EF = Builder->CreateSelect(Big, Builder->CreateFAdd(EF, FP(Ty, 1.0)), EF);
+
+    llvm::Value *S = Builder->CreateFDiv(Builder->CreateFSub(M, FP(Ty, 1.0)), Builder->CreateFAdd(M, FP(Ty, 1.0)));
+    llvm::Value *S2 = Builder->CreateFMul(S, S);
+    std::vector<double> Coeffs = {2.0, 2.0 / 3};
+    if (Tier == ApproxTier::Fast) {
+        Coeffs.push_back(2.0 / 5);
+        Coeffs.push_back(2.0 / 7);
+    }
+    llvm::Value *LogM = Builder->CreateFMul(S, Poly(S2, Coeffs));
+    llvm::Value *Result = FMulAdd(EF, FP(Ty, 0.6931471805599453), LogM);
+
+    llvm::Value *InDomain = Builder->CreateFCmpOGT(X, FP(Ty, 0.0));
+    return Builder->CreateSelect(InDomain, Result, llvm::ConstantFP::getNaN(Ty), "flog");
+}
+
+/// sin(x): reduce to r in [-pi, pi] by multiples of 2pi, fold into [-pi/2, pi/2]
+/// with sin(pi - r) = sin(r), then an odd Taylor polynomial.
+static llvm::Value *EmitSin(llvm::Value *X, ApproxTier Tier) {
+    llvm::Type *Ty = X->getType();
+    const double Pi = 3.141592653589793;
+
+    llvm::Value *K = RoundNearest(Builder->CreateFMul(X, FP(Ty, 0.15915494309189535)));
+    llvm::Value *R = FMulAdd(K, FP(Ty, -6.28125), X);
+    R = FMulAdd(K, FP(Ty, -1.9353071795864769e-3), R);
+
+    R = Builder->CreateSelect(Builder->CreateFCmpOGT(R, FP(Ty, Pi / 2)), Builder->CreateFSub(FP(Ty, Pi), R), R);
+    R = Builder->CreateSelect(Builder->CreateFCmpOLT(R, FP(Ty, -Pi / 2)), Builder->CreateFSub(FP(Ty, -Pi), R), R);
+
+    llvm::Value *R2 = Builder->CreateFMul(R, R);
+    std::vector<double> Coeffs = {1.0, -1.0 / 6, 1.0 / 120, -1.0 / 5040};
+    if (Tier == ApproxTier::Fast) {
+        Coeffs.push_back(1.0 / 362880);
+        Coeffs.push_back(-1.0 / 39916800);
+    }
+    return Builder->CreateFMul(R, Poly(R2, Coeffs), "fsin");
+}
+
+/// 1/sqrt(x): the classic magic-constant initial guess refined by Newton steps,
+/// each of which roughly doubles the number of correct bits.
+static llvm::Value *EmitRsqrt(llvm::Value *X, ApproxTier Tier) {
+    llvm::Type *Ty = X->getType();
+    FPLayout L = LayoutOf(Ty);
+    llvm::Type *IntTy = Builder->getIntNTy(L.Width);
+    uint64_t Magic = Ty->isFloatTy() ? 0x5f3759dfULL : 0x5fe6eb50c7b537a9ULL;
+
+    llvm::Value *Bits = Builder->CreateBitCast(X, IntTy);
+    llvm::Value *Y = Builder->CreateBitCast(
+        Builder->CreateSub(llvm::ConstantInt::get(IntTy, Magic), Builder->CreateLShr(Bits, 1)), Ty);
+
+    llvm::Value *HalfX = Builder->CreateFMul(X, FP(Ty, 0.5));
+    unsigned Steps = Tier == ApproxTier::Fast ? 3 : 2;
+    for (unsigned i = 0; i < Steps; ++i) {
+        // y = y * (1.5 - 0.5*x*y*y)
+        llvm::Value *YY = Builder->CreateFMul(Y, Y);
+        Y = Builder->CreateFMul(Y, FMulAdd(Builder->CreateFNeg(HalfX), YY, FP(Ty, 1.5)));
+    }
+    return Y;
+}
+
+llvm::Value *EmitApproxBuiltin(const std::string &Name, llvm::Value *X, ApproxTier Tier) {
+    llvm::Type *Ty = X->getType();
+
+    if (Tier == ApproxTier::Precise) {
+        if (Name == "fexp")
+            return Builder->CreateUnaryIntrinsic(llvm::Intrinsic::exp, X, nullptr, "fexp");
+        if (Name == "flog")
+            return Builder->CreateUnaryIntrinsic(llvm::Intrinsic::log, X, nullptr, "flog");
+        if (Name == "fsin")
+            return Builder->CreateUnaryIntrinsic(llvm::Intrinsic::sin, X, nullptr, "fsin");
+        if (Name == "fcos")
+            return Builder->CreateUnaryIntrinsic(llvm::Intrinsic::cos, X, nullptr, "fcos");
+        if (Name == "rsqrt")
+            return Builder->CreateFDiv(FP(Ty, 1.0), Builder->CreateUnaryIntrinsic(llvm::Intrinsic::sqrt, X),
+                                       "rsqrt");
+        return nullptr;
+    }
+
+    if (Name == "fexp")
+        return EmitExp(X, Tier);
+    if (Name == "flog")
+        return EmitLog(X, Tier);
+    if (Name == "fsin")
+        return EmitSin(X, Tier);
+    if (Name == "fcos")
+        return EmitSin(Builder->CreateFAdd(X, FP(Ty, 1.5707963267948966)), Tier);
+    if (Name == "rsqrt")
+        return EmitRsqrt(X, Tier);
+    return nullptr;
+}
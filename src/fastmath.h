@@ -0,0 +1,30 @@
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+#include "llvm/IR/Value.h"
+#include <string>
+
+// Approximate math builtins (fexp, flog, fsin, fcos, rsqrt), emitted inline as
+// polynomial and bit-trick sequences so they vectorize and never become calls.
+
+/// Precision tiers, from most to least accurate.
+///   Precise - LLVM intrinsics / libm, within ~1 ulp
+///   Fast    - about 24 correct bits (float-level accuracy)
+///   Coarse  - about 12 correct bits
+enum class ApproxTier { Precise, Fast, Coarse };
+
+// Tier used when a call does not ask for one, set with --approx=<tier>.
+extern ApproxTier DefaultApproxTier;
+
+bool IsApproxBuiltin(const std::string &Name);
+
+// Parse "precise", "fast" or "coarse".
+bool ParseApproxTier(const std::string &Name, ApproxTier &Tier);
+
+// Per-call tier from the requested number of correct bits, e.g. fexp(x, 12).
+ApproxTier ApproxTierForBits(double Bits);
+
+// Emit Name(X) inline at the current insertion point.
+llvm::Value *EmitApproxBuiltin(const std::string &Name, llvm::Value *X, ApproxTier Tier);
+
+#endif // FASTMATH_H
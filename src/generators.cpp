@@ -0,0 +1,127 @@
+#include "generators.h"
+#include "codegen.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Intrinsics.h"
+
+// Forward declaration, see ast.cpp
+llvm::AllocaInst *CreateEntryBlockAlloca(llvm::Function *TheFunction, llvm::StringRef VarName, llvm::Type *Ty);
+
+GeneratorState *CurGenerator = nullptr;
+
+// Alignment of the promise, the frame and llvm.coro.promise have to agree on it.
+static const unsigned PromiseAlign = 8;
+
+static llvm::Function *getCoroIntrinsic(llvm::Intrinsic::ID ID, llvm::ArrayRef<llvm::Type*> Tys = {}) {
+#if LLVM_VERSION_MAJOR >= 20
+    return llvm::Intrinsic::getOrInsertDeclaration(TheModule.get(), ID, Tys);
+#else
+    return llvm::Intrinsic::getDeclaration(TheModule.get(), ID, Tys);
+#endif
+}
+
+bool isGeneratorFunction(const std::string &Name) {
+    auto FI = FunctionProtos.find(Name);
+    return FI != FunctionProtos.end() && FI->second->isGenerator();
+}
+
+/// Suspend; the next resume continues in Resume, a destroy in the cleanup.
+static void EmitSuspend(GeneratorState &G, bool Final, llvm::BasicBlock *Resume) {
+    llvm::Value *NoSave = llvm::ConstantTokenNone::get(*TheContext);
+    llvm::Value *Result = Builder->CreateCall(getCoroIntrinsic(llvm::Intrinsic::coro_suspend),
+                                              {NoSave, Builder->getInt1(Final)}, "suspend");
+    llvm::SwitchInst *Switch = Builder->CreateSwitch(Result, G.Suspend, 2);
+    Switch->addCase(Builder->getInt8(0), Resume);
+    Switch->addCase(Builder->getInt8(1), G.Cleanup);
+}
+
+void EmitGeneratorBegin(llvm::Function *F, GeneratorState &G) {
+    llvm::PointerType *PtrTy = llvm::PointerType::getUnqual(*TheContext);
+    llvm::Value *Null = llvm::ConstantPointerNull::get(PtrTy);
+    G.Promise = CreateEntryBlockAlloca(F, "promise", getNumTy());
+    G.Promise->setAlignment(llvm::Align(PromiseAlign));
+    G.Id = Builder->CreateCall(getCoroIntrinsic(llvm::Intrinsic::coro_id),
+                               {Builder->getInt32(0), G.Promise, Null, Null}, "id");
+
+    // The frame is allocated unless CoroElide proved it can live in the caller's frame.
+    llvm::BasicBlock *EntryBB = Builder->GetInsertBlock();
+    llvm::BasicBlock *AllocBB = llvm::BasicBlock::Create(*TheContext, "coro.alloc", F);
+    llvm::BasicBlock *BeginBB = llvm::BasicBlock::Create(*TheContext, "coro.begin", F);
+    llvm::Value *NeedAlloc = Builder->CreateCall(getCoroIntrinsic(llvm::Intrinsic::coro_alloc), {G.Id}, "need.alloc");
+    Builder->CreateCondBr(NeedAlloc, AllocBB, BeginBB);
+
+    Builder->SetInsertPoint(AllocBB);
+    llvm::Value *Size = Builder->CreateCall(getCoroIntrinsic(llvm::Intrinsic::coro_size, {Builder->getInt64Ty()}),
+                                            {}, "size");
+    llvm::FunctionCallee Malloc = TheModule->getOrInsertFunction("malloc", PtrTy, Builder->getInt64Ty());
+    llvm::Value *Mem = Builder->CreateCall(Malloc, {Size}, "alloc");
+    Builder->CreateBr(BeginBB);
+
+    Builder->SetInsertPoint(BeginBB);
+    llvm::PHINode *Frame = Builder->CreatePHI(PtrTy, 2, "frame");
+    Frame->addIncoming(Null, EntryBB);
+    Frame->addIncoming(Mem, AllocBB);
+    G.Handle = Builder->CreateCall(getCoroIntrinsic(llvm::Intrinsic::coro_begin), {G.Id, Frame}, "hdl");
+
+    // Moved after the body by EmitGeneratorEnd().
+    G.Cleanup = llvm::BasicBlock::Create(*TheContext, "coro.cleanup", F);
+    G.Suspend = llvm::BasicBlock::Create(*TheContext, "coro.suspend", F);
+
+    // The call only sets the generator up, the first resume runs the body.
+    llvm::BasicBlock *BodyBB = llvm::BasicBlock::Create(*TheContext, "body", F);
+    EmitSuspend(G, /*Final*/ false, BodyBB);
+    Builder->SetInsertPoint(BodyBB);
+}
+
+void EmitYield(llvm::Value *V) {
+    GeneratorState &G = *CurGenerator;
+    Builder->CreateStore(V, G.Promise);
+    llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    llvm::BasicBlock *ResumeBB = llvm::BasicBlock::Create(*TheContext, "resume", TheFunction);
+    EmitSuspend(G, /*Final*/ false, ResumeBB);
+    Builder->SetInsertPoint(ResumeBB);
+}
+
+void EmitGeneratorEnd(GeneratorState &G) {
+    llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    llvm::Type *PtrTy = llvm::PointerType::getUnqual(*TheContext);
+
+    // A generator that is done must not be resumed, only destroyed.
+    llvm::BasicBlock *DoneBB = llvm::BasicBlock::Create(*TheContext, "resumed.done", TheFunction);
+    EmitSuspend(G, /*Final*/ true, DoneBB);
+    Builder->SetInsertPoint(DoneBB);
+    Builder->CreateUnreachable();
+
+    G.Cleanup->moveAfter(&TheFunction->back());
+    Builder->SetInsertPoint(G.Cleanup);
+    llvm::Value *Mem = Builder->CreateCall(getCoroIntrinsic(llvm::Intrinsic::coro_free), {G.Id, G.Handle}, "mem");
+    llvm::BasicBlock *FreeBB = llvm::BasicBlock::Create(*TheContext, "coro.free", TheFunction);
+    Builder->CreateCondBr(Builder->CreateIsNotNull(Mem), FreeBB, G.Suspend);
+    Builder->SetInsertPoint(FreeBB);
+    llvm::FunctionCallee Free = TheModule->getOrInsertFunction("free", Builder->getVoidTy(), PtrTy);
+    Builder->CreateCall(Free, {Mem});
+    Builder->CreateBr(G.Suspend);
+
+    G.Suspend->moveAfter(&TheFunction->back());
+    Builder->SetInsertPoint(G.Suspend);
+    // No funclet bundle to end, so the result token of coro.end is 'none'.
+    Builder->CreateCall(getCoroIntrinsic(llvm::Intrinsic::coro_end),
+                        {G.Handle, Builder->getFalse(), llvm::ConstantTokenNone::get(*TheContext)});
+    Builder->CreateRet(G.Handle);
+}
+
+llvm::Value *EmitGeneratorNext(llvm::Value *Handle) {
+    Builder->CreateCall(getCoroIntrinsic(llvm::Intrinsic::coro_resume), {Handle});
+    return Builder->CreateCall(getCoroIntrinsic(llvm::Intrinsic::coro_done), {Handle}, "done");
+}
+
+llvm::Value *EmitGeneratorValue(llvm::Value *Handle) {
+    llvm::Value *Promise = Builder->CreateCall(getCoroIntrinsic(llvm::Intrinsic::coro_promise),
+                                               {Handle, Builder->getInt32(PromiseAlign), Builder->getFalse()},
+                                               "promise");
+    return Builder->CreateLoad(getNumTy(), Promise, "yielded");
+}
+
+void EmitGeneratorDestroy(llvm::Value *Handle) {
+    Builder->CreateCall(getCoroIntrinsic(llvm::Intrinsic::coro_destroy), {Handle});
+}
@@ -0,0 +1,58 @@
+#ifndef GENERATORS_H
+#define GENERATORS_H
+
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Value.h"
+#include <string>
+
+// Generators: "gen range(n) for i = 0, i < n in yield i", and the loop consuming one,
+// "for x in range(10) in printd(x)".
+//
+// A generator is a switched-resume LLVM coroutine (llvm.coro.*). Calling it allocates
+// the coroutine frame, runs up to an initial suspend and returns the coroutine handle;
+// the first resume starts the body. A yield stores the value in the promise, a number
+// in the frame, and suspends. The for-in loop resumes the handle and stops once the
+// generator is done (suspended after the end of its body), else it reads the promise
+// and runs its body. Afterwards it destroys the handle, which frees the frame.
+//
+// FinalizeModule() runs the coroutine passes. CoroSplit cuts every generator into the
+// ramp, a resume and a destroy function. Generators are kept as ASTs, like functions
+// taking function values, and emitted as an alwaysinline clone into every module that
+// calls them (see closures.h). Once the ramp is inlined into the loop, CoroElide sees
+// the whole lifetime of the frame: it moves the frame from the heap to the stack and
+// turns the resumes into direct calls, which are inlined too, leaving one fused loop.
+
+// The coroutine of the generator whose body is being emitted.
+struct GeneratorState {
+    llvm::Value *Id = nullptr;           // token of llvm.coro.id
+    llvm::Value *Handle = nullptr;       // result of llvm.coro.begin
+    llvm::AllocaInst *Promise = nullptr; // the last yielded value
+    llvm::BasicBlock *Cleanup = nullptr; // frees the frame when the handle is destroyed
+    llvm::BasicBlock *Suspend = nullptr; // returns to whoever resumed the generator
+};
+// Null outside of generators, lambdas in the body of a generator included.
+extern GeneratorState *CurGenerator;
+
+// Whether the function Name was defined by "gen", from its prototype. Its result, the
+// handle, is a pointer, but so are the results of runtime functions such as
+// kaleido_arena_mark(), which calls can find in the module as well.
+bool isGeneratorFunction(const std::string &Name);
+
+// The start of generator F once its arguments are stored: allocate the frame, then
+// suspend. Leaves the builder at the start of the body.
+void EmitGeneratorBegin(llvm::Function *F, GeneratorState &G);
+// "yield V" in the body of CurGenerator, V is a number.
+void EmitYield(llvm::Value *V);
+// The final suspend after the body, the cleanup on destroy and the return of the handle.
+void EmitGeneratorEnd(GeneratorState &G);
+
+// The for-in side, on the handle returned by a call of a generator.
+// Resume the generator, an i1 that is true once it is done.
+llvm::Value *EmitGeneratorNext(llvm::Value *Handle);
+// The value of the last yield.
+llvm::Value *EmitGeneratorValue(llvm::Value *Handle);
+void EmitGeneratorDestroy(llvm::Value *Handle);
+
+#endif // GENERATORS_H
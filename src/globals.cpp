@@ -0,0 +1,68 @@
+#include "globals.h"
+#include "codegen.h"
+#include "records.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+
+std::map<std::string, GlobalInfo> GlobalVars;
+
+static llvm::Type *getGlobalTy(const GlobalInfo &Info) {
+    if (Info.IsTable)
+        return llvm::ArrayType::get(getNumTy(), Info.Values.size());
+    return getNumTy();
+}
+
+static llvm::Constant *getInitializer(const GlobalInfo &Info) {
+    if (!Info.IsTable)
+        return llvm::ConstantFP::get(getNumTy(), Info.Values[0]);
+    std::vector<llvm::Constant*> Elems;
+    for (double V : Info.Values)
+        Elems.push_back(llvm::ConstantFP::get(getNumTy(), V));
+    return llvm::ConstantArray::get(llvm::cast<llvm::ArrayType>(getGlobalTy(Info)), Elems);
+}
+
+llvm::GlobalVariable *getGlobal(const std::string &Name) {
+    if (auto *G = TheModule->getNamedGlobal(Name))
+        return G;
+    auto It = GlobalVars.find(Name);
+    if (It == GlobalVars.end())
+        return nullptr;
+
+    const GlobalInfo &Info = It->second;
+    if (Info.IsConst) {
+        return new llvm::GlobalVariable(*TheModule, getGlobalTy(Info), /*isConstant*/ true,
+                                        llvm::GlobalValue::AvailableExternallyLinkage,
+                                        getInitializer(Info), Name);
+    }
+    return new llvm::GlobalVariable(*TheModule, getGlobalTy(Info), /*isConstant*/ false,
+                                    llvm::GlobalValue::ExternalLinkage, nullptr, Name);
+}
+
+llvm::GlobalVariable *EmitGlobalDefinition(const std::string &Name) {
+    const GlobalInfo &Info = GlobalVars.at(Name);
+    auto *G = new llvm::GlobalVariable(*TheModule, getGlobalTy(Info), Info.IsConst,
+                                       llvm::GlobalValue::ExternalLinkage, getInitializer(Info), Name);
+    if (Info.IsConst)
+        G->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    return G;
+}
+
+llvm::Value *EmitGlobalRef(const std::string &Name) {
+    llvm::GlobalVariable *G = getGlobal(Name);
+    if (!G)
+        return LogErrorV("Unknown variable name");
+    const GlobalInfo &Info = GlobalVars.at(Name);
+    if (!Info.IsTable)
+        return Builder->CreateLoad(getNumTy(), G, Name);
+
+    llvm::StructType *DescTy = getArrayTy(TypeAST(TypeAST::Number).getArrayOf(TypeAST::AoS));
+    llvm::Value *Desc = llvm::PoisonValue::get(DescTy);
+    Desc = Builder->CreateInsertValue(Desc, G, 0);
+    return Builder->CreateInsertValue(Desc, Builder->getInt64(Info.Values.size()), 1, Name);
+}
+
+void CollectMutableGlobals(std::set<std::string> &Names) {
+    for (auto &G : GlobalVars)
+        if (!G.second.IsConst)
+            Names.insert(G.first);
+}
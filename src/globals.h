@@ -0,0 +1,37 @@
+#ifndef GLOBALS_H
+#define GLOBALS_H
+
+#include "ast.h"
+#include "llvm/IR/GlobalVariable.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Module-level variables: "global x = 0;" and "const T = [..];".
+//
+// A global is defined once, in a module of its own that stays in the JIT. Every other
+// module refers to it by symbol: mutable globals are plain external declarations, while
+// constants are declared available_externally together with their values, so loads
+// from them fold at compile time and the rest read the single copy in .rodata.
+
+struct GlobalInfo {
+    bool IsConst = false;
+    bool IsTable = false;       // a table is an array of numbers, a scalar is one number
+    std::vector<double> Values; // initial values (the only values, for a const)
+};
+
+// Every global defined so far, by name. Like FunctionProtos, this outlives modules.
+extern std::map<std::string, GlobalInfo> GlobalVars;
+
+// The global in the current module, declared on first use, or nullptr.
+llvm::GlobalVariable *getGlobal(const std::string &Name);
+// Define Name (already in GlobalVars) in the current module.
+llvm::GlobalVariable *EmitGlobalDefinition(const std::string &Name);
+// Read a global: scalars are loaded, tables become array descriptors (see records.h).
+llvm::Value *EmitGlobalRef(const std::string &Name);
+
+// Names of the globals a call may read or write.
+void CollectMutableGlobals(std::set<std::string> &Names);
+
+#endif // GLOBALS_H
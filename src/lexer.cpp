@@ -5,22 +5,46 @@
 
 // Global variables
 std::string IdentifierStr; // Filled in if tok_identifier
-double NumVal;             // Filled in if tok_number
+double NumVal;             // Filled in if tok_number or tok_imaginary
 int CurTok;
 
-int gettok() {
-    static int LastChar = ' ';
+// Input is read from stdin, or from the string given to SetLexerInput().
+static bool FromString = false;
+static std::string InputText;
+static size_t InputPos = 0;
+static int LastChar = ' ';
+
+static int ReadChar() {
+    if (!FromString)
+        return getchar();
+    return InputPos < InputText.size() ? static_cast<unsigned char>(InputText[InputPos++]) : EOF;
+}
+
+static void UnreadChar(int C) {
+    if (!FromString)
+        ungetc(C, stdin);
+    else if (C != EOF)
+        --InputPos;
+}
 
+void SetLexerInput(const std::string &Text) {
+    FromString = true;
+    InputText = Text;
+    InputPos = 0;
+    LastChar = ' ';
+}
+
+int gettok() {
     // consume white spaces
     while (isspace(LastChar)) {
-        LastChar = getchar(); // getchar() reads one char from the input stream
+        LastChar = ReadChar(); // reads one char from the input stream
     }
 
     // identifier => [a-zA-Z][a-zA-Z0-9]*
     if (isalpha(LastChar)) {
         IdentifierStr = LastChar;
 
-        while (isalnum((LastChar = getchar()))) {
+        while (isalnum((LastChar = ReadChar()))) {
             IdentifierStr += LastChar;
         }
 
@@ -54,24 +78,60 @@ int gettok() {
         if (IdentifierStr == "var"){
             return tok_var;
         }
+        if (IdentifierStr == "struct"){
+            return tok_struct;
+        }
+        if (IdentifierStr == "global"){
+            return tok_global;
+        }
+        if (IdentifierStr == "const"){
+            return tok_const;
+        }
+        if (IdentifierStr == "fn"){
+            return tok_fn;
+        }
+        if (IdentifierStr == "gen"){
+            return tok_gen;
+        }
+        if (IdentifierStr == "yield"){
+            return tok_yield;
+        }
         return tok_identifier;
     }
 
+    // a '.' that is not followed by a digit is field access, as in "p.x"
+    bool StartsFraction = false;
+    if (LastChar == '.') {
+        int NextChar = ReadChar();
+        UnreadChar(NextChar);
+        StartsFraction = isdigit(NextChar);
+    }
+
     // read the number/digit (floating val) as a str, then convert to double
-    if (isdigit(LastChar) || LastChar == '.') {
+    if (isdigit(LastChar) || StartsFraction) {
         std::string NumStr;
         do {
             NumStr += LastChar;
-            LastChar = getchar();
+            LastChar = ReadChar();
         } while (isdigit(LastChar) || LastChar == '.');
         NumVal = strtod(NumStr.c_str(), 0);
+
+        // imaginary literal => number 'i', as long as the 'i' does not start a word ("2in")
+        if (LastChar == 'i') {
+            int NextChar = ReadChar();
+            if (!isalnum(NextChar)) {
+                LastChar = NextChar;
+                return tok_imaginary;
+            }
+            UnreadChar(NextChar);
+        }
         return tok_number;
     }
 
     // handle comments
     if (LastChar == '#') {
         do {
-            LastChar = getchar();
+            LastChar = ReadChar();
         } while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
 
         // skip the comment and look for new token
@@ -86,7 +146,7 @@ int gettok() {
 
     // returns the ASCII
     int ThisChar = LastChar;
-    LastChar = getchar();
+    LastChar = ReadChar();
     return ThisChar;
 }
 
@@ -24,16 +24,34 @@ enum Token {
     tok_unary = -11,
     tok_binary = -12,
 
-    tok_var = -13
+    tok_var = -13,
+
+    // number immediately followed by 'i', e.g. 2.5i
+    tok_imaginary = -14,
+
+    tok_struct = -15,
+
+    // module-level variables
+    tok_global = -16,
+    tok_const = -17,
+
+    // function values
+    tok_fn = -18,
+
+    // generators
+    tok_gen = -19,
+    tok_yield = -20
 };
 
 // Global variables for lexer
 extern std::string IdentifierStr; // Filled in if tok_identifier
-extern double NumVal;             // Filled in if tok_number
+extern double NumVal;             // Filled in if tok_number or tok_imaginary
 extern int CurTok;
 
 // Lexer functions
 int gettok();
 int getNextToken();
+// Read the tokens from Text instead of stdin, from its start (used by bench/).
+void SetLexerInput(const std::string &Text);
 
 #endif // LEXER_H
\ No newline at end of file
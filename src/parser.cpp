@@ -2,6 +2,7 @@
 #include "lexer.h"
 #include <cstdio>
 #include <iostream>
+#include <algorithm>
 #include <cctype>
 
 std::unique_ptr<ExprAST> LogError(const char* Str) {
@@ -21,7 +22,15 @@ std::unique_ptr<ExprAST> ParseNumberExpr() {
     return std::move(Result); // change ownership of this pointer to the function calling it
 }
 
+/// imaginaryexpr ::= number 'i'
+std::unique_ptr<ExprAST> ParseImaginaryExpr() {
+    auto Result = std::make_unique<ImaginaryExprAST>(NumVal);
+    getNextToken();
+    return std::move(Result);
+}
+
 /// parenexpr ::= '(' expression ')'
+/// tupleexpr ::= '(' expression (',' expression)+ ')'
 std::unique_ptr<ExprAST> ParseParenExpr() {
     getNextToken(); // consume '('
     auto V = ParseExpression();
@@ -29,6 +38,19 @@ std::unique_ptr<ExprAST> ParseParenExpr() {
         return nullptr;
     }
 
+    if (CurTok == ',') {
+        std::vector<std::unique_ptr<ExprAST>> Elems;
+        Elems.push_back(std::move(V));
+        while (CurTok == ',') {
+            getNextToken(); // consume ','
+            auto Elem = ParseExpression();
+            if (!Elem)
+                return nullptr;
+            Elems.push_back(std::move(Elem));
+        }
+        V = std::make_unique<TupleExprAST>(std::move(Elems));
+    }
+
     if (CurTok != ')') {
         return LogError("expected ')' ");
     }
@@ -75,15 +97,21 @@ std::unique_ptr<ExprAST> ParseIdentifierOrCallExpr() {
 /// primary (for unary operators)
 ///   ::= identifierexpr
 ///   ::= numberexpr
+///   ::= imaginaryexpr
 ///   ::= parenexpr
+///   ::= tupleexpr
 ///   ::= ifexpr
 ///   ::= forexpr
+///   ::= lambdaexpr
+///   ::= yieldexpr
 std::unique_ptr<ExprAST> ParsePrimary() {
     switch (CurTok) {
         case tok_identifier:
             return ParseIdentifierOrCallExpr();
         case tok_number:
             return ParseNumberExpr();
+        case tok_imaginary:
+            return ParseImaginaryExpr();
         case '(':
             return ParseParenExpr();
         case tok_if:
@@ -92,6 +120,10 @@ std::unique_ptr<ExprAST> ParsePrimary() {
             return ParseForExpr();
         case tok_var:
             return ParseVarExpr();
+        case tok_fn:
+            return ParseLambdaExpr();
+        case tok_yield:
+            return ParseYieldExpr();
         default:
             return LogError("unknown token when expecting an expression");
     }
@@ -110,13 +142,42 @@ int GetTokPrecedence() {
     return TokPrec;
 }
 
-/// unary
+/// postfix
 ///   ::= primary
+///   ::= postfix '[' expression ']'
+///   ::= postfix '.' identifier
+std::unique_ptr<ExprAST> ParsePostfixExpr() {
+    auto E = ParsePrimary();
+    while (E) {
+        if (CurTok == '[') {
+            getNextToken(); // eat '['
+            auto Index = ParseExpression();
+            if (!Index)
+                return nullptr;
+            if (CurTok != ']')
+                return LogError("expected ']' after array index");
+            getNextToken(); // eat ']'
+            E = std::make_unique<IndexExprAST>(std::move(E), std::move(Index));
+        } else if (CurTok == '.') {
+            getNextToken(); // eat '.'
+            if (CurTok != tok_identifier)
+                return LogError("expected field name after '.'");
+            E = std::make_unique<FieldExprAST>(std::move(E), IdentifierStr);
+            getNextToken(); // eat the field name
+        } else {
+            break;
+        }
+    }
+    return E;
+}
+
+/// unary
+///   ::= postfix
 ///   ::= '!' unary -> !!x
 std::unique_ptr<ExprAST> ParseUnary() {
     //base case, if its not an operator anymore, it must be a primary expr
     if (!__isascii(CurTok) || CurTok == '(' || CurTok == ','){
-        return ParsePrimary();
+        return ParsePostfixExpr();
     }
 
     // recursion
@@ -129,20 +190,35 @@ std::unique_ptr<ExprAST> ParseUnary() {
     return nullptr;
 }
 
-/// varexpr ::= 'var' identifier ('=' expression)?
-//                    (',' identifier ('=' expression)?)* 'in' expression
+/// varexpr ::= 'var' identifier (':' vartype)? ('=' expression)?
+//                    (',' identifier (':' vartype)? ('=' expression)?)* 'in' expression
+//            ::= 'var' '(' identifier (',' identifier)+ ')' '=' expression 'in' expression
 std::unique_ptr<ExprAST> ParseVarExpr(){
     getNextToken(); // eat 'var'
 
+    if (CurTok == '(')
+        return ParseDestructuringVar();
+
     if(CurTok != tok_identifier){
         return LogError("expected identifier after 'var' ");
     }
 
     std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames;
+    std::vector<VarTypeAST> VarTypes;
     while (true){
         std::string Name = IdentifierStr;
         getNextToken(); // eat the identifier
 
+        // optional type, with the length for arrays
+        VarTypeAST VarTy;
+        if (CurTok == ':'){
+            getNextToken(); // eat ':'
+            VarTy.Present = true;
+            if (!ParseType(VarTy.Ty, &VarTy.Length))
+                return nullptr;
+        }
+        VarTypes.push_back(std::move(VarTy));
+
         std::unique_ptr<ExprAST> Init;
         // check if it has initial value or not (optional init)
         if (CurTok == '='){
@@ -171,7 +247,72 @@ std::unique_ptr<ExprAST> ParseVarExpr(){
         return nullptr;
     }
     
-    return std::make_unique<VarExprAST>(std::move(VarNames), std::move(Body));
+    return std::make_unique<VarExprAST>(std::move(VarNames), std::move(Body), std::move(VarTypes));
+}
+
+/// var (a, b) = e in body  ==>  var tup. = e in var a = tup.#0, b = tup.#1 in body
+std::unique_ptr<ExprAST> ParseDestructuringVar(){
+    getNextToken(); // eat '('
+    std::vector<std::string> Names;
+    while (CurTok == tok_identifier){
+        Names.push_back(IdentifierStr);
+        getNextToken(); // eat the identifier
+        if (CurTok != ',') break;
+        getNextToken(); // eat ','
+    }
+    if (CurTok != ')')
+        return LogError("expected ')' after the names of a destructuring var");
+    getNextToken(); // eat ')'
+    if (Names.size() < 2)
+        return LogError("a destructuring var needs at least two names");
+
+    if (CurTok != '=')
+        return LogError("expected '=' after the names of a destructuring var");
+    getNextToken(); // eat '='
+    auto Init = ParseExpression();
+    if (!Init) return nullptr;
+
+    if (CurTok != tok_in)
+        return LogError("expected 'in' keyword after 'var'");
+    getNextToken(); // eat 'in'
+    auto Body = ParseExpression();
+    if (!Body) return nullptr;
+
+    // The hidden name contains a '.', so it cannot clash with the user's names.
+    std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> Elems;
+    for (unsigned i = 0; i < Names.size(); ++i)
+        Elems.emplace_back(Names[i], std::make_unique<TupleElementExprAST>(std::make_unique<VariableExprAST>("tup."), i));
+    auto Inner = std::make_unique<VarExprAST>(std::move(Elems), std::move(Body));
+
+    std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> Tuple;
+    Tuple.emplace_back("tup.", std::move(Init));
+    return std::make_unique<VarExprAST>(std::move(Tuple), std::move(Inner));
+}
+
+/// lambdaexpr ::= 'fn' '(' (id (':' type)?)* ')' (':' type)? expression
+std::unique_ptr<ExprAST> ParseLambdaExpr(){
+    getNextToken(); // eat 'fn'
+    std::vector<std::string> ArgNames;
+    std::vector<TypeAST> ArgTypes;
+    TypeAST RetType;
+    if (!ParseParams(ArgNames, ArgTypes, RetType))
+        return nullptr;
+
+    auto Body = ParseExpression();
+    if (!Body)
+        return nullptr;
+    auto Proto = std::make_unique<PrototypeAST>("lambda", std::move(ArgNames), false, 0,
+                                                std::move(ArgTypes), RetType);
+    return std::make_unique<LambdaExprAST>(std::move(Proto), std::move(Body));
+}
+
+/// yieldexpr ::= 'yield' expression
+std::unique_ptr<ExprAST> ParseYieldExpr(){
+    getNextToken(); // eat 'yield'
+    auto Val = ParseExpression();
+    if (!Val)
+        return nullptr;
+    return std::make_unique<YieldExprAST>(std::move(Val));
 }
 
 /// binoprhs
@@ -217,8 +358,271 @@ std::unique_ptr<ExprAST> ParseExpression() {
     return nullptr;
 }
 
+/// type ::= ('double' | 'complex' | identifier) ('[' ']' layout?)?
+///      ::= '(' type (',' type)+ ')'
+///      ::= 'fn' '(' (type (',' type)*)? ')' (':' type)?
+/// vartype ::= ('double' | 'complex' | identifier) ('[' expression? ']' layout?)?
+/// layout ::= 'aos' | 'soa'
+/// Any other identifier names a struct. Only var declarations give an array length.
+bool ParseType(TypeAST &Ty, std::unique_ptr<ExprAST> *Length) {
+    if (CurTok == '(') {
+        getNextToken(); // eat '('
+        std::vector<TypeAST> Elems;
+        while (true) {
+            Elems.emplace_back();
+            if (!ParseType(Elems.back()))
+                return false;
+            if (CurTok != ',')
+                break;
+            getNextToken(); // eat ','
+        }
+        if (CurTok != ')') {
+            LogError("expected ')' in tuple type");
+            return false;
+        }
+        getNextToken(); // eat ')'
+        if (Elems.size() < 2) {
+            LogError("a tuple type needs at least two elements");
+            return false;
+        }
+        Ty = TypeAST::getTuple(std::move(Elems));
+        return true;
+    }
+    if (CurTok == tok_fn) {
+        getNextToken(); // eat 'fn'
+        if (CurTok != '(') {
+            LogError("expected '(' after fn");
+            return false;
+        }
+        getNextToken(); // eat '('
+        std::vector<TypeAST> Params;
+        while (CurTok != ')') {
+            Params.emplace_back();
+            if (!ParseType(Params.back()))
+                return false;
+            if (CurTok == ')')
+                break;
+            if (CurTok != ',') {
+                LogError("expected ',' or ')' in function type");
+                return false;
+            }
+            getNextToken(); // eat ','
+        }
+        getNextToken(); // eat ')'
+        // the result is a number unless annotated
+        TypeAST Result;
+        if (CurTok == ':') {
+            getNextToken(); // eat ':'
+            if (!ParseType(Result))
+                return false;
+        }
+        Ty = TypeAST::getFunction(std::move(Params), Result);
+        return true;
+    }
+    if (CurTok != tok_identifier) {
+        LogError("Expected a type name");
+        return false;
+    }
+    if (IdentifierStr == "double") {
+        Ty = TypeAST(TypeAST::Number);
+    } else if (IdentifierStr == "complex") {
+        Ty = TypeAST(TypeAST::Complex);
+    } else {
+        Ty = TypeAST(TypeAST::Record, IdentifierStr);
+    }
+    getNextToken(); // eat the type name
+
+    if (CurTok != '[')
+        return true;
+    getNextToken(); // eat '['
+    if (Length && CurTok != ']') {
+        *Length = ParseExpression();
+        if (!*Length)
+            return false;
+    }
+    if (CurTok != ']') {
+        LogError("expected ']' in array type");
+        return false;
+    }
+    getNextToken(); // eat ']'
+
+    TypeAST::LayoutTy Layout = TypeAST::AoS;
+    if (CurTok == tok_identifier && (IdentifierStr == "aos" || IdentifierStr == "soa")) {
+        Layout = IdentifierStr == "soa" ? TypeAST::SoA : TypeAST::AoS;
+        getNextToken(); // eat the layout
+    }
+    Ty = Ty.getArrayOf(Layout);
+    return true;
+}
+
+/// structdecl ::= 'struct' identifier '{' identifier (':' type)? (',' identifier (':' type)?)* '}'
+std::unique_ptr<RecordDeclAST> ParseStructDecl() {
+    getNextToken(); // eat 'struct'
+    if (CurTok != tok_identifier) {
+        LogError("Expected struct name");
+        return nullptr;
+    }
+    std::string Name = IdentifierStr;
+    if (Name == "double" || Name == "complex") {
+        LogError("struct name is a builtin type");
+        return nullptr;
+    }
+    getNextToken(); // eat the name
+
+    if (CurTok != '{') {
+        LogError("Expected '{' in struct declaration");
+        return nullptr;
+    }
+    getNextToken(); // eat '{'
+
+    std::vector<std::string> FieldNames;
+    std::vector<TypeAST> FieldTypes;
+    while (CurTok == tok_identifier) {
+        if (std::find(FieldNames.begin(), FieldNames.end(), IdentifierStr) != FieldNames.end()) {
+            LogError("duplicate field name in struct");
+            return nullptr;
+        }
+        FieldNames.push_back(IdentifierStr);
+        FieldTypes.emplace_back();
+        getNextToken(); // eat the field name
+        if (CurTok == ':') {
+            getNextToken(); // eat ':'
+            if (!ParseType(FieldTypes.back()))
+                return nullptr;
+        }
+        if (CurTok != ',')
+            break;
+        getNextToken(); // eat ','
+    }
+    if (CurTok != '}') {
+        LogError("Expected '}' at the end of struct declaration");
+        return nullptr;
+    }
+    getNextToken(); // eat '}'
+    if (FieldNames.empty()) {
+        LogError("a struct needs at least one field");
+        return nullptr;
+    }
+    return std::make_unique<RecordDeclAST>(Name, std::move(FieldNames), std::move(FieldTypes));
+}
+
+/// globaldecl ::= ('global' | 'const') identifier '=' (expression | table)
+/// table
+///   ::= '[' expression (',' expression)* ']'
+///   ::= '[' expression 'for' identifier '=' expression ',' expression ']'
+std::unique_ptr<GlobalDeclAST> ParseGlobalDecl() {
+    bool IsConst = CurTok == tok_const;
+    getNextToken(); // eat 'global' / 'const'
+    if (CurTok != tok_identifier) {
+        LogError("Expected name after 'global' or 'const'");
+        return nullptr;
+    }
+    std::string Name = IdentifierStr;
+    getNextToken(); // eat the name
+    if (CurTok != '=') {
+        LogError("Expected '=' after global name");
+        return nullptr;
+    }
+    getNextToken(); // eat '='
+
+    std::vector<std::unique_ptr<ExprAST>> Elems;
+    if (CurTok != '[') {
+        auto Init = ParseExpression();
+        if (!Init)
+            return nullptr;
+        Elems.push_back(std::move(Init));
+        return std::make_unique<GlobalDeclAST>(Name, IsConst, false, std::move(Elems));
+    }
+
+    getNextToken(); // eat '['
+    auto First = ParseExpression();
+    if (!First)
+        return nullptr;
+    Elems.push_back(std::move(First));
+
+    if (CurTok == tok_for) {
+        getNextToken(); // eat 'for'
+        if (CurTok != tok_identifier) {
+            LogError("expected identifier after 'for'");
+            return nullptr;
+        }
+        std::string GenVar = IdentifierStr;
+        getNextToken(); // eat the identifier
+        if (CurTok != '=') {
+            LogError("expected '=' after for");
+            return nullptr;
+        }
+        getNextToken(); // eat '='
+        auto Start = ParseExpression();
+        if (!Start)
+            return nullptr;
+        if (CurTok != ',') {
+            LogError("expected ',' after for start value");
+            return nullptr;
+        }
+        getNextToken(); // eat ','
+        auto End = ParseExpression();
+        if (!End)
+            return nullptr;
+        if (CurTok != ']') {
+            LogError("expected ']' at the end of the table");
+            return nullptr;
+        }
+        getNextToken(); // eat ']'
+        return std::make_unique<GlobalDeclAST>(Name, IsConst, true, std::move(Elems), GenVar,
+                                               std::move(Start), std::move(End));
+    }
+
+    while (CurTok == ',') {
+        getNextToken(); // eat ','
+        auto Elem = ParseExpression();
+        if (!Elem)
+            return nullptr;
+        Elems.push_back(std::move(Elem));
+    }
+    if (CurTok != ']') {
+        LogError("expected ',' or ']' in table");
+        return nullptr;
+    }
+    getNextToken(); // eat ']'
+    return std::make_unique<GlobalDeclAST>(Name, IsConst, true, std::move(Elems));
+}
+
+/// params ::= '(' (id (':' type)?)* ')' (':' type)?
+/// Shared by prototypes and lambdas, arguments and results are numbers by default.
+bool ParseParams(std::vector<std::string> &ArgNames, std::vector<TypeAST> &ArgTypes, TypeAST &RetType) {
+    if (CurTok != '(') {
+        LogErrorP("Expected '(' in prototype");
+        return false;
+    }
+    getNextToken(); // eat '('
+    while (CurTok == tok_identifier){
+        ArgNames.push_back(IdentifierStr);
+        ArgTypes.emplace_back();
+        getNextToken();
+        // optional type annotation
+        if (CurTok == ':'){
+            getNextToken(); // eat ':'
+            if (!ParseType(ArgTypes.back()))
+                return false;
+        }
+    }
+    if (CurTok != ')') {
+        LogErrorP("Expected ')' in prototype");
+        return false;
+    }
+    getNextToken(); //eat ')'
+
+    if (CurTok == ':'){
+        getNextToken(); // eat ':'
+        if (!ParseType(RetType))
+            return false;
+    }
+    return true;
+}
+
 /// prototype (function signature)
-///   ::= id '(' id* ')'
+///   ::= id '(' (id (':' type)?)* ')' (':' type)?
 ///   ::= binary LETTER number? (id, id)
 ///   ::= unary LETTER (id)
 std::unique_ptr<PrototypeAST> ParsePrototype() {
@@ -267,33 +671,41 @@ std::unique_ptr<PrototypeAST> ParsePrototype() {
             break;
     }
 
-    if (CurTok != '(') {
-        return LogErrorP("Expected '(' in prototype");
-    }
     std::vector<std::string> ArgNames;
-    while (getNextToken() == tok_identifier){
-        ArgNames.push_back(IdentifierStr);
-    }
-    if (CurTok != ')') {
-        return LogErrorP("Expected ')' in prototype");
-    }
-    getNextToken(); //eat ')'
+    std::vector<TypeAST> ArgTypes;
+    TypeAST RetType;
+    if (!ParseParams(ArgNames, ArgTypes, RetType))
+        return nullptr;
 
      // Verify right number of names for operator.
     if (Kind && ArgNames.size() != Kind){
         return LogErrorP("Invalid number of operands for operator");
     }
 
-    return std::make_unique<PrototypeAST>(FnName, std::move(ArgNames), Kind!=0, BinaryPrecedence);
+    return std::make_unique<PrototypeAST>(FnName, std::move(ArgNames), Kind!=0, BinaryPrecedence,
+                                          std::move(ArgTypes), RetType);
 }
 
-/// definition ::= 'def'
+/// definition ::= 'def' prototype expression
+///            ::= 'gen' prototype expression
 std::unique_ptr<FunctionAST> ParseDefinition() {
-    getNextToken(); // eat 'def'
+    bool IsGenerator = CurTok == tok_gen;
+    getNextToken(); // eat 'def' or 'gen'
     auto Proto = ParsePrototype();
     if (!Proto) {
         return nullptr;
     }
+    if (IsGenerator) {
+        if (Proto->isUnaryOp() || Proto->isBinaryOp()) {
+            LogError("operators cannot be generators");
+            return nullptr;
+        }
+        if (!Proto->getReturnType().isNumber()) {
+            LogError("generators yield numbers");
+            return nullptr;
+        }
+        Proto->setGenerator();
+    }
 
     auto E = ParseExpression();
     if (E) {
@@ -307,7 +719,10 @@ std::unique_ptr<FunctionAST> ParseDefinition() {
 /// external ::= 'extern' prototype
 std::unique_ptr<PrototypeAST> ParseExtern() {
     getNextToken(); // eat 'extern'
-    return ParsePrototype();
+    auto Proto = ParsePrototype();
+    if (Proto)
+        Proto->setExtern();
+    return Proto;
 }
 
 /// ifexpr ::= 'if' expression 'then' expression 'else' expression
@@ -342,43 +757,142 @@ std::unique_ptr<IfExprAST> ParseIfExpr(){
     return std::make_unique<IfExprAST>(std::move(condn), std::move(then_body), std::move(else_body));
 }
 
-/// forexpr ::= 'for' identifier '=' expr ',' expr (',' expr)? 'in' expression
-std::unique_ptr<ForExprAST> ParseForExpr(){
-    getNextToken();
-    if (CurTok != tok_identifier){
-        LogError("expected identifier after for");
-        return nullptr;
+/// loophints ::= '[' hint (',' hint)* ']'
+/// hint      ::= ('unroll' | 'vectorize' | 'interleave') number
+bool ParseLoopHints(LoopHints &Hints){
+    getNextToken(); // eat '['
+    while (true){
+        if (CurTok != tok_identifier){
+            LogError("expected loop hint name inside '[ ]'");
+            return false;
+        }
+        std::string HintName = IdentifierStr;
+        getNextToken(); // eat hint name
+
+        if (CurTok != tok_number || NumVal < 1){
+            LogError("expected a positive count after loop hint");
+            return false;
+        }
+        unsigned Count = static_cast<unsigned>(NumVal);
+        getNextToken(); // eat count
+
+        if (HintName == "unroll"){
+            Hints.UnrollCount = Count;
+        } else if (HintName == "vectorize"){
+            Hints.VectorizeWidth = Count;
+        } else if (HintName == "interleave"){
+            Hints.InterleaveCount = Count;
+        } else {
+            LogError("unknown loop hint, expected unroll, vectorize or interleave");
+            return false;
+        }
+
+        if (CurTok == ']') break;
+        if (CurTok != ','){
+            LogError("expected ',' or ']' in loop hint list");
+            return false;
+        }
+        getNextToken(); // eat ','
+    }
+    getNextToken(); // eat ']'
+    return true;
+}
+
+/// loopdim ::= identifier '=' expr ',' expr (',' expr)?
+bool ParseLoopDim(LoopDim &Dim){
+    // ParseForExpr() reads the name of the first dimension itself.
+    if (Dim.VarName.empty()) {
+        if (CurTok != tok_identifier){
+            LogError("expected identifier after for");
+            return false;
+        }
+        Dim.VarName = IdentifierStr;
+        getNextToken(); //eat identifier
     }
-    std::string IdName = IdentifierStr;
-    getNextToken(); //eat identifier
 
     if (CurTok != '='){
         LogError("expected '=' after for ");
-        return nullptr;
+        return false;
     }
     getNextToken(); //eat '='
-    auto Start = ParseExpression();
-    if (!Start)
-        return nullptr;
+    Dim.Start = ParseExpression();
+    if (!Dim.Start)
+        return false;
 
     if (CurTok != ','){
         LogError("expected ',' after for start value");
-        return nullptr;
+        return false;
     }
     getNextToken();
 
-    auto End = ParseExpression();
-    if (!End)
-        return nullptr;
+    Dim.End = ParseExpression();
+    if (!Dim.End)
+        return false;
 
     // The step value is optional
-    std::unique_ptr<ExprAST> Step;
     if (CurTok == ',') {
         getNextToken();
-        Step = ParseExpression();
-        if (!Step)
+        Dim.Step = ParseExpression();
+        if (!Dim.Step)
+            return false;
+    }
+    return true;
+}
+
+/// forexpr ::= 'for' loophints? loopdim 'in' expression
+///         ::= 'for' loophints? loopdim (';' loopdim)+ ('tile' '(' number (',' number)* ')')? 'interchange'? 'in' expression
+///         ::= 'for' loophints? identifier 'in' callexpr 'in' expression
+std::unique_ptr<ExprAST> ParseForExpr(){
+    getNextToken(); // eat 'for'
+
+    LoopHints Hints;
+    if (CurTok == '[' && !ParseLoopHints(Hints))
+        return nullptr;
+
+    std::vector<LoopDim> Dims(1);
+    if (CurTok == tok_identifier) {
+        Dims[0].VarName = IdentifierStr;
+        getNextToken(); // eat identifier
+        // "for x in g(..) in body" iterates over the values of a generator.
+        if (CurTok == tok_in)
+            return ParseForInExpr(Dims[0].VarName, Hints);
+    }
+    if (!ParseLoopDim(Dims[0]))
+        return nullptr;
+
+    // A ';' after the first dimension makes this a loop nest, where End is an upper bound.
+    std::vector<unsigned> TileSizes;
+    bool Interchange = false;
+    while (CurTok == ';'){
+        getNextToken(); // eat ';'
+        Dims.emplace_back();
+        if (!ParseLoopDim(Dims.back()))
             return nullptr;
     }
+    if (Dims.size() > 1){
+        if (CurTok == tok_identifier && IdentifierStr == "tile"){
+            getNextToken(); // eat 'tile'
+            if (CurTok != '(')
+                return LogError("expected '(' after tile");
+            do {
+                getNextToken(); // eat '(' or ','
+                if (CurTok != tok_number || NumVal < 1)
+                    return LogError("tile sizes must be positive numbers");
+                TileSizes.push_back(static_cast<unsigned>(NumVal));
+                getNextToken(); // eat size
+            } while (CurTok == ',');
+            if (CurTok != ')')
+                return LogError("expected ')' after tile sizes");
+            getNextToken(); // eat ')'
+            if (TileSizes.size() != Dims.size())
+                return LogError("tile needs exactly one size per loop dimension");
+        }
+        if (CurTok == tok_identifier && IdentifierStr == "interchange"){
+            Interchange = true;
+            getNextToken(); // eat 'interchange'
+        }
+    }
+
     if (CurTok != tok_in){
         LogError("expected 'in' after for");
         return nullptr;
@@ -391,8 +905,30 @@ std::unique_ptr<ForExprAST> ParseForExpr(){
         return nullptr;
     }
 
-    return std::make_unique<ForExprAST>(IdName, std::move(Start), std::move(End), std::move(Step), std::move(Body));
-    
+    if (Dims.size() > 1)
+        return std::make_unique<ForNestExprAST>(std::move(Dims), std::move(TileSizes), Interchange, std::move(Body), Hints);
+
+    LoopDim &D = Dims[0];
+    return std::make_unique<ForExprAST>(D.VarName, std::move(D.Start), std::move(D.End), std::move(D.Step), std::move(Body), Hints);
+}
+
+/// forinexpr ::= 'for' loophints? identifier 'in' callexpr 'in' expression
+std::unique_ptr<ExprAST> ParseForInExpr(const std::string &VarName, const LoopHints &Hints){
+    getNextToken(); // eat 'in'
+    auto Source = ParseExpression();
+    if (!Source)
+        return nullptr;
+    if (!llvm::isa<CallExprAST>(Source.get()))
+        return LogError("expected a call of a generator after 'in'");
+
+    if (CurTok != tok_in)
+        return LogError("expected 'in' after generator call");
+    getNextToken(); // eat 'in'
+
+    auto Body = ParseExpression();
+    if (!Body)
+        return nullptr;
+    return std::make_unique<ForInExprAST>(VarName, std::move(Source), std::move(Body), Hints);
 }
 
 /// toplevelexpr ::= expression
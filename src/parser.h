@@ -12,17 +12,29 @@ std::unique_ptr<PrototypeAST> LogErrorP(const char* Str);
 // Parsing functions
 std::unique_ptr<ExprAST> ParseExpression();
 std::unique_ptr<ExprAST> ParseNumberExpr();
+std::unique_ptr<ExprAST> ParseImaginaryExpr();
 std::unique_ptr<ExprAST> ParseParenExpr();
 std::unique_ptr<ExprAST> ParseIdentifierOrCallExpr();
 std::unique_ptr<ExprAST> ParsePrimary();
+std::unique_ptr<ExprAST> ParsePostfixExpr();
 std::unique_ptr<ExprAST> ParseUnary();
 std::unique_ptr<ExprAST> ParseVarExpr();
+std::unique_ptr<ExprAST> ParseDestructuringVar();
+std::unique_ptr<ExprAST> ParseLambdaExpr();
+std::unique_ptr<ExprAST> ParseYieldExpr();
 std::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec, std::unique_ptr<ExprAST> LHS);
+bool ParseType(TypeAST &Ty, std::unique_ptr<ExprAST> *Length = nullptr);
+std::unique_ptr<RecordDeclAST> ParseStructDecl();
+std::unique_ptr<GlobalDeclAST> ParseGlobalDecl();
+bool ParseParams(std::vector<std::string> &ArgNames, std::vector<TypeAST> &ArgTypes, TypeAST &RetType);
 std::unique_ptr<PrototypeAST> ParsePrototype();
 std::unique_ptr<FunctionAST> ParseDefinition();
 std::unique_ptr<PrototypeAST> ParseExtern();
 std::unique_ptr<IfExprAST> ParseIfExpr();
-std::unique_ptr<ForExprAST> ParseForExpr();
+bool ParseLoopHints(LoopHints &Hints);
+bool ParseLoopDim(LoopDim &Dim);
+std::unique_ptr<ExprAST> ParseForExpr();
+std::unique_ptr<ExprAST> ParseForInExpr(const std::string &VarName, const LoopHints &Hints);
 std::unique_ptr<FunctionAST> ParseTopLevelExpr();
 
 // Precedence helper
@@ -0,0 +1,306 @@
+#include "records.h"
+#include "codegen.h"
+#include "complex.h"
+#include "generators.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include <vector>
+
+// Forward declaration, see ast.cpp
+llvm::AllocaInst *CreateEntryBlockAlloca(llvm::Function *TheFunction, llvm::StringRef VarName, llvm::Type *Ty);
+
+std::map<std::string, std::unique_ptr<RecordDeclAST>> RecordDecls;
+
+llvm::StructType *getRecordTy(const std::string &Name) {
+    auto It = RecordDecls.find(Name);
+    if (It == RecordDecls.end())
+        return nullptr;
+    // Named types live in the context, so each is created once per context.
+    if (auto *ST = llvm::StructType::getTypeByName(*TheContext, Name))
+        return ST;
+
+    std::vector<llvm::Type*> Fields;
+    for (auto &FieldTy : It->second->getFieldTypes())
+        Fields.push_back(FieldTy.codegen());
+    return llvm::StructType::create(*TheContext, Fields, Name);
+}
+
+const RecordDeclAST *getRecordDecl(llvm::Type *Ty) {
+    auto *ST = llvm::dyn_cast<llvm::StructType>(Ty);
+    if (!ST || !ST->hasName())
+        return nullptr;
+    auto It = RecordDecls.find(ST->getName().str());
+    return It == RecordDecls.end() ? nullptr : It->second.get();
+}
+
+//===----------------------------------------------------------------------===//
+// Array descriptors
+//===----------------------------------------------------------------------===//
+
+llvm::StructType *getArrayTy(const TypeAST &Ty) {
+    TypeAST Elem = Ty.getElementType();
+    std::string Name;
+    unsigned NumPtrs = 1;
+    switch (Elem.getKind()) {
+    case TypeAST::Number:
+        Name = "double.array";
+        break;
+    case TypeAST::Complex:
+        Name = "complex.array";
+        break;
+    case TypeAST::Tuple:
+    case TypeAST::Function:
+        return nullptr;
+    case TypeAST::Record: {
+        auto It = RecordDecls.find(Elem.getRecordName());
+        if (It == RecordDecls.end())
+            return nullptr;
+        // The layout only changes anything for records
+        bool SoA = Ty.getLayout() == TypeAST::SoA;
+        Name = Elem.getRecordName() + (SoA ? ".soa" : ".aos");
+        if (SoA)
+            NumPtrs = It->second->getFieldTypes().size();
+        break;
+    }
+    }
+
+    if (auto *ST = llvm::StructType::getTypeByName(*TheContext, Name))
+        return ST;
+    std::vector<llvm::Type*> Fields(NumPtrs, llvm::PointerType::getUnqual(*TheContext));
+    Fields.push_back(llvm::Type::getInt64Ty(*TheContext));
+    return llvm::StructType::create(*TheContext, Fields, Name);
+}
+
+bool getArrayInfo(llvm::Type *Ty, ArrayInfo &Info) {
+    auto *ST = llvm::dyn_cast<llvm::StructType>(Ty);
+    if (!ST || !ST->hasName())
+        return false;
+    std::string Name = ST->getName().str();
+    size_t Dot = Name.rfind('.');
+    if (Dot == std::string::npos)
+        return false;
+    std::string Elem = Name.substr(0, Dot), Suffix = Name.substr(Dot + 1);
+
+    Info = ArrayInfo();
+    if (Suffix == "array") {
+        Info.ElemTy = Elem == "complex" ? getComplexTy() : getNumTy();
+        return true;
+    }
+    if (Suffix != "aos" && Suffix != "soa")
+        return false;
+    auto It = RecordDecls.find(Elem);
+    if (It == RecordDecls.end())
+        return false;
+    Info.Record = It->second.get();
+    Info.ElemTy = getRecordTy(Elem);
+    Info.SoA = Suffix == "soa";
+    return true;
+}
+
+/// Array indices are numbers truncated to an integer. There is no bounds check.
+static llvm::Value *ToIndex(llvm::Value *Index) {
+    if (!Index->getType()->isFloatingPointTy())
+        return LogErrorV("array index must be a number");
+    return Builder->CreateFPToSI(Index, Builder->getInt64Ty(), "idx");
+}
+
+static unsigned NumDataPtrs(llvm::Value *Desc) {
+    return llvm::cast<llvm::StructType>(Desc->getType())->getNumElements() - 1;
+}
+
+// Arrays of constant length up to this size are allocated on the stack.
+static const uint64_t MaxStackArrayBytes = 4096;
+
+/// Storage for N elements of type ElemTy: in the frame when Stack is set, else from the arena.
+static llvm::Value *EmitArrayStorage(llvm::Type *ElemTy, llvm::Value *N, bool Stack, const llvm::Twine &Name) {
+    const llvm::DataLayout &DL = TheModule->getDataLayout();
+    uint64_t ElemSize = DL.getTypeAllocSize(ElemTy);
+    if (Stack) {
+        uint64_t Count = llvm::cast<llvm::ConstantInt>(N)->getZExtValue();
+        llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+        llvm::AllocaInst *Data = CreateEntryBlockAlloca(TheFunction, Name.str(), llvm::ArrayType::get(ElemTy, Count));
+        // Zeroed on every entry to the var, which may be in a loop
+        Builder->CreateMemSet(Data, Builder->getInt8(0), Count * ElemSize, Data->getAlign());
+        return Data;
+    }
+    llvm::Type *PtrTy = llvm::PointerType::getUnqual(*TheContext);
+    llvm::FunctionCallee Calloc = TheModule->getOrInsertFunction(
+        "kaleido_arena_calloc", PtrTy, Builder->getInt64Ty(), Builder->getInt64Ty());
+    return Builder->CreateCall(Calloc, {N, Builder->getInt64(ElemSize)}, Name);
+}
+
+llvm::Value *EmitArrayAlloc(const TypeAST &Ty, llvm::Value *Len, llvm::Value *&ArenaMark) {
+    llvm::StructType *DescTy = getArrayTy(Ty);
+    ArrayInfo Info;
+    if (!DescTy || !getArrayInfo(DescTy, Info))
+        return LogErrorV("Unknown array element type");
+    if (!Len->getType()->isFloatingPointTy())
+        return LogErrorV("array length must be a number");
+
+    // A negative length makes an empty array.
+    llvm::Value *N = Builder->CreateFPToSI(Len, Builder->getInt64Ty(), "len");
+    N = Builder->CreateSelect(Builder->CreateICmpSLT(N, Builder->getInt64(0)), Builder->getInt64(0), N);
+
+    // Escape analysis: var arrays are dead once the body of the var is done (see
+    // runtime.h), so a small one of constant length can live in the function's frame.
+    // The builder folds a constant length down to a ConstantInt.
+    const llvm::DataLayout &DL = TheModule->getDataLayout();
+    auto *Count = llvm::dyn_cast<llvm::ConstantInt>(N);
+    bool Stack = Count && Count->getZExtValue() <= MaxStackArrayBytes / DL.getTypeAllocSize(Info.ElemTy);
+    // The arena is a stack, which a generator suspended inside the var would leave unbalanced.
+    if (!Stack && CurGenerator)
+        return LogErrorV("arrays in a generator need a small constant length");
+    if (!Stack && !ArenaMark) {
+        llvm::FunctionCallee Mark = TheModule->getOrInsertFunction(
+            "kaleido_arena_mark", llvm::PointerType::getUnqual(*TheContext));
+        ArenaMark = Builder->CreateCall(Mark, {}, "arena.mark");
+    }
+
+    llvm::Value *Desc = llvm::PoisonValue::get(DescTy);
+    if (Info.SoA) {
+        auto *RecTy = llvm::cast<llvm::StructType>(Info.ElemTy);
+        for (unsigned i = 0, e = RecTy->getNumElements(); i != e; ++i) {
+            llvm::Value *Data = EmitArrayStorage(RecTy->getElementType(i), N, Stack, Info.Record->getFieldNames()[i]);
+            Desc = Builder->CreateInsertValue(Desc, Data, i);
+        }
+    } else {
+        Desc = Builder->CreateInsertValue(Desc, EmitArrayStorage(Info.ElemTy, N, Stack, "data"), 0);
+    }
+    return Builder->CreateInsertValue(Desc, N, DescTy->getNumElements() - 1, "array");
+}
+
+void EmitArenaRelease(llvm::Value *ArenaMark) {
+    llvm::FunctionCallee Release = TheModule->getOrInsertFunction(
+        "kaleido_arena_release", Builder->getVoidTy(), llvm::PointerType::getUnqual(*TheContext));
+    Builder->CreateCall(Release, ArenaMark);
+}
+
+llvm::Value *EmitArrayLength(llvm::Value *Desc) {
+    llvm::Value *N = Builder->CreateExtractValue(Desc, NumDataPtrs(Desc), "len");
+    return Builder->CreateSIToFP(N, getNumTy(), "lentmp");
+}
+
+bool IsIOBuiltin(const std::string &Name) {
+    return Name == "write" || Name == "read" || Name == "flush" || Name == "writeimage";
+}
+
+llvm::Value *EmitIOBuiltin(const std::string &Name, llvm::Value *Fd, llvm::Value *Desc) {
+    llvm::Type *I64Ty = Builder->getInt64Ty();
+    Fd = Builder->CreateFPToSI(Fd, I64Ty, "fd");
+    llvm::Value *Result;
+    if (Name == "flush") {
+        llvm::FunctionCallee Flush = TheModule->getOrInsertFunction("kaleido_io_flush", I64Ty, I64Ty);
+        Result = Builder->CreateCall(Flush, {Fd}, "flushed");
+    } else {
+        ArrayInfo Info;
+        getArrayInfo(Desc->getType(), Info);
+        // The elements go out as they are laid out in memory, e.g. raw doubles.
+        uint64_t ElemSize = TheModule->getDataLayout().getTypeAllocSize(Info.ElemTy);
+        llvm::FunctionCallee Transfer = TheModule->getOrInsertFunction(
+            Name == "write" ? "kaleido_io_write" : "kaleido_io_read", I64Ty, I64Ty,
+            llvm::PointerType::getUnqual(*TheContext), I64Ty, I64Ty);
+        llvm::Value *Data = Builder->CreateExtractValue(Desc, 0, "data");
+        llvm::Value *N = Builder->CreateExtractValue(Desc, 1, "len");
+        Result = Builder->CreateCall(Transfer, {Fd, Data, N, Builder->getInt64(ElemSize)}, "transferred");
+    }
+    return Builder->CreateSIToFP(Result, getNumTy(), "iotmp");
+}
+
+llvm::Value *EmitImageWrite(llvm::Value *Fd, llvm::Value *Desc, llvm::Value *Width) {
+    ArrayInfo Info;
+    getArrayInfo(Desc->getType(), Info);
+    llvm::Type *NumTy = getNumTy();
+    unsigned Channels = 0;
+    if (!Info.Record && Info.ElemTy == NumTy) {
+        Channels = 1;
+    } else if (Info.Record) {
+        auto *RecTy = llvm::cast<llvm::StructType>(Info.ElemTy);
+        if (RecTy->getNumElements() == 3 && llvm::all_of(RecTy->elements(), [&](llvm::Type *T) { return T == NumTy; }))
+            Channels = 3;
+    }
+    if (!Channels)
+        return LogErrorV("writeimage() takes an array of numbers or of records of three numbers");
+
+    llvm::Type *I64Ty = Builder->getInt64Ty();
+    llvm::FunctionCallee Write = TheModule->getOrInsertFunction(
+        "kaleido_image_write", I64Ty, I64Ty, llvm::PointerType::getUnqual(*TheContext), I64Ty, I64Ty, I64Ty, I64Ty);
+    llvm::Value *Data = Builder->CreateExtractValue(Desc, 0, "data");
+    llvm::Value *N = Builder->CreateExtractValue(Desc, 1, "len");
+    uint64_t Size = TheModule->getDataLayout().getTypeAllocSize(NumTy);
+    llvm::Value *Result = Builder->CreateCall(
+        Write, {Builder->CreateFPToSI(Fd, I64Ty, "fd"), Data, N, Builder->CreateFPToSI(Width, I64Ty, "width"),
+                Builder->getInt64(Channels), Builder->getInt64(Size)}, "written");
+    return Builder->CreateSIToFP(Result, NumTy, "iotmp");
+}
+
+llvm::Value *EmitElementFieldAddress(llvm::Value *Desc, llvm::Value *Index, unsigned Field) {
+    ArrayInfo Info;
+    if (!getArrayInfo(Desc->getType(), Info) || !Info.Record)
+        return LogErrorV("'.' needs a record");
+    llvm::Value *I = ToIndex(Index);
+    if (!I)
+        return nullptr;
+
+    auto *RecTy = llvm::cast<llvm::StructType>(Info.ElemTy);
+    const std::string &Name = Info.Record->getFieldNames()[Field];
+    if (Info.SoA) {
+        llvm::Value *Column = Builder->CreateExtractValue(Desc, Field);
+        return Builder->CreateInBoundsGEP(RecTy->getElementType(Field), Column, I, Name);
+    }
+    llvm::Value *Data = Builder->CreateExtractValue(Desc, 0);
+    llvm::Value *Elem = Builder->CreateInBoundsGEP(RecTy, Data, I);
+    return Builder->CreateStructGEP(RecTy, Elem, Field, Name);
+}
+
+llvm::Value *EmitLoadElement(llvm::Value *Desc, llvm::Value *Index) {
+    ArrayInfo Info;
+    if (!getArrayInfo(Desc->getType(), Info))
+        return LogErrorV("only arrays can be indexed");
+
+    if (Info.SoA) {
+        // Gather the fields into a record value.
+        auto *RecTy = llvm::cast<llvm::StructType>(Info.ElemTy);
+        llvm::Value *Rec = llvm::PoisonValue::get(RecTy);
+        for (unsigned i = 0, e = RecTy->getNumElements(); i != e; ++i) {
+            llvm::Value *Addr = EmitElementFieldAddress(Desc, Index, i);
+            if (!Addr)
+                return nullptr;
+            Rec = Builder->CreateInsertValue(Rec, Builder->CreateLoad(RecTy->getElementType(i), Addr), i);
+        }
+        return Rec;
+    }
+
+    llvm::Value *I = ToIndex(Index);
+    if (!I)
+        return nullptr;
+    llvm::Value *Addr = Builder->CreateInBoundsGEP(Info.ElemTy, Builder->CreateExtractValue(Desc, 0), I);
+    return Builder->CreateLoad(Info.ElemTy, Addr, "elem");
+}
+
+llvm::Value *EmitStoreElement(llvm::Value *Desc, llvm::Value *Index, llvm::Value *Val) {
+    ArrayInfo Info;
+    if (!getArrayInfo(Desc->getType(), Info))
+        return LogErrorV("only arrays can be indexed");
+    Val = CoerceValue(Val, Info.ElemTy);
+    if (!Val)
+        return nullptr;
+
+    if (Info.SoA) {
+        // Scatter the record into the field arrays.
+        auto *RecTy = llvm::cast<llvm::StructType>(Info.ElemTy);
+        for (unsigned i = 0, e = RecTy->getNumElements(); i != e; ++i) {
+            llvm::Value *Addr = EmitElementFieldAddress(Desc, Index, i);
+            if (!Addr)
+                return nullptr;
+            Builder->CreateStore(Builder->CreateExtractValue(Val, i), Addr);
+        }
+        return Val;
+    }
+
+    llvm::Value *I = ToIndex(Index);
+    if (!I)
+        return nullptr;
+    llvm::Value *Addr = Builder->CreateInBoundsGEP(Info.ElemTy, Builder->CreateExtractValue(Desc, 0), I);
+    Builder->CreateStore(Val, Addr);
+    return Val;
+}
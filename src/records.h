@@ -0,0 +1,63 @@
+#ifndef RECORDS_H
+#define RECORDS_H
+
+#include "ast.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Value.h"
+#include <map>
+#include <memory>
+#include <string>
+
+// Records are named LLVM structs ("%Particle = type { double, double }"), so the type
+// of any value tells codegen which declaration it belongs to.
+//
+// Arrays are passed around as small descriptors, also named structs:
+//   %Particle.aos  = type { ptr data, i64 len }          one array of records
+//   %Particle.soa  = type { ptr x, ptr y, ..., i64 len }  one array per field
+//   %double.array  = type { ptr data, i64 len }          (and %complex.array)
+// Element and field accesses compile to a GEP on the right pointer, so a loop over
+// one field of a SoA array reads contiguous memory.
+
+// Every struct declared so far, by name. Like FunctionProtos, this outlives modules.
+extern std::map<std::string, std::unique_ptr<RecordDeclAST>> RecordDecls;
+
+// The named struct type of a record in the current module, or nullptr.
+llvm::StructType *getRecordTy(const std::string &Name);
+// The declaration behind a record type, or nullptr if Ty is not a record.
+const RecordDeclAST *getRecordDecl(llvm::Type *Ty);
+
+struct ArrayInfo {
+    llvm::Type *ElemTy = nullptr;
+    const RecordDeclAST *Record = nullptr; // for arrays of records
+    bool SoA = false;
+};
+
+// The descriptor type of an array type, or nullptr.
+llvm::StructType *getArrayTy(const TypeAST &Ty);
+// Decode a descriptor type, false if Ty is not an array.
+bool getArrayInfo(llvm::Type *Ty, ArrayInfo &Info);
+
+// Zero-initialized storage for Len elements, for the arrays of a var. Small arrays of
+// constant length go on the stack, the others in the runtime arena (runtime.h). The first
+// arena allocation sets ArenaMark, which EmitArenaRelease() frees everything back to.
+llvm::Value *EmitArrayAlloc(const TypeAST &Ty, llvm::Value *Len, llvm::Value *&ArenaMark);
+void EmitArenaRelease(llvm::Value *ArenaMark);
+// len(a), as a number.
+llvm::Value *EmitArrayLength(llvm::Value *Desc);
+
+// The bulk I/O builtins write(fd, a), read(fd, a), flush(fd) and writeimage(fd, a, w),
+// see runtime.h. Fd is a number, Desc an array that is not SoA (nullptr for flush).
+// The result is the number of elements transferred, or -1.
+bool IsIOBuiltin(const std::string &Name);
+llvm::Value *EmitIOBuiltin(const std::string &Name, llvm::Value *Fd, llvm::Value *Desc);
+// writeimage(fd, a, w): a, Width pixels to a row, as a PGM image if its elements are
+// numbers, or as a PPM if they are records of three numbers (r, g, b). The pixels are
+// set with ordinary element stores; the builtin only converts and writes them, once.
+llvm::Value *EmitImageWrite(llvm::Value *Fd, llvm::Value *Desc, llvm::Value *Width);
+
+// a[i], a[i] = v, and the address of field Field of a[i]. Index is a number.
+llvm::Value *EmitLoadElement(llvm::Value *Desc, llvm::Value *Index);
+llvm::Value *EmitStoreElement(llvm::Value *Desc, llvm::Value *Index, llvm::Value *Val);
+llvm::Value *EmitElementFieldAddress(llvm::Value *Desc, llvm::Value *Index, unsigned Field);
+
+#endif // RECORDS_H
@@ -0,0 +1,114 @@
+#include "runtime.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Chunks are allocated on demand and kept for reuse until ResetRuntimeArena().
+static const size_t ChunkSize = 1 << 20;
+static const size_t Alignment = 16;
+
+struct ArenaChunk {
+    char *Begin, *End;
+};
+
+class RuntimeArena {
+    std::vector<ArenaChunk> Chunks;
+    size_t Cur = 0;        // the chunk Top points into
+    char *Top = nullptr;
+
+    bool contains(const ArenaChunk &C, const char *P) const { return P >= C.Begin && P <= C.End; }
+public:
+    ~RuntimeArena() {
+        for (auto &C : Chunks)
+            std::free(C.Begin);
+    }
+
+    void *allocate(size_t Bytes) {
+        Bytes = (Bytes + Alignment - 1) & ~(Alignment - 1);
+        if (Chunks.empty() || size_t(Chunks[Cur].End - Top) < Bytes) {
+            // Move on to the next kept chunk, or put a new one in front of it.
+            size_t Next = Chunks.empty() ? 0 : Cur + 1;
+            if (Next == Chunks.size() || size_t(Chunks[Next].End - Chunks[Next].Begin) < Bytes) {
+                size_t Size = std::max(ChunkSize, Bytes);
+                // malloc aligns to 16 bytes on every 64-bit target
+                char *Mem = static_cast<char *>(std::malloc(Size));
+                if (!Mem)
+                    return nullptr;
+                Chunks.insert(Chunks.begin() + Next, {Mem, Mem + Size});
+            }
+            Cur = Next;
+            Top = Chunks[Cur].Begin;
+        }
+        void *P = Top;
+        Top += Bytes;
+        return P;
+    }
+
+    void *mark() const { return Top; }
+
+    void release(void *Mark) {
+        char *P = static_cast<char *>(Mark);
+        if (!P) {
+            // Marked before the first chunk existed
+            Cur = 0;
+            Top = Chunks.empty() ? nullptr : Chunks[0].Begin;
+            return;
+        }
+        while (Cur > 0 && !contains(Chunks[Cur], P))
+            --Cur;
+        Top = P;
+    }
+
+    void reset() {
+        for (size_t i = 1; i < Chunks.size(); ++i)
+            std::free(Chunks[i].Begin);
+        Chunks.resize(std::min<size_t>(Chunks.size(), 1));
+        release(nullptr);
+    }
+};
+
+// One arena per thread, so code running on worker threads needs no locking.
+static thread_local RuntimeArena TheArena;
+
+extern "C" DLLEXPORT void *kaleido_arena_calloc(int64_t N, int64_t Size) {
+    if (N < 0 || Size < 0 || (Size && N > INT64_MAX / Size))
+        return nullptr;
+    size_t Bytes = N * Size;
+    void *P = TheArena.allocate(Bytes);
+    if (P)
+        std::memset(P, 0, Bytes);
+    return P;
+}
+
+extern "C" DLLEXPORT void *kaleido_arena_mark() {
+    return TheArena.mark();
+}
+
+extern "C" DLLEXPORT void kaleido_arena_release(void *Mark) {
+    TheArena.release(Mark);
+}
+
+void ResetRuntimeArena() {
+    TheArena.reset();
+}
+
+extern "C" DLLEXPORT void kaleido_parallel_for(int64_t N, void (*Body)(void *, int64_t), void *Ctx) {
+    if (N <= 0)
+        return;
+    int64_t Workers = std::min<int64_t>(std::max(1u, std::thread::hardware_concurrency()), N);
+    std::atomic<int64_t> Next(0);
+    auto Run = [&] {
+        for (int64_t I; (I = Next.fetch_add(1, std::memory_order_relaxed)) < N;)
+            Body(Ctx, I);
+    };
+    std::vector<std::thread> Threads;
+    for (int64_t i = 1; i < Workers; ++i)
+        Threads.emplace_back(Run);
+    Run();
+    for (auto &T : Threads)
+        T.join();
+}
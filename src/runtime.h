@@ -0,0 +1,66 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <cstdint>
+
+#ifdef _WIN32
+#define DLLEXPORT __declspec(dllexport)
+#else
+#define DLLEXPORT
+#endif
+
+// Memory for the heap values of JIT'd code, resolved by name like the extern builtins.
+//
+// The only heap values are the arrays a 'var' allocates, and they never outlive its body
+// (codegen rejects a body whose value is one of them, or a closure over one). So each
+// thread allocates them from a bump arena and frees them in LIFO order: the var takes a
+// mark before its first array and releases back to it after its body. Allocating is a
+// pointer bump, freeing a store.
+//
+// Small arrays of constant length do not use the arena at all, see EmitArrayAlloc().
+
+extern "C" {
+// Zeroed storage for N elements of Size bytes, 16-byte aligned, like calloc.
+DLLEXPORT void *kaleido_arena_calloc(int64_t N, int64_t Size);
+// The current top of this thread's arena, and a reset to an earlier top.
+DLLEXPORT void *kaleido_arena_mark();
+DLLEXPORT void kaleido_arena_release(void *Mark);
+}
+
+// Bulk I/O for the read(fd, a), write(fd, a) and flush(fd) builtins. The language has
+// no strings, so the files and pipes are the descriptors the process was started with,
+// e.g. "kaledio_lang 3<in.f64 4>out.f64"; each descriptor is either read or written.
+//
+// With io_uring (KALEIDO_HAVE_IO_URING, and a kernel that has it) writes return at once:
+// the data is copied into one of a few buffers registered with the ring and submitted,
+// and a runtime thread reaps the completions and submits the next write of the
+// descriptor, so writes land in order while the JIT'd code computes on. A read waits for
+// its data, then reads the next buffer's worth ahead, so the following read usually
+// finds its data there. Otherwise both are blocking read()/write() loops.
+extern "C" {
+// Write or read N elements of Size bytes. Returns the number of elements written
+// (queued) or read, fewer only at end of file, or -1 on an error.
+DLLEXPORT int64_t kaleido_io_write(int64_t Fd, const void *Data, int64_t N, int64_t Size);
+DLLEXPORT int64_t kaleido_io_read(int64_t Fd, void *Data, int64_t N, int64_t Size);
+// Wait until the writes to Fd are done: 0, or -1 if one of them failed.
+DLLEXPORT int64_t kaleido_io_flush(int64_t Fd);
+// writeimage(fd, a, w): the N pixels at Data, Width to a row, as one binary PGM (one
+// channel) or PPM (three, r g b) image, queued like kaleido_io_write. Values are floats
+// (Size 4) or doubles (Size 8) in [0, 1], clamped. Returns N, or -1 on an error.
+DLLEXPORT int64_t kaleido_image_write(int64_t Fd, const void *Data, int64_t N, int64_t Width, int64_t Channels,
+                                      int64_t Size);
+}
+
+// parfor(n, f): calls Body(Ctx, i) for every i in [0, n), spread over one thread per
+// core, the calling thread included, and returns when all calls are done. Iterations
+// are handed out one at a time, so rows of uneven cost (a fractal) balance out. Worker
+// threads live for one call, their arenas with them.
+extern "C" {
+DLLEXPORT void kaleido_parallel_for(int64_t N, void (*Body)(void *, int64_t), void *Ctx);
+}
+
+// Called by the driver after each top-level evaluation: empties this thread's arena and
+// returns all but its first chunk to the system.
+void ResetRuntimeArena();
+
+#endif // RUNTIME_H
@@ -0,0 +1,70 @@
+#include "symbols.h"
+#include "llvm/ADT/StringMap.h"
+#include <string>
+#include <vector>
+
+static llvm::StringMap<Symbol> SymbolIDs;
+// The keys of SymbolIDs, which own the text and never move.
+static std::vector<llvm::StringRef> SymbolNames;
+
+Symbol InternSymbol(llvm::StringRef Name) {
+    auto It = SymbolIDs.try_emplace(Name, SymbolNames.size()).first;
+    if (It->second == SymbolNames.size())
+        SymbolNames.push_back(It->first());
+    return It->second;
+}
+
+llvm::StringRef getSymbolText(Symbol S) {
+    return SymbolNames[S];
+}
+
+unsigned getNumSymbols() {
+    return SymbolNames.size();
+}
+
+// The symbols of the operators, plus one: 0 until an operator is first used.
+static Symbol BinaryOps[256], UnaryOps[256];
+
+static Symbol getOperatorSymbol(Symbol *Table, const char *Prefix, char Op) {
+    Symbol &Entry = Table[(unsigned char)Op];
+    if (!Entry)
+        Entry = InternSymbol(std::string(Prefix) + Op) + 1;
+    return Entry - 1;
+}
+
+Symbol getBinaryOpSymbol(char Op) {
+    return getOperatorSymbol(BinaryOps, "binary", Op);
+}
+
+Symbol getUnaryOpSymbol(char Op) {
+    return getOperatorSymbol(UnaryOps, "unary", Op);
+}
+
+void SymbolTable::pushScope(bool IsFrame) {
+    Scopes.emplace_back(Bindings.size(), FrameBase);
+    if (IsFrame)
+        FrameBase = Bindings.size();
+}
+
+void SymbolTable::popScope() {
+    unsigned Mark = Scopes.back().first;
+    FrameBase = Scopes.back().second;
+    Scopes.pop_back();
+    while (Bindings.size() > Mark) {
+        Innermost[Bindings.back().Name] = Bindings.back().Shadowed;
+        Bindings.pop_back();
+    }
+}
+
+void SymbolTable::bind(Symbol Name, llvm::AllocaInst *Value) {
+    if (Innermost.size() <= Name)
+        Innermost.resize(getNumSymbols());
+    Bindings.push_back({Name, Value, Innermost[Name]});
+    Innermost[Name] = Bindings.size();
+}
+
+llvm::AllocaInst *SymbolTable::lookup(Symbol Name) const {
+    if (Name >= Innermost.size() || Innermost[Name] <= FrameBase)
+        return nullptr;
+    return Bindings[Innermost[Name] - 1].Value;
+}
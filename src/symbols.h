@@ -0,0 +1,67 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include "llvm/ADT/StringRef.h"
+#include <utility>
+#include <vector>
+
+namespace llvm {
+class AllocaInst;
+}
+
+// Interned identifiers. Every distinct name is given a small integer the first time it
+// is seen (usually by the parser), so codegen can index tables by it instead of
+// building, hashing or comparing strings. Symbols are never freed and stay valid for
+// the whole session, across modules.
+using Symbol = unsigned;
+
+Symbol InternSymbol(llvm::StringRef Name);
+llvm::StringRef getSymbolText(Symbol S);
+// One past the largest symbol handed out so far, for tables indexed by symbol.
+unsigned getNumSymbols();
+
+// The function "binary<Op>" or "unary<Op>" that implements a user-defined operator,
+// from a table indexed by the operator character.
+Symbol getBinaryOpSymbol(char Op);
+Symbol getUnaryOpSymbol(char Op);
+
+/// SymbolTable - the local variables in scope during codegen.
+///
+/// The bindings live in one flat vector, innermost last. A table indexed by symbol
+/// points at the innermost binding of every name, and each binding remembers the one it
+/// shadows, so bind, lookup and unbind are O(1) without comparing strings. A scope is a
+/// mark in the vector; leaving it drops the bindings made since, innermost first.
+///
+/// A frame is a scope that also hides every binding outside it. Lambdas and inlinable
+/// clones are emitted while their caller is in progress, and must not see its locals.
+class SymbolTable {
+    struct Binding {
+        Symbol Name;
+        llvm::AllocaInst *Value;
+        unsigned Shadowed; // index + 1 of the binding this one hides, or 0
+    };
+    std::vector<Binding> Bindings;
+    std::vector<unsigned> Innermost; // by symbol: index + 1 into Bindings, or 0
+    std::vector<std::pair<unsigned, unsigned>> Scopes; // Bindings.size() and FrameBase on entry
+    unsigned FrameBase = 0; // bindings below this index belong to an outer frame
+public:
+    void pushScope(bool IsFrame = false);
+    void popScope();
+    // Bind Name in the innermost scope, shadowing any outer binding.
+    void bind(Symbol Name, llvm::AllocaInst *Value);
+    // The innermost binding of Name in the current frame, or nullptr.
+    llvm::AllocaInst *lookup(Symbol Name) const;
+};
+
+/// SymbolScope - a scope of a SymbolTable for the lifetime of the object, so the
+/// bindings are dropped on every path out of codegen, including errors.
+class SymbolScope {
+    SymbolTable &Table;
+public:
+    explicit SymbolScope(SymbolTable &Table, bool IsFrame = false) : Table(Table) { Table.pushScope(IsFrame); }
+    ~SymbolScope() { Table.popScope(); }
+    SymbolScope(const SymbolScope &) = delete;
+    SymbolScope &operator=(const SymbolScope &) = delete;
+};
+
+#endif // SYMBOLS_H
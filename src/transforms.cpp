@@ -0,0 +1,476 @@
+#include "transforms.h"
+#include "globals.h"
+#include "visitor.h"
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+#include <utility>
+
+//===----------------------------------------------------------------------===//
+// AST building helpers
+//===----------------------------------------------------------------------===//
+
+// Names created by the transformations contain a '.', so they can never clash
+// with identifiers the lexer accepts from the user.
+static std::string Hidden(const std::string &VarName, const char *Suffix) {
+    return VarName + "." + Suffix;
+}
+
+static std::unique_ptr<ExprAST> Num(double Val) {
+    return std::make_unique<NumberExprAST>(Val);
+}
+
+static std::unique_ptr<ExprAST> Var(const std::string &Name) {
+    return std::make_unique<VariableExprAST>(Name);
+}
+
+static std::unique_ptr<ExprAST> Bin(char Op, std::unique_ptr<ExprAST> L, std::unique_ptr<ExprAST> R) {
+    return std::make_unique<BinaryExprAST>(Op, std::move(L), std::move(R));
+}
+
+static std::unique_ptr<ExprAST> For(std::string VarName, std::unique_ptr<ExprAST> Start,
+                                    std::unique_ptr<ExprAST> End, std::unique_ptr<ExprAST> Step,
+                                    std::unique_ptr<ExprAST> Body, LoopHints Hints = LoopHints()) {
+    return std::make_unique<ForExprAST>(VarName, std::move(Start), std::move(End),
+                                        std::move(Step), std::move(Body), Hints);
+}
+
+using VarList = std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>>;
+
+//===----------------------------------------------------------------------===//
+// Analysis helpers
+//===----------------------------------------------------------------------===//
+
+// Arrays can alias (the same array may be passed twice), so reads and writes of any
+// element are tracked as accesses to this one pseudo variable.
+const std::string ArrayMemory = "mem.";
+
+bool ReferencesAnyVar(ExprAST *E, const std::set<std::string> &Names) {
+    if (!E)
+        return false;
+    if (auto *V = llvm::dyn_cast<VariableExprAST>(E))
+        return Names.count(V->getName()) != 0;
+
+    bool Found = false;
+    E->forEachChild([&](std::unique_ptr<ExprAST> &Child) {
+        if (!Found)
+            Found = ReferencesAnyVar(Child.get(), Names);
+    });
+    return Found;
+}
+
+// The variable an assignment writes through: "a" for a = .., a[i] = .., a[i].x = .. and a.x = ..
+static VariableExprAST *DestinationVar(ExprAST *Dest) {
+    while (true) {
+        if (auto *Elem = llvm::dyn_cast<IndexExprAST>(Dest))
+            Dest = Elem->getArray();
+        else if (auto *Field = llvm::dyn_cast<FieldExprAST>(Dest))
+            Dest = Field->getBase();
+        else
+            return llvm::dyn_cast<VariableExprAST>(Dest);
+    }
+}
+
+// Does an assignment destination write array memory, i.e. contain an a[i]?
+static bool WritesMemory(ExprAST *Dest) {
+    if (llvm::isa<IndexExprAST>(Dest))
+        return true;
+    if (auto *Field = llvm::dyn_cast<FieldExprAST>(Dest))
+        return WritesMemory(Field->getBase());
+    return false;
+}
+
+bool AssignsAnyVar(ExprAST *E, const std::set<std::string> &Names) {
+    if (!E)
+        return false;
+    if (auto *B = llvm::dyn_cast<BinaryExprAST>(E)) {
+        if (B->getOp() == '=') {
+            auto *Dest = DestinationVar(B->getLHS());
+            if (Dest && Names.count(Dest->getName()))
+                return true;
+        }
+    }
+
+    bool Found = false;
+    E->forEachChild([&](std::unique_ptr<ExprAST> &Child) {
+        if (!Found)
+            Found = AssignsAnyVar(Child.get(), Names);
+    });
+    return Found;
+}
+
+class VarRefCollector : public ExprVisitor<VarRefCollector> {
+    std::set<std::string> &Names;
+public:
+    VarRefCollector(std::set<std::string> &Names) : Names(Names) {}
+    void visitExpr(ExprAST *E) { visitChildren(E); }
+    void visitVariable(VariableExprAST *E) { Names.insert(E->getName()); }
+    void visitCall(CallExprAST *E) {
+        // The callee may be a variable holding a function value
+        Names.insert(E->getCallee());
+        visitChildren(E);
+    }
+    void visitIndex(IndexExprAST *E) {
+        Names.insert(ArrayMemory);
+        visitChildren(E);
+    }
+};
+
+class AssignedVarCollector : public ExprVisitor<AssignedVarCollector> {
+    std::set<std::string> &Names;
+public:
+    AssignedVarCollector(std::set<std::string> &Names) : Names(Names) {}
+    void visitExpr(ExprAST *E) { visitChildren(E); }
+    void visitBinary(BinaryExprAST *B) {
+        if (B->getOp() == '=') {
+            if (auto *Dest = DestinationVar(B->getLHS()))
+                Names.insert(Dest->getName());
+            if (WritesMemory(B->getLHS()))
+                Names.insert(ArrayMemory);
+        }
+        visitChildren(B);
+    }
+};
+
+void CollectVarRefs(ExprAST *E, std::set<std::string> &Names) {
+    if (E)
+        VarRefCollector(Names).visit(E);
+}
+
+void CollectAssignedVars(ExprAST *E, std::set<std::string> &Names) {
+    if (E)
+        AssignedVarCollector(Names).visit(E);
+}
+
+// Binary operators that codegen emits inline; every other one is a call to "binary<op>".
+static bool IsBuiltinBinaryOp(char Op) {
+    return Op == '=' || Op == '+' || Op == '-' || Op == '*' || Op == '/' || Op == '<';
+}
+
+// Calls are the only way an expression can have effects outside its own function,
+// apart from a yield handing a value to the loop consuming the generator.
+bool ContainsCall(ExprAST *E) {
+    if (!E)
+        return false;
+    if (llvm::isa<CallExprAST, UnaryExprAST, YieldExprAST>(E))
+        return true;
+    if (auto *B = llvm::dyn_cast<BinaryExprAST>(E)) {
+        if (!IsBuiltinBinaryOp(B->getOp()))
+            return true;
+    }
+
+    bool Found = false;
+    E->forEachChild([&](std::unique_ptr<ExprAST> &Child) {
+        if (!Found)
+            Found = ContainsCall(Child.get());
+    });
+    return Found;
+}
+
+//===----------------------------------------------------------------------===//
+// Loop nest lowering (tiling and interchange)
+//===----------------------------------------------------------------------===//
+
+// Untransformed nest: every dimension evaluates its bounds on entry and is guarded
+// against an empty range, since a plain for loop always runs its body once.
+static std::unique_ptr<ExprAST> LowerPlainNest(std::vector<LoopDim> &Dims,
+                                               std::unique_ptr<ExprAST> Body,
+                                               const LoopHints &Hints) {
+    std::unique_ptr<ExprAST> Inner = std::move(Body);
+    for (size_t k = Dims.size(); k-- > 0;) {
+        LoopDim &D = Dims[k];
+        std::string Lo = Hidden(D.VarName, "lo"), Hi = Hidden(D.VarName, "hi"), St = Hidden(D.VarName, "st");
+
+        auto Loop = For(D.VarName, Var(Lo), Bin('<', Var(D.VarName), Var(Hi)), Var(St),
+                        std::move(Inner), k + 1 == Dims.size() ? Hints : LoopHints());
+        auto Guarded = std::make_unique<IfExprAST>(Bin('<', Var(Lo), Var(Hi)), std::move(Loop), Num(0));
+
+        VarList Bounds;
+        Bounds.emplace_back(Lo, std::move(D.Start));
+        Bounds.emplace_back(Hi, std::move(D.End));
+        Bounds.emplace_back(St, D.Step ? std::move(D.Step) : Num(1));
+        Inner = std::make_unique<VarExprAST>(std::move(Bounds), std::move(Guarded));
+    }
+    return Inner;
+}
+
+/// Lower a loop nest. If no bound depends on a nest variable and the body never assigns
+/// one, the iteration space is a fixed rectangle: the bounds are hoisted out of the whole
+/// nest, the loops may be interchanged and, with tile sizes, each dimension is split into
+/// a tile loop and a point loop:
+///
+///   for y.t = y.lo, y.t < y.hi, y.ts in
+///     for x.t = x.lo, x.t < x.hi, x.ts in
+///       var y.e = min(y.t + y.ts, y.hi), x.e = min(x.t + x.ts, x.hi) in
+///         for y = y.t, y < y.e, y.st in
+///           for x = x.t, x < x.e, x.st in body
+///
+/// The tiles are independent of each other, so each tile iteration could run in parallel.
+/// Steps are assumed positive.
+std::unique_ptr<ExprAST> LowerLoopNest(ForNestExprAST &Nest) {
+    std::vector<LoopDim> &Dims = Nest.getDims();
+    const std::vector<unsigned> &TileSizes = Nest.getTileSizes();
+
+    std::set<std::string> NestVars;
+    for (auto &D : Dims)
+        NestVars.insert(D.VarName);
+
+    bool Rectangular = !AssignsAnyVar(Nest.getBody().get(), NestVars);
+    for (auto &D : Dims) {
+        if (ReferencesAnyVar(D.Start.get(), NestVars) || ReferencesAnyVar(D.End.get(), NestVars) ||
+            ReferencesAnyVar(D.Step.get(), NestVars))
+            Rectangular = false;
+    }
+
+    if (!Rectangular) {
+        if (!TileSizes.empty() || Nest.shouldInterchange())
+            fprintf(stderr, "Note: loop nest bounds are not rectangular, tiling/interchange skipped\n");
+        return LowerPlainNest(Dims, std::move(Nest.getBody()), Nest.getHints());
+    }
+
+    const size_t N = Dims.size();
+    const bool Tiled = !TileSizes.empty();
+
+    // Loop order, outermost first.
+    std::vector<size_t> Order(N);
+    std::iota(Order.begin(), Order.end(), 0);
+    if (Nest.shouldInterchange())
+        std::reverse(Order.begin(), Order.end());
+
+    // Point loops, built from the innermost outwards. Hints go on the innermost loop.
+    std::unique_ptr<ExprAST> Inner = std::move(Nest.getBody());
+    for (size_t k = N; k-- > 0;) {
+        const LoopDim &D = Dims[Order[k]];
+        auto Start = Var(Hidden(D.VarName, Tiled ? "t" : "lo"));
+        auto End = Var(Hidden(D.VarName, Tiled ? "e" : "hi"));
+        Inner = For(D.VarName, std::move(Start), Bin('<', Var(D.VarName), std::move(End)),
+                    Var(Hidden(D.VarName, "st")), std::move(Inner), k + 1 == N ? Nest.getHints() : LoopHints());
+    }
+
+    if (Tiled) {
+        // Clamp each tile to the upper bound, once per tile.
+        VarList TileEnds;
+        for (size_t k = 0; k < N; ++k) {
+            const LoopDim &D = Dims[Order[k]];
+            std::string T = Hidden(D.VarName, "t"), TS = Hidden(D.VarName, "ts"), Hi = Hidden(D.VarName, "hi");
+            auto Min = std::make_unique<IfExprAST>(
+                Bin('<', Bin('+', Var(T), Var(TS)), Var(Hi)), Bin('+', Var(T), Var(TS)), Var(Hi));
+            TileEnds.emplace_back(Hidden(D.VarName, "e"), std::move(Min));
+        }
+        Inner = std::make_unique<VarExprAST>(std::move(TileEnds), std::move(Inner));
+
+        for (size_t k = N; k-- > 0;) {
+            const LoopDim &D = Dims[Order[k]];
+            std::string T = Hidden(D.VarName, "t");
+            Inner = For(T, Var(Hidden(D.VarName, "lo")), Bin('<', Var(T), Var(Hidden(D.VarName, "hi"))),
+                        Var(Hidden(D.VarName, "ts")), std::move(Inner));
+        }
+    }
+
+    // The bounds are loop invariant, so an empty dimension makes the whole nest empty.
+    for (size_t k = N; k-- > 0;) {
+        const LoopDim &D = Dims[k];
+        Inner = std::make_unique<IfExprAST>(Bin('<', Var(Hidden(D.VarName, "lo")), Var(Hidden(D.VarName, "hi"))),
+                                            std::move(Inner), Num(0));
+    }
+
+    // Hoisted bounds, evaluated once in source order.
+    VarList Bounds;
+    for (size_t k = 0; k < N; ++k) {
+        LoopDim &D = Dims[k];
+        std::string St = Hidden(D.VarName, "st");
+        Bounds.emplace_back(Hidden(D.VarName, "lo"), std::move(D.Start));
+        Bounds.emplace_back(Hidden(D.VarName, "hi"), std::move(D.End));
+        Bounds.emplace_back(St, D.Step ? std::move(D.Step) : Num(1));
+        if (Tiled)
+            Bounds.emplace_back(Hidden(D.VarName, "ts"), Bin('*', Num(TileSizes[k]), Var(St)));
+    }
+    return std::make_unique<VarExprAST>(std::move(Bounds), std::move(Inner));
+}
+
+//===----------------------------------------------------------------------===//
+// Loop fusion
+//===----------------------------------------------------------------------===//
+
+std::set<char> SequenceOperators;
+
+/// Structural equality of two loop header expressions, where the loop variable VarA of
+/// the first loop corresponds to VarB of the second. Only the node kinds that can appear
+/// in a side-effect free header are compared; anything else is treated as different.
+static bool HeaderExprEquals(ExprAST *A, ExprAST *B, const std::string &VarA, const std::string &VarB) {
+    if (!A || !B)
+        return A == B;
+
+    if (auto *NA = llvm::dyn_cast<NumberExprAST>(A)) {
+        auto *NB = llvm::dyn_cast<NumberExprAST>(B);
+        return NB && NA->getVal() == NB->getVal();
+    }
+    if (auto *VA = llvm::dyn_cast<VariableExprAST>(A)) {
+        auto *VB = llvm::dyn_cast<VariableExprAST>(B);
+        if (!VB)
+            return false;
+        bool IsLoopA = VA->getName() == VarA, IsLoopB = VB->getName() == VarB;
+        return IsLoopA == IsLoopB && (IsLoopA || VA->getName() == VB->getName());
+    }
+
+    if (auto *BA = llvm::dyn_cast<BinaryExprAST>(A)) {
+        auto *BB = llvm::dyn_cast<BinaryExprAST>(B);
+        if (!BB || BA->getOp() != BB->getOp())
+            return false;
+    } else if (!llvm::isa<IfExprAST>(A) || !llvm::isa<IfExprAST>(B)) {
+        return false;
+    }
+
+    std::vector<ExprAST*> ChildrenA, ChildrenB;
+    A->forEachChild([&](std::unique_ptr<ExprAST> &C) { ChildrenA.push_back(C.get()); });
+    B->forEachChild([&](std::unique_ptr<ExprAST> &C) { ChildrenB.push_back(C.get()); });
+    if (ChildrenA.size() != ChildrenB.size())
+        return false;
+    for (size_t i = 0; i < ChildrenA.size(); ++i) {
+        if (!HeaderExprEquals(ChildrenA[i], ChildrenB[i], VarA, VarB))
+            return false;
+    }
+    return true;
+}
+
+static bool SameHints(const LoopHints &A, const LoopHints &B) {
+    return A.UnrollCount == B.UnrollCount && A.VectorizeWidth == B.VectorizeWidth &&
+           A.InterleaveCount == B.InterleaveCount;
+}
+
+static bool IsPureHeader(ExprAST *E) {
+    std::set<std::string> Assigned;
+    CollectAssignedVars(E, Assigned);
+    return Assigned.empty() && !ContainsCall(E);
+}
+
+/// Two adjacent loops can be fused when they run the same iterations and running the
+/// bodies interleaved cannot be observed:
+///  - start, end and step are side-effect free and identical (modulo the loop variable),
+///    and neither body writes the loop variable or anything the headers read;
+///  - no variable written by one body is read or written by the other, where all array
+///    elements count as the single variable ArrayMemory and a call may access any of them
+///    and any mutable global;
+///  - at most one body makes calls, so the order of external effects is unchanged.
+static bool CanFuseLoops(ForExprAST &A, ForExprAST &B) {
+    const std::string &VA = A.getVarName(), &VB = B.getVarName();
+
+    if (!SameHints(A.getHints(), B.getHints()))
+        return false;
+    if (!IsPureHeader(A.getStart()) || !IsPureHeader(A.getEnd()) || !IsPureHeader(A.getStep()) ||
+        !IsPureHeader(B.getStart()) || !IsPureHeader(B.getEnd()) || !IsPureHeader(B.getStep()))
+        return false;
+
+    // The start value is evaluated outside the loop, so no renaming applies to it.
+    if (!HeaderExprEquals(A.getStart(), B.getStart(), "", ""))
+        return false;
+    if (!HeaderExprEquals(A.getEnd(), B.getEnd(), VA, VB))
+        return false;
+    // A missing step means 1.0
+    NumberExprAST One(1.0);
+    if (!HeaderExprEquals(A.getStep() ? A.getStep() : &One, B.getStep() ? B.getStep() : &One, VA, VB))
+        return false;
+
+    std::set<std::string> ReadsA, ReadsB, WritesA, WritesB, HeaderReads;
+    CollectVarRefs(A.getBody(), ReadsA);
+    CollectVarRefs(B.getBody(), ReadsB);
+    CollectAssignedVars(A.getBody(), WritesA);
+    CollectAssignedVars(B.getBody(), WritesB);
+    CollectVarRefs(A.getStart(), HeaderReads);
+    CollectVarRefs(A.getEnd(), HeaderReads);
+    CollectVarRefs(A.getStep(), HeaderReads);
+    HeaderReads.insert(VA);
+    CollectVarRefs(B.getEnd(), HeaderReads);
+    CollectVarRefs(B.getStep(), HeaderReads);
+    HeaderReads.insert(VB);
+    // Callees can read and write arrays they are passed, and any mutable global
+    std::set<std::string> CallEffects = {ArrayMemory};
+    CollectMutableGlobals(CallEffects);
+    if (ContainsCall(A.getBody())) {
+        ReadsA.insert(CallEffects.begin(), CallEffects.end());
+        WritesA.insert(CallEffects.begin(), CallEffects.end());
+    }
+    if (ContainsCall(B.getBody())) {
+        ReadsB.insert(CallEffects.begin(), CallEffects.end());
+        WritesB.insert(CallEffects.begin(), CallEffects.end());
+    }
+
+    auto Intersects = [](const std::set<std::string> &X, const std::set<std::string> &Y) {
+        for (auto &Name : X)
+            if (Y.count(Name))
+                return true;
+        return false;
+    };
+
+    if (Intersects(WritesA, HeaderReads) || Intersects(WritesB, HeaderReads))
+        return false;
+    if (Intersects(WritesA, ReadsB) || Intersects(WritesB, ReadsA))
+        return false;
+    // B's body moves into the scope of A's loop variable.
+    if (VA != VB && ReadsB.count(VA))
+        return false;
+    if (ContainsCall(A.getBody()) && ContainsCall(B.getBody()))
+        return false;
+    return true;
+}
+
+/// for i = s, e, st in A  then  for j = s, e, st in B
+///   ==>  for i = s, e, st in (var seq. = A in (var j = i in B))
+static std::unique_ptr<ExprAST> FuseLoops(ForExprAST &A, ForExprAST &B) {
+    std::unique_ptr<ExprAST> BodyB = B.takeBody();
+    if (A.getVarName() != B.getVarName()) {
+        VarList Alias;
+        Alias.emplace_back(B.getVarName(), Var(A.getVarName()));
+        BodyB = std::make_unique<VarExprAST>(std::move(Alias), std::move(BodyB));
+    }
+
+    // Sequence the bodies with a var binding rather than a call to the user's operator.
+    VarList Seq;
+    Seq.emplace_back("seq.", A.takeBody());
+    auto Body = std::make_unique<VarExprAST>(std::move(Seq), std::move(BodyB));
+
+    return For(A.getVarName(), A.takeStart(), A.takeEnd(), A.takeStep(), std::move(Body), A.getHints());
+}
+
+/// Sequences parse left-associatively, so "p : A : B" is ((p : A) : B). The loop to fuse
+/// with B is the LHS itself, or the last element of the LHS sequence.
+std::unique_ptr<ExprAST> FuseAdjacentLoops(std::unique_ptr<ExprAST> E) {
+    auto *Seq = llvm::dyn_cast<BinaryExprAST>(E.get());
+    if (!Seq || !SequenceOperators.count(Seq->getOp()))
+        return E;
+
+    auto *Second = llvm::dyn_cast<ForExprAST>(Seq->getRHS());
+    if (!Second)
+        return E;
+
+    std::unique_ptr<ExprAST> *FirstSlot = &Seq->getLHSPtr();
+    auto *LHSSeq = llvm::dyn_cast<BinaryExprAST>(FirstSlot->get());
+    if (LHSSeq && LHSSeq->getOp() == Seq->getOp())
+        FirstSlot = &LHSSeq->getRHSPtr();
+
+    auto *First = llvm::dyn_cast<ForExprAST>(FirstSlot->get());
+    if (!First || !CanFuseLoops(*First, *Second))
+        return E;
+
+    // Both loops evaluate to 0.0, so the fused loop can stand in for the whole pair.
+    *FirstSlot = FuseLoops(*First, *Second);
+    return std::move(Seq->getLHSPtr());
+}
+
+//===----------------------------------------------------------------------===//
+// Driver
+//===----------------------------------------------------------------------===//
+
+std::unique_ptr<ExprAST> TransformAST(std::unique_ptr<ExprAST> E) {
+    if (!E)
+        return E;
+
+    // Children first, so every transformation sees already-rewritten subtrees.
+    E->forEachChild([](std::unique_ptr<ExprAST> &Child) {
+        Child = TransformAST(std::move(Child));
+    });
+
+    if (auto *Nest = llvm::dyn_cast<ForNestExprAST>(E.get()))
+        return LowerLoopNest(*Nest);
+    return FuseAdjacentLoops(std::move(E));
+}
@@ -0,0 +1,33 @@
+#ifndef TRANSFORMS_H
+#define TRANSFORMS_H
+
+#include "ast.h"
+#include <memory>
+#include <set>
+#include <string>
+
+// AST-level transformations, run on every function body before codegen.
+
+// Run all AST transformations bottom-up over E and return the rewritten tree.
+std::unique_ptr<ExprAST> TransformAST(std::unique_ptr<ExprAST> E);
+
+// Rewrite a loop nest into plain ForExprAST loops, tiled and interchanged when its bounds allow it.
+std::unique_ptr<ExprAST> LowerLoopNest(ForNestExprAST &Nest);
+
+// Binary operators the user defined as "def binary<op> (x y) y", i.e. pure sequencing.
+// Loop fusion only looks through these.
+extern std::set<char> SequenceOperators;
+
+// Fuse "A <seq> B" when A and B are compatible for loops; returns E unchanged otherwise.
+std::unique_ptr<ExprAST> FuseAdjacentLoops(std::unique_ptr<ExprAST> E);
+
+// Analysis helpers. CollectVarRefs/CollectAssignedVars report any access to an array
+// element as the pseudo variable ArrayMemory.
+extern const std::string ArrayMemory;
+bool ReferencesAnyVar(ExprAST *E, const std::set<std::string> &Names);
+bool AssignsAnyVar(ExprAST *E, const std::set<std::string> &Names);
+void CollectVarRefs(ExprAST *E, std::set<std::string> &Names);
+void CollectAssignedVars(ExprAST *E, std::set<std::string> &Names);
+bool ContainsCall(ExprAST *E);
+
+#endif // TRANSFORMS_H
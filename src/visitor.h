@@ -0,0 +1,48 @@
+#ifndef VISITOR_H
+#define VISITOR_H
+
+#include "ast.h"
+#include "llvm/Support/ErrorHandling.h"
+
+// ExprVisitor - dispatch on the kind of an expression node without virtual calls, in
+// the style of llvm::InstVisitor. A pass derives from ExprVisitor<Pass, Result> and
+// defines visitNumber(NumberExprAST *), visitBinary(BinaryExprAST *), ... for the
+// kinds it cares about; the others fall back to visitExpr(ExprAST *), which does
+// nothing unless the pass overrides it.
+//
+//   struct CountCalls : ExprVisitor<CountCalls> {
+//       unsigned N = 0;
+//       void visitExpr(ExprAST *E) { visitChildren(E); }
+//       void visitCall(CallExprAST *E) { ++N; visitChildren(E); }
+//   };
+//
+// visit() is a switch on getKind(), and the calls it makes are resolved statically,
+// so small handlers are inlined into it.
+template <typename SubClass, typename RetTy = void>
+class ExprVisitor {
+    SubClass &derived() { return *static_cast<SubClass*>(this); }
+public:
+    RetTy visit(ExprAST *E) {
+        assert(E && "visiting a null expression");
+        switch (E->getKind()) {
+#define EXPR_VISIT(Name) \
+        case ExprAST::EK_##Name: return derived().visit##Name(static_cast<Name##ExprAST*>(E));
+        EXPR_NODES(EXPR_VISIT)
+#undef EXPR_VISIT
+        }
+        llvm_unreachable("unknown expression kind");
+    }
+
+    // Visit every direct child in source order, the traversal shared by all passes.
+    void visitChildren(ExprAST *E) {
+        E->forEachChild([this](std::unique_ptr<ExprAST> &Child) { derived().visit(Child.get()); });
+    }
+
+    RetTy visitExpr(ExprAST *E) { return RetTy(); }
+#define EXPR_VISIT(Name) \
+    RetTy visit##Name(Name##ExprAST *E) { return derived().visitExpr(E); }
+    EXPR_NODES(EXPR_VISIT)
+#undef EXPR_VISIT
+};
+
+#endif // VISITOR_H
@@ -0,0 +1,54 @@
+# Run one smoke test script through the REPL:
+#
+#   cmake -DREPL=<path to kaledio_lang> -DSCRIPT=<script.kal> [-DARGS="<options>"]
+#         [-DLOOPBACK=ON] -P tests/run_script.cmake
+#
+# The REPL has to exit cleanly, report no errors, and print the text of every
+# "# expect: <text>" comment in the script, in that order. With LOOPBACK (POSIX
+# only), file descriptors 3 and 4 are the read and write ends of one pipe, so a
+# script can read back what it wrote.
+if(NOT REPL OR NOT SCRIPT)
+    message(FATAL_ERROR "set REPL to the kaledio_lang executable and SCRIPT to the script")
+endif()
+
+separate_arguments(ARGS UNIX_COMMAND "${ARGS}")
+set(COMMAND "${REPL}" --echo=results ${ARGS})
+if(LOOPBACK)
+    get_filename_component(NAME "${SCRIPT}" NAME_WE)
+    set(FIFO "${CMAKE_CURRENT_BINARY_DIR}/${NAME}.fifo")
+    file(REMOVE "${FIFO}")
+    execute_process(COMMAND mkfifo "${FIFO}" RESULT_VARIABLE RESULT)
+    if(NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "cannot create the pipe ${FIFO}")
+    endif()
+    # Opening the FIFO for reading and writing first does not wait for a writer.
+    set(COMMAND sh -c "exec \"$@\" 3<>\"${FIFO}\" 4>\"${FIFO}\"" sh ${COMMAND})
+endif()
+execute_process(
+    COMMAND ${COMMAND}
+    INPUT_FILE "${SCRIPT}"
+    OUTPUT_VARIABLE OUT
+    ERROR_VARIABLE OUT
+    RESULT_VARIABLE RESULT)
+if(LOOPBACK)
+    file(REMOVE "${FIFO}")
+endif()
+if(NOT RESULT EQUAL 0)
+    message(FATAL_ERROR "kaledio_lang exited with ${RESULT}:\n${OUT}")
+endif()
+if(OUT MATCHES "Error")
+    message(FATAL_ERROR "${SCRIPT} reported errors:\n${OUT}")
+endif()
+
+file(STRINGS "${SCRIPT}" EXPECTED REGEX "^# expect: ")
+set(REST "${OUT}")
+foreach(LINE ${EXPECTED})
+    string(REPLACE "# expect: " "" TEXT "${LINE}")
+    string(FIND "${REST}" "${TEXT}" AT)
+    if(AT EQUAL -1)
+        message(FATAL_ERROR "missing \"${TEXT}\" in the output of ${SCRIPT}:\n${OUT}")
+    endif()
+    string(LENGTH "${TEXT}" LEN)
+    math(EXPR AT "${AT} + ${LEN}")
+    string(SUBSTRING "${REST}" ${AT} -1 REST)
+endforeach()